@@ -0,0 +1,968 @@
+#include "CompiledScene.h"
+#include "TriMesh.h"
+
+// below this many bounded primitives walking the arrays beats the BVH
+static const int BVH_MIN_PRIMS = 8;
+static const int BVH_LEAF_SIZE = 4;
+static const int BVH_BINS = 16;
+static const float MESH_EXACT_BAND = 0.05f;   // of MeshPrim::margin, see meshSdf
+
+//--------------------------------------------------------------
+// Primitive distance functions, same maths as the sdf() of each SceneObject.
+//
+static inline float sphereSdf(const SpherePrim& s, const glm::vec3& p) {
+    return glm::length(s.center - p) - s.radius;
+}
+
+static inline float torusSdf(const TorusPrim& t, const glm::vec3& p) {
+    glm::vec3 local = t.toLocal.apply(p);
+    glm::vec2 q(glm::length(glm::vec2(local.x, local.y)) - t.t.x, local.z);
+    return glm::length(q) - t.t.y;
+}
+
+static inline float hollowSphereSdf(const HollowSpherePrim& h, const glm::vec3& p) {
+    glm::vec3 local = h.toLocal.apply(p);
+    glm::vec2 q(glm::length(glm::vec2(local.x, local.y)), local.z);
+    return ((h.rht.y * q.x < h.w * q.y) ? glm::length(q - glm::vec2(h.w, h.rht.y)) : abs(glm::length(q) - h.rht.x)) - h.rht.z;
+}
+
+// far from the mesh its box is a cheap lower bound, the BVH query runs near
+// it and is exact only within MESH_EXACT_BAND * margin of the surface, well
+// above any hit threshold; further out a lower bound is all a step needs
+static inline float meshSdf(const MeshPrim& m, const glm::vec3& p) {
+    glm::vec3 local = m.toMesh.apply(p);
+    float outside = m.mesh->bounds.distance(local);
+    if (outside > m.margin)
+        return outside * m.scale;
+    return m.mesh->lowerBound(local, MESH_EXACT_BAND * m.margin) * m.scale;
+}
+
+//--------------------------------------------------------------
+// The same distances with their gradient. The rotated primitives work out the
+// gradient in local space and rotate it back with the transpose (toLocal is a
+// rotation plus translation). Gradients are unit length away from the
+// degenerate points (centre, axis), where any direction is returned.
+//
+static inline float sphereSdfGradient(const SpherePrim& s, const glm::vec3& p, glm::vec3& grad) {
+    glm::vec3 v = p - s.center;
+    float len = glm::length(v);
+    grad = (len > 0) ? v / len : glm::vec3(0, 1, 0);
+    return len - s.radius;
+}
+
+// d/dlocal of a function of q = (length(local.xy), local.z), given dq
+static inline glm::vec3 radialGradient(const glm::vec3& local, float rxy, const glm::vec2& dq) {
+    glm::vec2 dir = (rxy > 0) ? glm::vec2(local.x, local.y) / rxy : glm::vec2(1, 0);
+    return glm::vec3(dq.x * dir.x, dq.x * dir.y, dq.y);
+}
+
+static inline float torusSdfGradient(const TorusPrim& t, const glm::vec3& p, glm::vec3& grad) {
+    glm::vec3 local = t.toLocal.apply(p);
+    float rxy = glm::length(glm::vec2(local.x, local.y));
+    glm::vec2 q(rxy - t.t.x, local.z);
+    float len = glm::length(q);
+    glm::vec2 dq = (len > 0) ? q / len : glm::vec2(1, 0);
+    grad = glm::transpose(t.toLocal.rotate) * radialGradient(local, rxy, dq);
+    return len - t.t.y;
+}
+
+static inline float hollowSphereSdfGradient(const HollowSpherePrim& h, const glm::vec3& p, glm::vec3& grad) {
+    glm::vec3 local = h.toLocal.apply(p);
+    float rxy = glm::length(glm::vec2(local.x, local.y));
+    glm::vec2 q(rxy, local.z);
+    float d;
+    glm::vec2 dq;
+    if (h.rht.y * q.x < h.w * q.y) {
+        //closest to the rim circle
+        glm::vec2 v = q - glm::vec2(h.w, h.rht.y);
+        float len = glm::length(v);
+        dq = (len > 0) ? v / len : glm::vec2(0, 1);
+        d = len;
+    }
+    else {
+        //closest to the shell, inside or outside
+        float len = glm::length(q);
+        float side = (len < h.rht.x) ? -1.0f : 1.0f;
+        dq = (len > 0) ? side * q / len : glm::vec2(0, 1);
+        d = abs(len - h.rht.x);
+    }
+    grad = glm::transpose(h.toLocal.rotate) * radialGradient(local, rxy, dq);
+    return d - h.rht.z;
+}
+
+// toMesh.rotate is the rotation over scale, its transpose times scale turns back
+static inline float meshSdfGradient(const MeshPrim& m, const glm::vec3& p, glm::vec3& grad) {
+    glm::vec3 localGrad;
+    float d = m.mesh->distance(m.toMesh.apply(p), &localGrad);
+    grad = glm::normalize(glm::transpose(m.toMesh.rotate) * localGrad);
+    return d * m.scale;
+}
+
+//--------------------------------------------------------------
+// The same distances over a box of points, in interval arithmetic (see
+// CompiledScene::primInterval).
+//
+static inline Interval sphereInterval(const SpherePrim& s, const Interval3& p) {
+    return length(p[0] - s.center.x, p[1] - s.center.y, p[2] - s.center.z) - s.radius;
+}
+
+static inline Interval torusInterval(const TorusPrim& t, const Interval3& p) {
+    Interval3 local = t.toLocal.apply(p);
+    return length(length(local[0], local[1]) - t.t.x, local[2]) - t.t.y;
+}
+
+static inline Interval hollowSphereInterval(const HollowSpherePrim& h, const Interval3& p) {
+    Interval3 local = h.toLocal.apply(p);
+    Interval qx = length(local[0], local[1]), qy = local[2];
+    Interval side = qx * h.rht.y - qy * h.w;
+    Interval rim = length(qx - h.w, qy - h.rht.y);
+    Interval shell = abs(length(qx, qy) - h.rht.x);
+    //the box can straddle the cone between rim and shell
+    Interval d = (side.hi < 0) ? rim : (side.lo >= 0) ? shell : hull(rim, shell);
+    return d - h.rht.z;
+}
+
+// only the mesh box is known here: no closer than the gap between the boxes
+static inline Interval meshInterval(const MeshPrim& m, const Interval3& p) {
+    Interval3 local = m.toMesh.apply(p);
+    const Bounds& b = m.mesh->bounds;
+    glm::vec3 gap;
+    for (int a = 0; a < 3; a++)
+        gap[a] = std::max(0.0f, std::max(b.min[a] - local[a].hi, local[a].lo - b.max[a]));
+    float lo = glm::length(gap);
+    return Interval((lo > 0) ? lo * m.scale : -INFINITY, INFINITY);
+}
+
+static Interval csgShapeInterval(int type, const glm::vec3& size, const Interval3& p) {
+    switch (type) {
+    case CSG_SPHERE:
+        return length(p[0], p[1], p[2]) - size.x;
+    case CSG_BOX: {
+        Interval q[3];
+        for (int a = 0; a < 3; a++)
+            q[a] = abs(p[a]) - size[a];
+        Interval outside = length(max(q[0], 0), max(q[1], 0), max(q[2], 0));
+        return outside + min(max(q[0], max(q[1], q[2])), 0);
+    }
+    case CSG_TORUS:
+        return length(length(p[0], p[1]) - size.x, p[2]) - size.y;
+    default: {
+        Interval dx = length(p[0], p[2]) - size.x, dy = abs(p[1]) - size.y;
+        return min(max(dx, dy), 0) + length(max(dx, 0), max(dy, 0));
+    }
+    }
+}
+
+//--------------------------------------------------------------
+// the coordinates x (cell centre of cell 0 at origin) can have once moved
+// into the nearest cell of a repetition with cells cellMin .. cellMax along
+// the axis: the box moved by its cell when it stays in one, otherwise
+// everything from its own part of the first cell to that of the last
+//
+static Interval foldInterval(const Interval& x, float origin, float period, float cellMin, float cellMax) {
+    float first = std::min(std::max(floor((x.lo - origin) / period + 0.5f), cellMin), cellMax);
+    float last = std::min(std::max(floor((x.hi - origin) / period + 0.5f), cellMin), cellMax);
+    if (first == last)
+        return x - first * period;
+    return Interval(std::min(x.lo - first * period, origin - 0.5f * period), std::max(x.hi - last * period, origin + 0.5f * period));
+}
+
+//--------------------------------------------------------------
+bool Bounds::clip(const glm::vec3& o, const glm::vec3& d, float& tNear, float& tFar) const {
+    glm::vec3 inv = 1.0f / d;
+    glm::vec3 t1 = (min - o) * inv;
+    glm::vec3 t2 = (max - o) * inv;
+    glm::vec3 tMin = glm::min(t1, t2), tMax = glm::max(t1, t2);
+    tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+    tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+    return tFar >= std::max(tNear, 0.0f);
+}
+
+//--------------------------------------------------------------
+float Repetition::random(const glm::ivec3& cell, int salt) {
+    unsigned int h = unsigned(cell.x) * 73856093u ^ unsigned(cell.y) * 19349663u ^ unsigned(cell.z) * 83492791u
+        ^ unsigned(salt) * 2654435761u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) / 16777216.0f;
+}
+
+//--------------------------------------------------------------
+void CompiledScene::clear() {
+    spheres.clear();
+    planes.clear();
+    tori.clear();
+    hollowSpheres.clear();
+    csgModels.clear();
+    meshes.clear();
+    csgCode.clear();
+    csgShapes.clear();
+    csgRepeats.clear();
+    repetitions.clear();
+    repeated.clear();
+    plainSpheres = plainTori = plainHollowSpheres = plainCsgModels = plainMeshes = 0;
+    nodes.clear();
+    bvhPrims.clear();
+    bounds = Bounds();
+    bounded = false;
+    objectPrims.clear();
+}
+
+//--------------------------------------------------------------
+// Conservative box around each primitive. The rotated ones put their local
+// box through the local -> world rotation (transpose of toLocal) using the
+// absolute matrix, which bounds every orientation of the box.
+//
+Bounds CompiledScene::primBounds(const PrimRef& prim) const {
+    Bounds b;
+    glm::vec3 center, extent;
+    if (prim.type == PRIM_REPEATED)
+        return repeated[prim.index].bounds;
+    if (prim.type == PRIM_CSG)
+        return csgModels[prim.index].bounds;
+    if (prim.type == PRIM_MESH)
+        return meshes[prim.index].bounds;
+    if (prim.type == PRIM_SPHERE) {
+        const SpherePrim& s = spheres[prim.index];
+        center = s.center;
+        extent = glm::vec3(s.radius);
+    }
+    else if (prim.type == PRIM_TORUS) {
+        const TorusPrim& t = tori[prim.index];
+        glm::mat3 toWorld = glm::transpose(t.toLocal.rotate);
+        center = -(toWorld * t.toLocal.translate);
+        glm::vec3 local(t.t.x + t.t.y, t.t.x + t.t.y, t.t.y);
+        for (int i = 0; i < 3; i++)
+            extent[i] = abs(toWorld[0][i]) * local.x + abs(toWorld[1][i]) * local.y + abs(toWorld[2][i]) * local.z;
+    }
+    else {
+        const HollowSpherePrim& h = hollowSpheres[prim.index];
+        center = -(glm::transpose(h.toLocal.rotate) * h.toLocal.translate);
+        extent = glm::vec3(h.rht.x + h.rht.z);
+    }
+    b.min = center - extent;
+    b.max = center + extent;
+    return b;
+}
+
+//--------------------------------------------------------------
+void CompiledScene::build() {
+    nodes.clear();
+    bvhPrims.clear();
+    repeated.clear();
+    bounds = Bounds();
+
+    //unrepeated primitives to the front of their arrays
+    auto plain = [&](int obj) { return obj >= (int)repetitions.size() || !repetitions[obj].enabled(); };
+    plainSpheres = int(std::stable_partition(spheres.begin(), spheres.end(),
+        [&](const SpherePrim& s) { return plain(s.obj); }) - spheres.begin());
+    plainTori = int(std::stable_partition(tori.begin(), tori.end(),
+        [&](const TorusPrim& t) { return plain(t.obj); }) - tori.begin());
+    plainHollowSpheres = int(std::stable_partition(hollowSpheres.begin(), hollowSpheres.end(),
+        [&](const HollowSpherePrim& h) { return plain(h.obj); }) - hollowSpheres.begin());
+    plainCsgModels = int(std::stable_partition(csgModels.begin(), csgModels.end(),
+        [&](const CsgModel& m) { return plain(m.obj) || !m.finite(); }) - csgModels.begin());
+    plainMeshes = int(std::stable_partition(meshes.begin(), meshes.end(),
+        [&](const MeshPrim& m) { return plain(m.obj); }) - meshes.begin());
+    for (int i = plainSpheres; i < spheres.size(); i++)
+        addRepeated({ PRIM_SPHERE, i });
+    for (int i = plainTori; i < tori.size(); i++)
+        addRepeated({ PRIM_TORUS, i });
+    for (int i = plainHollowSpheres; i < hollowSpheres.size(); i++)
+        addRepeated({ PRIM_HOLLOW_SPHERE, i });
+    for (int i = plainCsgModels; i < csgModels.size(); i++)
+        addRepeated({ PRIM_CSG, i });
+    for (int i = plainMeshes; i < meshes.size(); i++)
+        addRepeated({ PRIM_MESH, i });
+
+    vector<Bounds> primBox;
+    bool endless = false;
+    for (int i = 0; i < plainSpheres; i++)
+        bvhPrims.push_back({ PRIM_SPHERE, i });
+    for (int i = 0; i < plainTori; i++)
+        bvhPrims.push_back({ PRIM_TORUS, i });
+    for (int i = 0; i < plainHollowSpheres; i++)
+        bvhPrims.push_back({ PRIM_HOLLOW_SPHERE, i });
+    for (int i = 0; i < plainCsgModels; i++) {
+        if (csgModels[i].finite())
+            bvhPrims.push_back({ PRIM_CSG, i });
+        else
+            endless = true;
+    }
+    for (int i = 0; i < plainMeshes; i++)
+        bvhPrims.push_back({ PRIM_MESH, i });
+    for (int i = 0; i < repeated.size(); i++) {
+        if (repeated[i].endless)
+            endless = true;
+        else
+            bvhPrims.push_back({ PRIM_REPEATED, i });
+    }
+    for (int i = 0; i < bvhPrims.size(); i++) {
+        primBox.push_back(primBounds(bvhPrims[i]));
+        bounds.grow(primBox.back());
+    }
+
+    //object -> primitive lookup for hit normals
+    objectPrims.clear();
+    vector<PrimRef> all = bvhPrims;
+    for (int i = 0; i < planes.size(); i++)
+        all.push_back({ PRIM_PLANE, i });
+    for (int i = 0; i < repeated.size(); i++)
+        if (repeated[i].endless)
+            all.push_back({ PRIM_REPEATED, i });
+    for (int i = 0; i < plainCsgModels; i++)
+        if (!csgModels[i].finite())
+            all.push_back({ PRIM_CSG, i });
+    for (int i = 0; i < all.size(); i++) {
+        int obj = primObject(all[i]);
+        if (obj >= (int)objectPrims.size())
+            objectPrims.resize(obj + 1, { PRIM_NONE, 0 });
+        objectPrims[obj] = all[i];
+    }
+
+    //planes and endless repetition reach infinity, the scene box is only used without them
+    bounded = !endless && planes.empty() && !bvhPrims.empty();
+
+    if (bvhPrims.size() >= BVH_MIN_PRIMS) {
+        nodes.reserve(2 * bvhPrims.size());
+        nodes.push_back(BVHNode());
+        buildNode(0, bvhPrims, primBox, 0, (int)bvhPrims.size());
+    }
+}
+
+//--------------------------------------------------------------
+// RepeatedPrim for a primitive behind the plain ones. The copies' box grows
+// with the largest size jitter.
+//
+void CompiledScene::addRepeated(const PrimRef& prim) {
+    RepeatedPrim r;
+    r.prim = prim;
+    r.obj = primObject(prim);
+    r.repetition = repetitions[r.obj];
+    Bounds copy = primBounds(prim);
+    r.origin = copy.center();
+    float largest = 1 + std::max(r.repetition.sizeJitter, 0.0f);
+    r.cellBox.min = (copy.min - r.origin) * largest;
+    r.cellBox.max = (copy.max - r.origin) * largest;
+    if (prim.type == PRIM_SPHERE)
+        r.radius = spheres[prim.index].radius * largest;
+    else if (prim.type == PRIM_TORUS)
+        r.radius = (tori[prim.index].t.x + tori[prim.index].t.y) * largest;
+    else if (prim.type == PRIM_CSG || prim.type == PRIM_MESH)
+        r.radius = 0.5f * glm::length(copy.max - copy.min) * largest;
+    else
+        r.radius = (hollowSpheres[prim.index].rht.x + hollowSpheres[prim.index].rht.z) * largest;
+    r.endless = r.repetition.endless();
+    r.clearance = INFINITY;
+    for (int a = 0; a < 3; a++) {
+        r.period[a] = (r.repetition.period[a] > 0) ? r.repetition.period[a] : 1;
+        r.invPeriod[a] = 1 / r.period[a];
+        r.cellMin[a] = r.repetition.firstCell(a);
+        r.cellMax[a] = r.repetition.lastCell(a);
+        bool endlessAxis = r.cellMax[a] == ENDLESS_CELLS;
+        r.bounds.min[a] = endlessAxis ? -INFINITY : r.origin[a] + r.cellMin[a] * r.period[a] + r.cellBox.min[a];
+        r.bounds.max[a] = endlessAxis ? INFINITY : r.origin[a] + r.cellMax[a] * r.period[a] + r.cellBox.max[a];
+        r.halfCell[a] = (r.cellMin[a] < r.cellMax[a]) ? 0.5f * r.period[a] : INFINITY;
+        r.clearance = std::min(r.clearance, r.halfCell[a] - std::max(r.cellBox.max[a], -r.cellBox.min[a]));
+    }
+    repeated.push_back(r);
+}
+
+//--------------------------------------------------------------
+// Top down build with binned surface area heuristic. Fills nodes[nodeIndex]
+// for prims[first .. first + count). Both children are allocated together so
+// they sit next to each other.
+//
+void CompiledScene::buildNode(int nodeIndex, vector<PrimRef>& prims, vector<Bounds>& primBox, int first, int count) {
+    Bounds box, centroids;
+    for (int i = first; i < first + count; i++) {
+        box.grow(primBox[i]);
+        centroids.grow(primBox[i].center());
+    }
+    nodes[nodeIndex].bounds = box;
+    nodes[nodeIndex].first = first;
+    nodes[nodeIndex].count = count;
+    if (count <= BVH_LEAF_SIZE)
+        return;
+
+    //split along the widest axis of the centroids
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+    if (extent[axis] <= 0)
+        return;
+
+    Bounds binBox[BVH_BINS];
+    int binCount[BVH_BINS] = { 0 };
+    float scale = BVH_BINS / extent[axis];
+    for (int i = first; i < first + count; i++) {
+        int b = std::min(BVH_BINS - 1, int((primBox[i].center()[axis] - centroids.min[axis]) * scale));
+        binBox[b].grow(primBox[i]);
+        binCount[b]++;
+    }
+
+    //cost of splitting after each bin, sweeping from both sides
+    float rightCost[BVH_BINS];
+    Bounds accum;
+    int accumCount = 0;
+    for (int b = BVH_BINS - 1; b > 0; b--) {
+        accum.grow(binBox[b]);
+        accumCount += binCount[b];
+        rightCost[b] = accumCount ? accumCount * accum.area() : 0;
+    }
+    int bestSplit = -1;
+    float bestCost = count * box.area();   // cost of keeping a leaf
+    accum = Bounds();
+    accumCount = 0;
+    for (int b = 0; b < BVH_BINS - 1; b++) {
+        accum.grow(binBox[b]);
+        accumCount += binCount[b];
+        if (accumCount == 0 || accumCount == count)
+            continue;
+        float cost = accumCount * accum.area() + rightCost[b + 1];
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+    if (bestSplit < 0)
+        return;
+
+    //partition prims by bin
+    int mid = first;
+    for (int i = first; i < first + count; i++) {
+        int b = std::min(BVH_BINS - 1, int((primBox[i].center()[axis] - centroids.min[axis]) * scale));
+        if (b <= bestSplit) {
+            std::swap(prims[i], prims[mid]);
+            std::swap(primBox[i], primBox[mid]);
+            mid++;
+        }
+    }
+
+    int left = (int)nodes.size();
+    nodes[nodeIndex].first = left;
+    nodes[nodeIndex].count = 0;
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    buildNode(left, prims, primBox, first, mid - first);
+    buildNode(left + 1, prims, primBox, mid, first + count - mid);
+}
+
+//--------------------------------------------------------------
+bool CompiledScene::clipRay(const glm::vec3& o, const glm::vec3& d, float& tNear, float& tFar) const {
+    tNear = 0;
+    tFar = INFINITY;
+    if (!bounded)
+        return true;
+    if (!bounds.clip(o, d, tNear, tFar))
+        return false;
+    tNear = std::max(tNear, 0.0f);
+    return true;
+}
+
+//--------------------------------------------------------------
+float CompiledScene::primSdf(const PrimRef& prim, const glm::vec3& p, int& objIndex) const {
+    switch (prim.type) {
+    case PRIM_SPHERE:
+        objIndex = spheres[prim.index].obj;
+        return sphereSdf(spheres[prim.index], p);
+    case PRIM_TORUS:
+        objIndex = tori[prim.index].obj;
+        return torusSdf(tori[prim.index], p);
+    case PRIM_REPEATED:
+        return repeatedSdf(repeated[prim.index], p, objIndex);
+    case PRIM_CSG:
+        objIndex = csgModels[prim.index].obj;
+        return csgSdf(csgModels[prim.index], p);
+    case PRIM_MESH:
+        objIndex = meshes[prim.index].obj;
+        return meshSdf(meshes[prim.index], p);
+    case PRIM_PLANE:
+        objIndex = planes[prim.index].obj;
+        return p.y - planes[prim.index].height;
+    default:
+        objIndex = hollowSpheres[prim.index].obj;
+        return hollowSphereSdf(hollowSpheres[prim.index], p);
+    }
+}
+
+//--------------------------------------------------------------
+int CompiledScene::primObject(const PrimRef& prim) const {
+    switch (prim.type) {
+    case PRIM_SPHERE:
+        return spheres[prim.index].obj;
+    case PRIM_TORUS:
+        return tori[prim.index].obj;
+    case PRIM_HOLLOW_SPHERE:
+        return hollowSpheres[prim.index].obj;
+    case PRIM_REPEATED:
+        return repeated[prim.index].obj;
+    case PRIM_CSG:
+        return csgModels[prim.index].obj;
+    case PRIM_MESH:
+        return meshes[prim.index].obj;
+    default:
+        return planes[prim.index].obj;
+    }
+}
+
+//--------------------------------------------------------------
+// the copy in cell: the primitive at its place in cell (0, 0, 0) evaluated
+// at p moved into that cell and scaled by the copy's size
+//
+float CompiledScene::cellSdf(const RepeatedPrim& r, const glm::vec3& cell, const glm::vec3& p, int& objIndex) const {
+    glm::vec3 local = p - cell * r.period;
+    if (r.repetition.sizeJitter <= 0)
+        return primSdf(r.prim, local, objIndex);
+    float scale = r.repetition.scale(glm::ivec3(cell));
+    return scale * primSdf(r.prim, r.origin + (local - r.origin) / scale, objIndex);
+}
+
+//--------------------------------------------------------------
+// Closest copy of a repeated primitive. The cell p falls in is evaluated
+// first, which is all it takes when that copy is closer than the wall of the
+// cell plus r.clearance. Otherwise along each axis the neighbour cell on
+// either side is only looked at when its copy's bounding sphere is closer
+// than the best distance so far, and the cells of that 3x3x3 block are box
+// tested before evaluating. Cells two or more away are not evaluated at all:
+// the distance to their nearest box along an axis (and to the box of all
+// copies) bounds them from below, so the result is never more than the true
+// distance.
+//
+float CompiledScene::repeatedSdf(const RepeatedPrim& r, const glm::vec3& point, int& objIndex, glm::ivec3* closestCell) const {
+    glm::vec3 p = point - r.origin;
+    glm::vec3 own = glm::clamp(glm::floor(p * r.invPeriod + 0.5f), r.cellMin, r.cellMax);
+    float best = cellSdf(r, own, point, objIndex);
+    if (closestCell)
+        *closestCell = glm::ivec3(own);
+    //every other copy is past the nearest wall of p's cell and then
+    //clearance into its own cell
+    glm::vec3 local = p - own * r.period;
+    glm::vec3 wall = r.halfCell - glm::abs(local);
+    if (best <= r.clearance + std::min(std::min(wall.x, wall.y), wall.z))
+        return best;
+
+    //the neighbour along one axis can only be closer when p reaches into
+    //its bounding sphere
+    glm::ivec3 from(own), to(own);
+    float reach = (best + r.radius) * (best + r.radius);
+    float centre = glm::dot(local, local);
+    for (int a = 0; a < 3; a++) {
+        float across = centre - local[a] * local[a];
+        float below = local[a] + r.period[a], above = r.period[a] - local[a];
+        if (own[a] > r.cellMin[a] && below * below + across < reach)
+            from[a]--;
+        if (own[a] < r.cellMax[a] && above * above + across < reach)
+            to[a]++;
+    }
+    if (from == glm::ivec3(own) && to == glm::ivec3(own))
+        return best;
+
+    float far = INFINITY;
+    for (int a = 0; a < 3; a++) {
+        float centre = own[a] * r.period[a];
+        if (own[a] - 1 > r.cellMin[a])
+            far = std::min(far, p[a] - (centre - 2 * r.period[a] + r.cellBox.max[a]));
+        if (own[a] + 1 < r.cellMax[a])
+            far = std::min(far, (centre + 2 * r.period[a] + r.cellBox.min[a]) - p[a]);
+    }
+    far = std::max(far, r.bounds.distance(point));
+
+    for (int z = from.z; z <= to.z; z++)
+        for (int y = from.y; y <= to.y; y++)
+            for (int x = from.x; x <= to.x; x++) {
+                glm::vec3 cell(x, y, z);
+                if (cell == own)
+                    continue;
+                Bounds box;
+                box.min = r.cellBox.min + cell * r.period;
+                box.max = r.cellBox.max + cell * r.period;
+                if (box.distance(p) >= best || glm::length(p - cell * r.period) - r.radius >= best)
+                    continue;
+                int obj;
+                float d = cellSdf(r, cell, point, obj);
+                if (d < best) {
+                    best = d;
+                    if (closestCell)
+                        *closestCell = glm::ivec3(x, y, z);
+                }
+            }
+    return std::min(best, far);
+}
+
+//--------------------------------------------------------------
+bool CompiledScene::objectCell(int objIndex, const glm::vec3& p, glm::ivec3& cell) const {
+    if (objIndex < 0 || objIndex >= objectPrims.size() || objectPrims[objIndex].type != PRIM_REPEATED)
+        return false;
+    int obj;
+    repeatedSdf(repeated[objectPrims[objIndex].index], p, obj, &cell);
+    return true;
+}
+
+//--------------------------------------------------------------
+float CompiledScene::primSdfGradient(const PrimRef& prim, const glm::vec3& p, glm::vec3& grad) const {
+    switch (prim.type) {
+    case PRIM_SPHERE:
+        return sphereSdfGradient(spheres[prim.index], p, grad);
+    case PRIM_TORUS:
+        return torusSdfGradient(tori[prim.index], p, grad);
+    case PRIM_HOLLOW_SPHERE:
+        return hollowSphereSdfGradient(hollowSpheres[prim.index], p, grad);
+    case PRIM_REPEATED: {
+        //gradient of the closest copy. moving into a cell is a translation and
+        //the size a uniform scale, neither turns the gradient
+        const RepeatedPrim& r = repeated[prim.index];
+        glm::ivec3 cell;
+        int obj;
+        repeatedSdf(r, p, obj, &cell);
+        glm::vec3 local = p - glm::vec3(cell) * r.period;
+        float scale = r.repetition.scale(cell);
+        return scale * primSdfGradient(r.prim, r.origin + (local - r.origin) / scale, grad);
+    }
+    case PRIM_CSG: {
+        //no analytic gradient through the operators: tetrahedral differences
+        //of the model alone
+        const CsgModel& m = csgModels[prim.index];
+        const float eps = 0.001f;
+        glm::vec3 a(1, -1, -1), b(-1, -1, 1), c(-1, 1, -1), d(1, 1, 1);
+        grad = a * csgSdf(m, p + eps * a) + b * csgSdf(m, p + eps * b) + c * csgSdf(m, p + eps * c) + d * csgSdf(m, p + eps * d);
+        float len = glm::length(grad);
+        grad = (len > 0) ? grad / len : glm::vec3(0, 1, 0);
+        return csgSdf(m, p);
+    }
+    case PRIM_MESH:
+        return meshSdfGradient(meshes[prim.index], p, grad);
+    default:
+        grad = glm::vec3(0, 1, 0);
+        return p.y - planes[prim.index].height;
+    }
+}
+
+//--------------------------------------------------------------
+bool CompiledScene::objectSdfGradient(int objIndex, const glm::vec3& point, float& dist, glm::vec3& grad) const {
+    if (objIndex < 0 || objIndex >= objectPrims.size() || objectPrims[objIndex].type == PRIM_NONE)
+        return false;
+    dist = primSdfGradient(objectPrims[objIndex], point, grad);
+    return true;
+}
+
+//--------------------------------------------------------------
+// Repeated primitives bound their copy in the cell of each point, like
+// repeatedSdf evaluates first. Every other copy is at least clearance away
+// (or pokes at most -clearance into the cell), which bounds the rest.
+//
+Interval CompiledScene::primInterval(const PrimRef& prim, const Interval3& box) const {
+    switch (prim.type) {
+    case PRIM_SPHERE:
+        return sphereInterval(spheres[prim.index], box);
+    case PRIM_TORUS:
+        return torusInterval(tori[prim.index], box);
+    case PRIM_HOLLOW_SPHERE:
+        return hollowSphereInterval(hollowSpheres[prim.index], box);
+    case PRIM_REPEATED: {
+        const RepeatedPrim& r = repeated[prim.index];
+        Interval3 local;
+        for (int a = 0; a < 3; a++)
+            local[a] = foldInterval(box[a], r.origin[a], r.period[a], r.cellMin[a], r.cellMax[a]);
+        Interval own;
+        if (r.repetition.sizeJitter <= 0)
+            own = primInterval(r.prim, local);
+        else {
+            Interval scale(1 - r.repetition.sizeJitter, 1 + r.repetition.sizeJitter);
+            for (int a = 0; a < 3; a++)
+                local[a] = (local[a] - r.origin[a]) / scale + r.origin[a];
+            own = primInterval(r.prim, local) * scale;
+        }
+        return Interval(std::min(own.lo, r.clearance), own.hi);
+    }
+    case PRIM_CSG:
+        return csgInterval(csgModels[prim.index], box);
+    case PRIM_MESH:
+        return meshInterval(meshes[prim.index], box);
+    default:
+        return box[1] - planes[prim.index].height;
+    }
+}
+
+//--------------------------------------------------------------
+// Closest primitive. Unbounded planes are always evaluated, the rest goes
+// through the BVH: a node is only opened when its box is closer than the
+// best distance so far, nearer child first so the bound tightens early.
+//
+float CompiledScene::sdf(const glm::vec3& point, int& objIndex) const {
+    if (nodes.empty())
+        return sdfBruteForce(point, objIndex);
+
+    const glm::vec3& p = point;
+    float closestDist = INFINITY;
+    for (int i = 0; i < planes.size(); i++) {
+        float d = p.y - planes[i].height;
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = planes[i].obj;
+        }
+    }
+    for (int i = 0; i < repeated.size(); i++) {
+        if (!repeated[i].endless)
+            continue;
+        int obj;
+        float d = repeatedSdf(repeated[i], p, obj);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = obj;
+        }
+    }
+    for (int i = 0; i < plainCsgModels; i++) {
+        if (csgModels[i].finite())
+            continue;
+        float d = csgSdf(csgModels[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = csgModels[i].obj;
+        }
+    }
+
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode& node = nodes[stack[--top]];
+        if (node.bounds.distance(p) >= closestDist)
+            continue;
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                int obj;
+                float d = primSdf(bvhPrims[i], p, obj);
+                if (d < closestDist) {
+                    closestDist = d;
+                    objIndex = obj;
+                }
+            }
+            continue;
+        }
+        float dLeft = nodes[node.first].bounds.distance(p);
+        float dRight = nodes[node.first + 1].bounds.distance(p);
+        if (dLeft < dRight) {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+        else {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+    }
+    return closestDist;
+}
+
+//--------------------------------------------------------------
+// closest of a list of primitives, e.g. the ones a screen tile can reach
+// (see TileCuller)
+//
+float CompiledScene::sdf(const PrimRef* prims, int count, const glm::vec3& p, int& objIndex) const {
+    float closestDist = INFINITY;
+    for (int i = 0; i < count; i++) {
+        int obj;
+        float d = primSdf(prims[i], p, obj);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = obj;
+        }
+    }
+    return closestDist;
+}
+
+//--------------------------------------------------------------
+// Every primitive, one loop per type. Used for small scenes.
+//
+float CompiledScene::sdfBruteForce(const glm::vec3& point, int& objIndex) const {
+    const glm::vec3& p = point;
+    float closestDist = INFINITY;
+
+    for (int i = 0; i < plainSpheres; i++) {
+        float d = sphereSdf(spheres[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = spheres[i].obj;
+        }
+    }
+
+    for (int i = 0; i < planes.size(); i++) {
+        float d = p.y - planes[i].height;
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = planes[i].obj;
+        }
+    }
+
+    for (int i = 0; i < plainTori; i++) {
+        float d = torusSdf(tori[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = tori[i].obj;
+        }
+    }
+
+    for (int i = 0; i < plainHollowSpheres; i++) {
+        float d = hollowSphereSdf(hollowSpheres[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = hollowSpheres[i].obj;
+        }
+    }
+
+    for (int i = 0; i < plainCsgModels; i++) {
+        float d = csgSdf(csgModels[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = csgModels[i].obj;
+        }
+    }
+
+    for (int i = 0; i < plainMeshes; i++) {
+        float d = meshSdf(meshes[i], p);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = meshes[i].obj;
+        }
+    }
+
+    for (int i = 0; i < repeated.size(); i++) {
+        int obj;
+        float d = repeatedSdf(repeated[i], p, obj);
+        if (d < closestDist) {
+            closestDist = d;
+            objIndex = obj;
+        }
+    }
+
+    return closestDist;
+}
+
+//--------------------------------------------------------------
+// The stack machine. values holds the distances of finished subtrees, the
+// frames the point and distance scale outside each repeat being evaluated.
+// compileCsg() checked the program stays within both stacks.
+//
+float CompiledScene::csgSdf(const CsgModel& model, const glm::vec3& point) const {
+    float values[CSG_MAX_STACK];
+    glm::vec3 framePoint[CSG_MAX_REPEATS];
+    float frameScale[CSG_MAX_REPEATS];
+    int top = 0, frames = 0;
+    glm::vec3 p = point;
+    float scale = 1;
+
+    const CsgInstr* code = &csgCode[model.first];
+    for (int i = 0; i < model.count; i++) {
+        const CsgInstr& in = code[i];
+        switch (in.op) {
+        case CSG_OP_SHAPE: {
+            const CsgShape& s = csgShapes[in.arg];
+            values[top++] = scale * s.scale * csgShapeSdf(s.type, s.size, s.toLocal.apply(p));
+            break;
+        }
+        case CSG_OP_UNION:
+            top--;
+            values[top - 1] = std::min(values[top - 1], values[top]);
+            break;
+        case CSG_OP_INTERSECT:
+            top--;
+            values[top - 1] = std::max(values[top - 1], values[top]);
+            break;
+        case CSG_OP_SUBTRACT:
+            top--;
+            values[top - 1] = std::max(values[top - 1], -values[top]);
+            break;
+        case CSG_OP_SMOOTH_UNION:
+            top--;
+            values[top - 1] = csgSmoothMin(values[top - 1], values[top], in.k);
+            break;
+        case CSG_OP_SMOOTH_INTERSECT:
+            top--;
+            values[top - 1] = -csgSmoothMin(-values[top - 1], -values[top], in.k);
+            break;
+        case CSG_OP_SMOOTH_SUBTRACT:
+            top--;
+            values[top - 1] = -csgSmoothMin(-values[top - 1], values[top], in.k);
+            break;
+        case CSG_OP_REPEAT: {
+            const CsgRepeat& r = csgRepeats[in.arg];
+            framePoint[frames] = p;
+            frameScale[frames++] = scale;
+            glm::vec3 local = r.toLocal.apply(p);
+            glm::vec3 cell = glm::clamp(glm::floor(local / r.period + 0.5f), r.cellMin, r.cellMax);
+            p = local - cell * r.period;
+            scale *= r.scale;
+            break;
+        }
+        default:
+            p = framePoint[--frames];
+            scale = frameScale[frames];
+            break;
+        }
+    }
+    return values[0];
+}
+
+//--------------------------------------------------------------
+// csgSdf over a box: the same program on intervals. Smooth operators pull
+// the hard result down (union) or up (intersection, subtraction) by at most
+// k / 4, repeats fold the box into the cells it reaches.
+//
+Interval CompiledScene::csgInterval(const CsgModel& model, const Interval3& box) const {
+    Interval values[CSG_MAX_STACK];
+    Interval3 frameBox[CSG_MAX_REPEATS];
+    float frameScale[CSG_MAX_REPEATS];
+    int top = 0, frames = 0;
+    Interval3 p = box;
+    float scale = 1;
+
+    const CsgInstr* code = &csgCode[model.first];
+    for (int i = 0; i < model.count; i++) {
+        const CsgInstr& in = code[i];
+        switch (in.op) {
+        case CSG_OP_SHAPE: {
+            const CsgShape& s = csgShapes[in.arg];
+            values[top++] = csgShapeInterval(s.type, s.size, s.toLocal.apply(p)) * (scale * s.scale);
+            break;
+        }
+        case CSG_OP_UNION:
+        case CSG_OP_SMOOTH_UNION:
+            top--;
+            values[top - 1] = min(values[top - 1], values[top]);
+            if (in.op == CSG_OP_SMOOTH_UNION)
+                values[top - 1].lo -= 0.25f * in.k;
+            break;
+        case CSG_OP_INTERSECT:
+        case CSG_OP_SMOOTH_INTERSECT:
+            top--;
+            values[top - 1] = max(values[top - 1], values[top]);
+            if (in.op == CSG_OP_SMOOTH_INTERSECT)
+                values[top - 1].hi += 0.25f * in.k;
+            break;
+        case CSG_OP_SUBTRACT:
+        case CSG_OP_SMOOTH_SUBTRACT:
+            top--;
+            values[top - 1] = max(values[top - 1], -values[top]);
+            if (in.op == CSG_OP_SMOOTH_SUBTRACT)
+                values[top - 1].hi += 0.25f * in.k;
+            break;
+        case CSG_OP_REPEAT: {
+            const CsgRepeat& r = csgRepeats[in.arg];
+            frameBox[frames] = p;
+            frameScale[frames++] = scale;
+            Interval3 local = r.toLocal.apply(p);
+            for (int a = 0; a < 3; a++)
+                p[a] = foldInterval(local[a], 0, r.period[a], r.cellMin[a], r.cellMax[a]);
+            scale *= r.scale;
+            break;
+        }
+        default:
+            p = frameBox[--frames];
+            scale = frameScale[frames];
+            break;
+        }
+    }
+    return values[0];
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Interval.h"
+
+class TriMesh;
+
+//  World -> local affine transform of a positioned and rotated primitive,
+//  stored as 3x3 + translation so applying it is one matrix-vector multiply.
+//
+struct AffineTransform {
+	glm::mat3 rotate = glm::mat3(1.0);
+	glm::vec3 translate = glm::vec3(0);
+
+	glm::vec3 apply(const glm::vec3& p) const { return rotate * p + translate; }
+	//  the box of every point of the box p moved by this
+	Interval3 apply(const Interval3& p) const {
+		Interval3 q;
+		for (int i = 0; i < 3; i++)
+			q[i] = p[0] * rotate[0][i] + p[1] * rotate[1][i] + p[2] * rotate[2][i] + translate[i];
+		return q;
+	}
+};
+
+//  Flattened copy of the scene used by the ray marcher.
+//  Every primitive type gets its own contiguous array of plain parameters so
+//  a march step is a handful of tight loops - no pointer chasing and no
+//  virtual sdf() calls. obj is the index of the source object in ofApp::scene
+//  (used to look up colours after a hit).
+//  Rebuild with SceneObject::compile() whenever the scene changes.
+//
+struct SpherePrim {
+	glm::vec3 center;
+	float radius;
+	int obj;
+};
+
+struct PlanePrim {
+	float height;             // plane y = height, facing +y (same as Plane::sdf)
+	int obj;
+};
+
+struct TorusPrim {
+	AffineTransform toLocal;  // world -> torus space
+	glm::vec2 t;              // major / minor radius
+	int obj;
+};
+
+struct HollowSpherePrim {
+	AffineTransform toLocal;  // world -> hollow sphere space
+	glm::vec3 rht;            // radius, opening height, thickness
+	float w;                  // sqrt(r^2 - h^2), rim radius
+	int obj;
+};
+
+//  axis aligned box, used for primitive bounds and the scene extent
+//
+struct Bounds {
+	glm::vec3 min = glm::vec3(INFINITY);
+	glm::vec3 max = glm::vec3(-INFINITY);
+
+	void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const Bounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	bool isEmpty() const { return min.x > max.x; }
+	glm::vec3 center() const { return 0.5f * (min + max); }
+	float area() const {
+		glm::vec3 e = max - min;
+		return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+	//  distance from p to the box, 0 inside. a lower bound of the distance
+	//  to anything the box contains
+	float distance(const glm::vec3& p) const {
+		glm::vec3 q = glm::max(glm::max(min - p, p - max), glm::vec3(0));
+		return glm::length(q);
+	}
+	//  slab test, [tNear, tFar] is the part of the ray inside the box
+	bool clip(const glm::vec3& o, const glm::vec3& d, float& tNear, float& tFar) const;
+};
+
+//  a TriMesh placed in the scene. toMesh includes 1 / scale, so distances
+//  in mesh coordinates are scale times too small. Further than margin (mesh
+//  units) from the mesh box, the distance to the box stands in for the mesh,
+//  further from the surface TriMesh::lowerBound does (see meshSdf)
+//
+struct MeshPrim {
+	const TriMesh* mesh;      // owned by its scene object
+	AffineTransform toMesh;   // world -> mesh coordinates
+	float scale;
+	float margin;
+	Bounds bounds;            // world box
+	int obj;
+};
+
+//  CSG models (see Csg.h). A model is a postfix program in
+//  CompiledScene::csgCode run by a stack machine: shapes push their
+//  distance, operators combine the top two, and a repeat instruction moves
+//  the evaluation point into the cell of a repetition until its end
+//  instruction. Transforms are folded into the shapes and repeats when the
+//  tree is compiled, so they cost nothing at run time.
+//
+enum CsgShapeType { CSG_SPHERE, CSG_BOX, CSG_TORUS, CSG_CYLINDER };
+enum CsgOpcode {
+	CSG_OP_SHAPE, CSG_OP_UNION, CSG_OP_INTERSECT, CSG_OP_SUBTRACT,
+	CSG_OP_SMOOTH_UNION, CSG_OP_SMOOTH_INTERSECT, CSG_OP_SMOOTH_SUBTRACT,
+	CSG_OP_REPEAT, CSG_OP_END_REPEAT
+};
+// stack machine limits: values on the stack and repeats inside each other
+static const int CSG_MAX_STACK = 32;
+static const int CSG_MAX_REPEATS = 8;
+
+struct CsgShape {
+	AffineTransform toLocal;  // repeat cell (or world) -> shape space, including 1 / scale
+	float scale;              // shape space distances times this are cell distances
+	glm::vec3 size;           // see csgShapeSdf
+	int type;                 // CsgShapeType
+};
+
+struct CsgRepeat {
+	AffineTransform toLocal;  // enclosing space -> repetition space, including 1 / scale
+	float scale;
+	glm::vec3 period;         // 1 on axes with a single cell
+	glm::vec3 cellMin, cellMax;
+};
+
+struct CsgInstr {
+	int op;                   // CsgOpcode
+	int arg;                  // CSG_OP_SHAPE: into csgShapes, CSG_OP_REPEAT: into csgRepeats
+	float k;                  // smooth operators: blend radius in world units
+};
+
+struct CsgModel {
+	int first, count;         // its instructions in csgCode
+	Bounds bounds;            // infinite when a repeat is endless
+	int obj;
+	bool finite() const {
+		for (int a = 0; a < 3; a++)
+			if (std::isinf(bounds.min[a]) || std::isinf(bounds.max[a]))
+				return false;
+		return true;
+	}
+};
+
+//  distance to a CSG shape in its own space. size is the sphere radius
+//  (x), the box half size, the torus major / minor radius (x, y, around
+//  the z axis like Torus) or the cylinder radius / half height (x, y, along y)
+//
+inline float csgShapeSdf(int type, const glm::vec3& size, const glm::vec3& p) {
+	switch (type) {
+	case CSG_SPHERE:
+		return glm::length(p) - size.x;
+	case CSG_BOX: {
+		glm::vec3 q = glm::abs(p) - size;
+		return glm::length(glm::max(q, glm::vec3(0))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+	}
+	case CSG_TORUS: {
+		glm::vec2 q(glm::length(glm::vec2(p.x, p.y)) - size.x, p.z);
+		return glm::length(q) - size.y;
+	}
+	default: {
+		glm::vec2 d(glm::length(glm::vec2(p.x, p.z)) - size.x, abs(p.y) - size.y);
+		return std::min(std::max(d.x, d.y), 0.0f) + glm::length(glm::max(d, glm::vec2(0)));
+	}
+	}
+}
+
+//  polynomial smooth minimum: min(a, b) pulled down by up to k / 4 where a
+//  and b are less than k apart
+//
+inline float csgSmoothMin(float a, float b, float k) {
+	float h = std::max(k - abs(a - b), 0.0f) / k;
+	return std::min(a, b) - h * h * k * 0.25f;
+}
+
+enum PrimType { PRIM_SPHERE, PRIM_TORUS, PRIM_HOLLOW_SPHERE, PRIM_PLANE, PRIM_REPEATED, PRIM_CSG, PRIM_MESH, PRIM_NONE };
+
+struct PrimRef {
+	int type;                 // PrimType
+	int index;                // into the array of that type
+};
+
+// cell index used as the end of an endless repetition
+static const int ENDLESS_CELLS = 1 << 28;
+
+//  Domain repetition of one scene object (SceneObject::repetition). Copies
+//  the object every period along each axis, cell (0, 0, 0) being the object
+//  itself. count limits the copies per axis (0 = endless), centred on the
+//  object. Every copy can vary its size and colour, seeded by its cell.
+//  Axes with period 0 are not repeated.
+//
+struct Repetition {
+	glm::vec3 period = glm::vec3(0);
+	glm::ivec3 count = glm::ivec3(0);
+	float sizeJitter = 0;     // copies are scaled by 1 +- sizeJitter
+	float colorJitter = 0;    // 0..1, how far copies blend towards a random colour
+
+	bool enabled() const { return period.x > 0 || period.y > 0 || period.z > 0; }
+	//  cells along axis a are firstCell(a) .. lastCell(a)
+	int firstCell(int a) const { return (period[a] <= 0) ? 0 : (count[a] > 0) ? -((count[a] - 1) / 2) : -ENDLESS_CELLS; }
+	int lastCell(int a) const { return (period[a] <= 0) ? 0 : (count[a] > 0) ? firstCell(a) + count[a] - 1 : ENDLESS_CELLS; }
+	bool endless() const {
+		for (int a = 0; a < 3; a++)
+			if (period[a] > 0 && count[a] <= 0)
+				return true;
+		return false;
+	}
+	float scale(const glm::ivec3& cell) const { return (sizeJitter > 0) ? 1 + sizeJitter * (2 * random(cell, 0) - 1) : 1; }
+	//  hash of a cell and salt to [0, 1)
+	static float random(const glm::ivec3& cell, int salt);
+};
+
+//  a repeated object in the flat scene. Its primitive stays in the array of
+//  its type (behind the unrepeated ones) as the copy in cell (0, 0, 0) and
+//  is only evaluated through CompiledScene::repeatedSdf
+//
+struct RepeatedPrim {
+	PrimRef prim;
+	int obj;
+	Repetition repetition;
+	glm::vec3 origin;         // centre of cell (0, 0, 0)
+	glm::vec3 period;         // 1 on axes without repetition (one cell there)
+	glm::vec3 invPeriod;
+	glm::vec3 cellMin, cellMax;   // cell index range, whole numbers kept as floats for the hot path
+	Bounds cellBox;           // one copy around its cell centre, at the largest size
+	float radius;             // and the sphere around it, tighter than the box for round shapes
+	Bounds bounds;            // all copies, infinite along endless axes
+	float clearance;          // a copy is this far inside its cell on every side
+	glm::vec3 halfCell;       // half a period, infinite on axes with a single cell
+	bool endless;
+};
+
+//  flat BVH node. leaf: count > 0 and primitives bvhPrims[first .. first + count).
+//  inner: count == 0 and children nodes[first] and nodes[first + 1].
+//
+struct BVHNode {
+	Bounds bounds;
+	int first;
+	int count;
+};
+
+class CompiledScene {
+public:
+	void clear();
+	int size() const { return (int)(spheres.size() + planes.size() + tori.size() + hollowSpheres.size() + csgModels.size() + meshes.size()); }
+
+	//  compute primitive bounds, the scene box and the BVH. call after all
+	//  SceneObject::compile() calls
+	void build();
+
+	//  distance to the closest primitive, objIndex is set to its scene index
+	float sdf(const glm::vec3& p, int& objIndex) const;
+	float sdfBruteForce(const glm::vec3& p, int& objIndex) const;
+	//  closest of prims[0 .. count), any types including planes
+	float sdf(const PrimRef* prims, int count, const glm::vec3& p, int& objIndex) const;
+	float primSdf(const PrimRef& prim, const glm::vec3& p, int& objIndex) const;
+	//  distance and analytic gradient of one primitive
+	float primSdfGradient(const PrimRef& prim, const glm::vec3& p, glm::vec3& grad) const;
+	//  same for the primitive of scene object objIndex. false when that
+	//  object has nothing in the flat scene
+	bool objectSdfGradient(int objIndex, const glm::vec3& p, float& dist, glm::vec3& grad) const;
+	Bounds primBounds(const PrimRef& prim) const;
+	//  range of primSdf over every point of box
+	Interval primInterval(const PrimRef& prim, const Interval3& box) const;
+
+	//  closest copy of a repeated primitive: the cell p is in, then only the
+	//  neighbour cells whose copies can be closer. cell receives the cell of
+	//  the closest copy
+	float repeatedSdf(const RepeatedPrim& r, const glm::vec3& p, int& objIndex, glm::ivec3* cell = nullptr) const;
+	//  cell of the copy of scene object objIndex closest to p. false when the
+	//  object is not repeated
+	bool objectCell(int objIndex, const glm::vec3& p, glm::ivec3& cell) const;
+	//  run the program of a CSG model
+	float csgSdf(const CsgModel& model, const glm::vec3& p) const;
+	Interval csgInterval(const CsgModel& model, const Interval3& box) const;
+
+	//  part of a ray that can reach geometry. false when the ray misses the
+	//  scene box. unbounded scenes (planes, repetition) return [0, inf)
+	bool clipRay(const glm::vec3& o, const glm::vec3& d, float& tNear, float& tFar) const;
+
+	vector<SpherePrim> spheres;
+	vector<PlanePrim> planes;
+	vector<TorusPrim> tori;
+	vector<HollowSpherePrim> hollowSpheres;
+	vector<CsgModel> csgModels;
+	vector<MeshPrim> meshes;
+	//  the arena every CSG model's program and parameters live in
+	vector<CsgInstr> csgCode;
+	vector<CsgShape> csgShapes;
+	vector<CsgRepeat> csgRepeats;
+
+	//  repetition of every scene object (by scene index), set before build()
+	vector<Repetition> repetitions;
+
+	//  filled in by build(). the arrays above hold their unrepeated primitives
+	//  first (plainSpheres ...), finite repetitions are BVH leaves like any
+	//  primitive, endless ones are always evaluated like the planes (and so
+	//  are CSG models with an endless repeat, which are never repeated again)
+	int plainSpheres = 0, plainTori = 0, plainHollowSpheres = 0, plainCsgModels = 0, plainMeshes = 0;
+	vector<RepeatedPrim> repeated;
+	bool bounded = false;
+	Bounds bounds;
+	vector<BVHNode> nodes;
+	vector<PrimRef> bvhPrims;
+	vector<PrimRef> objectPrims;   // scene index -> its primitive, type PRIM_NONE if it has none
+
+private:
+	int primObject(const PrimRef& prim) const;
+	void addRepeated(const PrimRef& prim);
+	float cellSdf(const RepeatedPrim& r, const glm::vec3& cell, const glm::vec3& p, int& objIndex) const;
+	void buildNode(int nodeIndex, vector<PrimRef>& prims, vector<Bounds>& primBox, int first, int count);
+};
+
+//  how rayMarching walks along the ray
+//  MARCH_BASIC     : step by the scene distance, hit below a fixed threshold
+//  MARCH_FOOTPRINT : same steps, hit once the distance is below the pixel
+//                    footprint at t (grazing rays stop when they cover a pixel)
+//  MARCH_RELAXED   : footprint threshold plus over-relaxed steps (relaxation * distance),
+//                    falling back to plain steps when two spheres stop overlapping
+//
+enum MarchStrategy { MARCH_BASIC, MARCH_FOOTPRINT, MARCH_RELAXED };
+
+//  ray marching limits, shared by ofApp::rayMarching and the packet marcher
+//
+struct MarchSettings {
+	int maxSteps = 200;
+	float hitThreshold = 0.001;
+	float maxDistance = 10;       // unbounded scenes: give up once the scene is further than this
+	                              // from the ray. bounded scenes stop at the scene box instead
+	MarchStrategy strategy = MARCH_BASIC;
+	float relaxation = 1.6;       // MARCH_RELAXED step factor, between 1 and 2
+	float pixelRadius = 0;        // radius of a pixel cone at t = 1, see ofApp::pixelConeRadius
+	bool conePrepass = false;     // start pixels from the depth found by 8x8 / 2x2 cone marching
+	bool shadows = false;         // cast soft shadows from the point lights (ofApp::shadowRay)
+	float penumbra = 8;           // shadow hardness k in min(k * h / t)
+	int shadowMaxSteps = 64;      // cost cap per shadow ray
+	float shadowBias = 0.01;      // shadow rays start this far off the surface, along the normal
+	bool distanceCache = false;   // step through empty space by the baked bounds of ofApp::distanceCache
+	int cacheCells = 32;          // its coarse cells along the longest side of the scene
+	bool tileCulling = false;     // march 8x8 pixel blocks against the primitives they can reach (TileCuller)
+
+	float stepScale() const { return (strategy == MARCH_RELAXED) ? relaxation : 1.0f; }
+	float threshold(float t) const {
+		return (strategy == MARCH_BASIC) ? hitThreshold : std::max(hitThreshold, pixelRadius * t);
+	}
+};
+
+//  What ofApp::rayMarching (or staticMarch) found along a ray. For a miss p,
+//  obj and dist describe the last point marched to.
+//
+struct HitRecord {
+	float t = 0;              // distance along the ray
+	glm::vec3 p = glm::vec3(0);
+	int obj = -1;             // index in ofApp::scene of the closest object at p
+	int steps = 0;            // scene evaluations taken by the march
+	float dist = 0;           // scene distance at p
+};
@@ -0,0 +1,361 @@
+#include "Csg.h"
+#include "glm/gtx/euler_angles.hpp"
+
+//--------------------------------------------------------------
+int CsgTree::add(const CsgNode& node) {
+    nodes.push_back(node);
+    root = (int)nodes.size() - 1;
+    return root;
+}
+
+int CsgTree::sphere(float radius) {
+    CsgNode n;
+    n.type = CSG_NODE_SHAPE;
+    n.shape = CSG_SPHERE;
+    n.size = glm::vec3(radius, 0, 0);
+    return add(n);
+}
+
+int CsgTree::box(const glm::vec3& halfSize) {
+    CsgNode n;
+    n.type = CSG_NODE_SHAPE;
+    n.shape = CSG_BOX;
+    n.size = halfSize;
+    return add(n);
+}
+
+int CsgTree::torus(float major, float minor) {
+    CsgNode n;
+    n.type = CSG_NODE_SHAPE;
+    n.shape = CSG_TORUS;
+    n.size = glm::vec3(major, minor, 0);
+    return add(n);
+}
+
+int CsgTree::cylinder(float radius, float halfHeight) {
+    CsgNode n;
+    n.type = CSG_NODE_SHAPE;
+    n.shape = CSG_CYLINDER;
+    n.size = glm::vec3(radius, halfHeight, 0);
+    return add(n);
+}
+
+//--------------------------------------------------------------
+int CsgTree::unite(int a, int b, float k) {
+    CsgNode n;
+    n.type = CSG_NODE_UNION;
+    n.a = a;
+    n.b = b;
+    n.k = k;
+    return add(n);
+}
+
+int CsgTree::intersect(int a, int b, float k) {
+    CsgNode n;
+    n.type = CSG_NODE_INTERSECT;
+    n.a = a;
+    n.b = b;
+    n.k = k;
+    return add(n);
+}
+
+int CsgTree::subtract(int a, int b, float k) {
+    CsgNode n;
+    n.type = CSG_NODE_SUBTRACT;
+    n.a = a;
+    n.b = b;
+    n.k = k;
+    return add(n);
+}
+
+int CsgTree::transform(int a, const glm::vec3& translate, const glm::vec3& rotation, float scale) {
+    CsgNode n;
+    n.type = CSG_NODE_TRANSFORM;
+    n.a = a;
+    n.translate = translate;
+    n.rotation = rotation;
+    n.scale = scale;
+    return add(n);
+}
+
+int CsgTree::repeat(int a, const glm::vec3& period, const glm::ivec3& count) {
+    CsgNode n;
+    n.type = CSG_NODE_REPEAT;
+    n.a = a;
+    n.repetition.period = period;
+    n.repetition.count = count;
+    return add(n);
+}
+
+//--------------------------------------------------------------
+AffineTransform csgNodeTransform(const CsgNode& node) {
+    glm::mat3 rotate(glm::eulerAngleXYZ(glm::radians(node.rotation.y), glm::radians(node.rotation.x), glm::radians(node.rotation.z)));
+    AffineTransform t;
+    t.rotate = glm::transpose(rotate) / node.scale;
+    t.translate = -(t.rotate * node.translate);
+    return t;
+}
+
+//--------------------------------------------------------------
+float CsgTree::sdf(const glm::vec3& p) const {
+    return (root < 0) ? INFINITY : nodeSdf(root, p);
+}
+
+float CsgTree::nodeSdf(int index, const glm::vec3& p) const {
+    const CsgNode& n = nodes[index];
+    switch (n.type) {
+    case CSG_NODE_SHAPE:
+        return csgShapeSdf(n.shape, n.size, p);
+    case CSG_NODE_UNION: {
+        float a = nodeSdf(n.a, p), b = nodeSdf(n.b, p);
+        return (n.k > 0) ? csgSmoothMin(a, b, n.k) : std::min(a, b);
+    }
+    case CSG_NODE_INTERSECT: {
+        float a = nodeSdf(n.a, p), b = nodeSdf(n.b, p);
+        return (n.k > 0) ? -csgSmoothMin(-a, -b, n.k) : std::max(a, b);
+    }
+    case CSG_NODE_SUBTRACT: {
+        float a = nodeSdf(n.a, p), b = nodeSdf(n.b, p);
+        return (n.k > 0) ? -csgSmoothMin(-a, b, n.k) : std::max(a, -b);
+    }
+    case CSG_NODE_TRANSFORM:
+        return n.scale * nodeSdf(n.a, csgNodeTransform(n).apply(p));
+    default: {
+        //nearest cell only, like ofApp::opRep
+        const Repetition& rep = n.repetition;
+        glm::vec3 q = p;
+        for (int a = 0; a < 3; a++) {
+            if (rep.period[a] <= 0)
+                continue;
+            float cell = std::min(std::max(floor(p[a] / rep.period[a] + 0.5f), (float)rep.firstCell(a)), (float)rep.lastCell(a));
+            q[a] -= cell * rep.period[a];
+        }
+        return nodeSdf(n.a, q);
+    }
+    }
+}
+
+//--------------------------------------------------------------
+// box in the enclosing space of a box in the space toLocal maps to. infinite
+// sides stay infinite along every axis they reach
+//
+static Bounds boundsToFrame(const Bounds& local, const AffineTransform& toLocal) {
+    glm::mat3 toFrame = glm::inverse(toLocal.rotate);
+    glm::vec3 center, extent;
+    for (int a = 0; a < 3; a++) {
+        bool infinite = std::isinf(local.min[a]) || std::isinf(local.max[a]);
+        center[a] = infinite ? 0 : 0.5f * (local.min[a] + local.max[a]);
+        extent[a] = infinite ? INFINITY : 0.5f * (local.max[a] - local.min[a]);
+    }
+    center = toFrame * (center - toLocal.translate);
+    Bounds b;
+    for (int i = 0; i < 3; i++) {
+        float e = 0;
+        for (int j = 0; j < 3; j++)
+            if (toFrame[j][i] != 0)
+                e += abs(toFrame[j][i]) * extent[j];
+        b.min[i] = center[i] - e;
+        b.max[i] = center[i] + e;
+    }
+    return b;
+}
+
+//--------------------------------------------------------------
+// gap between two boxes, 0 when they touch or overlap
+//
+static float boundsGap(const Bounds& a, const Bounds& b) {
+    glm::vec3 gap;
+    for (int i = 0; i < 3; i++)
+        gap[i] = std::max(0.0f, std::max(a.min[i] - b.max[i], b.min[i] - a.max[i]));
+    return glm::length(gap);
+}
+
+//  a node of the tree after folding, with its box in the space of the
+//  repeat (or world) it is in and the stack depth its program needs
+//
+struct CsgLowered {
+	int op;
+	int a = -1, b = -1;
+	float k = 0;
+	CsgShape shape;
+	CsgRepeat repeat;
+	Bounds bounds;
+	int stack = 1;
+};
+
+//  folds a CsgTree into CsgLowered nodes, then writes their program
+//
+class CsgCompiler {
+public:
+	CsgCompiler(const CsgTree& tree, CompiledScene& out) : tree(tree), out(out) { }
+	int lower(int index, const AffineTransform& toLocal, float scale, float frameScale, int repeats);
+	void emit(int index);
+
+	vector<CsgLowered> lowered;
+	int deepestRepeat = 0;
+
+private:
+	const CsgTree& tree;
+	CompiledScene& out;
+};
+
+//--------------------------------------------------------------
+// Lowered node for tree node index, seen through toLocal (enclosing space ->
+// node space; node space distances times scale are enclosing distances)
+// inside repeats whose own scales multiply to frameScale. -1 = empty space.
+//
+int CsgCompiler::lower(int index, const AffineTransform& toLocal, float scale, float frameScale, int repeats) {
+    const CsgNode& n = tree.nodes[index];
+    CsgLowered l;
+    switch (n.type) {
+    case CSG_NODE_SHAPE: {
+        glm::vec3 half = n.size;
+        if (n.shape == CSG_SPHERE)
+            half = glm::vec3(n.size.x);
+        else if (n.shape == CSG_TORUS)
+            half = glm::vec3(n.size.x + n.size.y, n.size.x + n.size.y, n.size.y);
+        else if (n.shape == CSG_CYLINDER)
+            half = glm::vec3(n.size.x, n.size.y, n.size.x);
+        if (half.x <= 0 || half.y <= 0 || half.z <= 0 || (n.shape == CSG_TORUS && n.size.y <= 0))
+            return -1;
+        l.op = CSG_OP_SHAPE;
+        l.shape.toLocal = toLocal;
+        l.shape.scale = scale;
+        l.shape.size = n.size;
+        l.shape.type = n.shape;
+        Bounds local;
+        local.min = -half;
+        local.max = half;
+        l.bounds = boundsToFrame(local, toLocal);
+        break;
+    }
+    case CSG_NODE_TRANSFORM: {
+        //folded into everything below
+        AffineTransform node = csgNodeTransform(n);
+        AffineTransform both;
+        both.rotate = node.rotate * toLocal.rotate;
+        both.translate = node.rotate * toLocal.translate + node.translate;
+        return lower(n.a, both, scale * n.scale, frameScale, repeats);
+    }
+    case CSG_NODE_REPEAT: {
+        deepestRepeat = std::max(deepestRepeat, repeats + 1);
+        int child = lower(n.a, AffineTransform(), 1, frameScale * scale, repeats + 1);
+        if (child < 0)
+            return -1;
+        const Repetition& rep = n.repetition;
+        l.op = CSG_OP_REPEAT;
+        l.a = child;
+        l.repeat.toLocal = toLocal;
+        l.repeat.scale = scale;
+        Bounds copies = lowered[child].bounds;
+        for (int a = 0; a < 3; a++) {
+            l.repeat.period[a] = (rep.period[a] > 0) ? rep.period[a] : 1;
+            l.repeat.cellMin[a] = rep.firstCell(a);
+            l.repeat.cellMax[a] = rep.lastCell(a);
+            bool endless = rep.lastCell(a) == ENDLESS_CELLS;
+            copies.min[a] = endless ? -INFINITY : copies.min[a] + l.repeat.cellMin[a] * l.repeat.period[a];
+            copies.max[a] = endless ? INFINITY : copies.max[a] + l.repeat.cellMax[a] * l.repeat.period[a];
+        }
+        l.bounds = boundsToFrame(copies, toLocal);
+        l.stack = lowered[child].stack;
+        break;
+    }
+    default: {
+        int a = lower(n.a, toLocal, scale, frameScale, repeats);
+        int b = lower(n.b, toLocal, scale, frameScale, repeats);
+        //blend radius in the node's enclosing space and in world units
+        float k = std::max(n.k, 0.0f) * scale;
+        l.k = k * frameScale;
+        if (n.type == CSG_NODE_UNION) {
+            if (a < 0 || b < 0)
+                return (a < 0) ? b : a;
+            //boxes further apart than k never blend
+            if (k > 0 && boundsGap(lowered[a].bounds, lowered[b].bounds) >= k)
+                k = 0;
+            l.op = (k > 0) ? CSG_OP_SMOOTH_UNION : CSG_OP_UNION;
+            l.bounds = lowered[a].bounds;
+            l.bounds.grow(lowered[b].bounds);
+            l.bounds.min -= glm::vec3(0.25f * k);
+            l.bounds.max += glm::vec3(0.25f * k);
+        }
+        else if (n.type == CSG_NODE_INTERSECT) {
+            if (a < 0 || b < 0)
+                return -1;
+            l.op = (k > 0) ? CSG_OP_SMOOTH_INTERSECT : CSG_OP_INTERSECT;
+            l.bounds.min = glm::max(lowered[a].bounds.min, lowered[b].bounds.min);
+            l.bounds.max = glm::min(lowered[a].bounds.max, lowered[b].bounds.max);
+            if (l.bounds.min.x > l.bounds.max.x || l.bounds.min.y > l.bounds.max.y || l.bounds.min.z > l.bounds.max.z)
+                return -1;
+        }
+        else {
+            if (a < 0)
+                return -1;
+            //cutting away what is not there leaves a as it is
+            if (b < 0 || boundsGap(lowered[a].bounds, lowered[b].bounds) > k)
+                return a;
+            l.op = (k > 0) ? CSG_OP_SMOOTH_SUBTRACT : CSG_OP_SUBTRACT;
+            l.bounds = lowered[a].bounds;
+        }
+        if (k <= 0)
+            l.k = 0;
+        //union and intersection can run the deeper side first, subtract
+        //keeps a below b on the stack
+        bool commutative = n.type != CSG_NODE_SUBTRACT;
+        if (commutative && lowered[b].stack > lowered[a].stack)
+            std::swap(a, b);
+        l.a = a;
+        l.b = b;
+        l.stack = std::max(lowered[a].stack, lowered[b].stack + 1);
+        break;
+    }
+    }
+    lowered.push_back(l);
+    return (int)lowered.size() - 1;
+}
+
+//--------------------------------------------------------------
+void CsgCompiler::emit(int index) {
+    const CsgLowered& l = lowered[index];
+    CsgInstr in = { l.op, -1, l.k };
+    if (l.op == CSG_OP_SHAPE) {
+        in.arg = (int)out.csgShapes.size();
+        out.csgShapes.push_back(l.shape);
+        out.csgCode.push_back(in);
+    }
+    else if (l.op == CSG_OP_REPEAT) {
+        in.arg = (int)out.csgRepeats.size();
+        out.csgRepeats.push_back(l.repeat);
+        out.csgCode.push_back(in);
+        emit(l.a);
+        CsgInstr end = { CSG_OP_END_REPEAT, -1, 0 };
+        out.csgCode.push_back(end);
+    }
+    else {
+        emit(l.a);
+        emit(l.b);
+        out.csgCode.push_back(in);
+    }
+}
+
+//--------------------------------------------------------------
+bool compileCsg(const CsgTree& tree, const AffineTransform& toLocal, int obj, CompiledScene& out) {
+    if (tree.root < 0)
+        return false;
+    CsgCompiler compiler(tree, out);
+    int root = compiler.lower(tree.root, toLocal, 1, 1, 0);
+    if (root < 0)
+        return false;
+    if (compiler.lowered[root].stack > CSG_MAX_STACK || compiler.deepestRepeat > CSG_MAX_REPEATS) {
+        cout << "CSG model of object " << obj << " is too deep for the stack machine" << endl;
+        return false;
+    }
+
+    CsgModel model;
+    model.first = (int)out.csgCode.size();
+    compiler.emit(root);
+    model.count = (int)out.csgCode.size() - model.first;
+    model.bounds = compiler.lowered[root].bounds;
+    model.obj = obj;
+    out.csgModels.push_back(model);
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "CompiledScene.h"
+
+//  CSG node kinds. Shapes are leaves, the boolean operators take children a
+//  and b (a minus b for subtract) and blend them over k when k > 0,
+//  transform and repeat take child a.
+//
+enum CsgNodeType {
+	CSG_NODE_SHAPE, CSG_NODE_UNION, CSG_NODE_INTERSECT, CSG_NODE_SUBTRACT,
+	CSG_NODE_TRANSFORM, CSG_NODE_REPEAT
+};
+
+struct CsgNode {
+	CsgNodeType type;
+	int a = -1, b = -1;                    // children, indices into CsgTree::nodes
+	int shape = CSG_SPHERE;                // CSG_NODE_SHAPE: CsgShapeType
+	glm::vec3 size = glm::vec3(0);         //   and its size, see csgShapeSdf
+	float k = 0;                           // operators: blend radius, 0 = hard edge
+	glm::vec3 translate = glm::vec3(0);    // CSG_NODE_TRANSFORM: child scaled, then rotated
+	glm::vec3 rotation = glm::vec3(0);     //   (degrees, same order as TransformedObject),
+	float scale = 1;                       //   then moved to translate
+	Repetition repetition;                 // CSG_NODE_REPEAT: period and count (no jitter)
+};
+
+//  A CSG model as a node graph. Nodes are kept in one vector and refer to
+//  each other by index; every builder call returns its node and the node
+//  made last is the root unless root is set. e.g. a box with a smooth
+//  rounded hole:
+//      CsgTree t;
+//      t.subtract(t.box(glm::vec3(1)), t.cylinder(0.5, 2), 0.1);
+//  compileCsg() flattens the graph into the CompiledScene arena, sdf() walks
+//  it recursively and is kept as the reference for that program.
+//
+class CsgTree {
+public:
+	int sphere(float radius);
+	int box(const glm::vec3& halfSize);
+	int torus(float major, float minor);
+	int cylinder(float radius, float halfHeight);
+	int unite(int a, int b, float k = 0);
+	int intersect(int a, int b, float k = 0);
+	int subtract(int a, int b, float k = 0);
+	int transform(int a, const glm::vec3& translate, const glm::vec3& rotation = glm::vec3(0), float scale = 1);
+	int repeat(int a, const glm::vec3& period, const glm::ivec3& count = glm::ivec3(0));
+
+	float sdf(const glm::vec3& p) const;
+
+	vector<CsgNode> nodes;
+	int root = -1;
+
+private:
+	int add(const CsgNode& node);
+	float nodeSdf(int index, const glm::vec3& p) const;
+};
+
+//  world -> local transform of a CSG_NODE_TRANSFORM node
+AffineTransform csgNodeTransform(const CsgNode& node);
+
+//  Append the model (placed by toLocal, world -> model space) to out as
+//  the CSG model of scene object obj. Transforms are folded into the
+//  shapes and repeats below them, smooth operators with k = 0 become hard
+//  ones, and subtrees that cannot change the result are dropped: anything
+//  intersected with or subtracted from empty space, and subtractions
+//  whose boxes do not reach each other. false when nothing is left or the
+//  program would not fit the stack machine.
+//
+bool compileCsg(const CsgTree& tree, const AffineTransform& toLocal, int obj, CompiledScene& out);
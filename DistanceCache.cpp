@@ -0,0 +1,155 @@
+#include "DistanceCache.h"
+
+template<class T>
+static void appendBytes(vector<char>& key, const vector<T>& values) {
+    const char* bytes = (const char*)values.data();
+    key.insert(key.end(), bytes, bytes + values.size() * sizeof(T));
+    key.push_back('|');
+}
+
+//--------------------------------------------------------------
+// the parameters of every primitive, to tell whether a rebuilt scene changed
+//
+vector<char> DistanceCache::sceneKey(const CompiledScene& scene) {
+    vector<char> key;
+    appendBytes(key, scene.spheres);
+    appendBytes(key, scene.planes);
+    appendBytes(key, scene.tori);
+    appendBytes(key, scene.hollowSpheres);
+    appendBytes(key, scene.repetitions);
+    appendBytes(key, scene.csgCode);
+    appendBytes(key, scene.csgShapes);
+    appendBytes(key, scene.csgRepeats);
+    appendBytes(key, scene.meshes);
+    return key;
+}
+
+//--------------------------------------------------------------
+void DistanceCache::clear() {
+    coarse.clear();
+    brickIndex.clear();
+    brickData.clear();
+    key.clear();
+    cells = glm::ivec3(0);
+    brickCount = 0;
+    exactBelow = 0;
+}
+
+//--------------------------------------------------------------
+bool DistanceCache::matches(const CompiledScene& scene, const Bounds& area) const {
+    return isBuilt() && area.min == region.min && area.max == region.max && key == sceneKey(scene);
+}
+
+//--------------------------------------------------------------
+// coarse vertices first, one job per z slice. coarse cells whose bounds can
+// drop below exactBelow without lying wholly below it get a brick, baked in
+// jobs of 16 bricks
+//
+void DistanceCache::build(const CompiledScene& scene, const Bounds& area, int cellsPerAxis, ThreadPool& pool) {
+    float start = ofGetElapsedTimef();
+    clear();
+    region = area;
+    glm::vec3 size = region.max - region.min;
+    cellSize = std::max(std::max(size.x, size.y), size.z) / cellsPerAxis;
+    invCellSize = 1 / cellSize;
+    for (int a = 0; a < 3; a++)
+        cells[a] = std::max(1, (int)ceil(size[a] * invCellSize));
+
+    //empty scenes are infinitely far, keep the lerps finite
+    auto vertexDistance = [&](const glm::vec3& p) {
+        int objIndex;
+        return std::min(scene.sdf(p, objIndex), 1e6f);
+    };
+
+    glm::ivec3 vertices = cells + 1;
+    coarse.resize(vertices.x * vertices.y * vertices.z);
+    for (int z = 0; z < vertices.z; z++) {
+        pool.submit([&, z] {
+            for (int y = 0; y < vertices.y; y++)
+                for (int x = 0; x < vertices.x; x++)
+                    coarse[(z * vertices.y + y) * vertices.x + x] = vertexDistance(region.min + glm::vec3(x, y, z) * cellSize);
+        });
+    }
+    pool.wait();
+
+    float fineSize = cellSize / BRICK_CELLS;
+    exactBelow = 2 * fineSize;
+    float halfDiagonal = 0.5f * sqrt(3.0f) * cellSize;
+    brickIndex.assign(cells.x * cells.y * cells.z, -1);
+    vector<glm::ivec3> refined;
+    for (int z = 0; z < cells.z; z++)
+        for (int y = 0; y < cells.y; y++)
+            for (int x = 0; x < cells.x; x++) {
+                float low = INFINITY, high = -INFINITY;
+                for (int corner = 0; corner < 8; corner++) {
+                    int cx = x + (corner & 1), cy = y + ((corner >> 1) & 1), cz = z + (corner >> 2);
+                    float d = coarse[(cz * vertices.y + cy) * vertices.x + cx];
+                    low = std::min(low, d);
+                    high = std::max(high, d);
+                }
+                if (low - halfDiagonal < exactBelow && high + halfDiagonal >= exactBelow) {
+                    brickIndex[(z * cells.y + y) * cells.x + x] = brickCount++;
+                    refined.push_back(glm::ivec3(x, y, z));
+                }
+            }
+
+    const int side = BRICK_CELLS + 1;
+    brickData.resize(refined.size() * side * side * side);
+    for (int first = 0; first < refined.size(); first += 16) {
+        pool.submit([&, first] {
+            int last = std::min(first + 16, (int)refined.size());
+            for (int b = first; b < last; b++) {
+                glm::vec3 corner = region.min + glm::vec3(refined[b]) * cellSize;
+                float* v = &brickData[b * side * side * side];
+                for (int z = 0; z < side; z++)
+                    for (int y = 0; y < side; y++)
+                        for (int x = 0; x < side; x++)
+                            v[(z * side + y) * side + x] = vertexDistance(corner + glm::vec3(x, y, z) * fineSize);
+            }
+        });
+    }
+    pool.wait();
+
+    key = sceneKey(scene);
+    bakeSeconds = ofGetElapsedTimef() - start;
+}
+
+//--------------------------------------------------------------
+size_t DistanceCache::memoryBytes() const {
+    return (coarse.size() + brickData.size()) * sizeof(float) + brickIndex.size() * sizeof(int);
+}
+
+//--------------------------------------------------------------
+// trilinear distance in the cell with corner vertex v, minus the most the
+// true distance can dip below it in between
+//
+float DistanceCache::cellBound(const float* v, int strideY, int strideZ, const glm::vec3& u, float size) const {
+    float x00 = v[0] + (v[1] - v[0]) * u.x;
+    float x10 = v[strideY] + (v[strideY + 1] - v[strideY]) * u.x;
+    float x01 = v[strideZ] + (v[strideZ + 1] - v[strideZ]) * u.x;
+    float x11 = v[strideZ + strideY] + (v[strideZ + strideY + 1] - v[strideZ + strideY]) * u.x;
+    float y0 = x00 + (x10 - x00) * u.y;
+    float y1 = x01 + (x11 - x01) * u.y;
+    float d = y0 + (y1 - y0) * u.z;
+    return d - size * sqrt(u.x * (1 - u.x) + u.y * (1 - u.y) + u.z * (1 - u.z));
+}
+
+//--------------------------------------------------------------
+float DistanceCache::lowerBound(const glm::vec3& p) const {
+    glm::vec3 g = (p - region.min) * invCellSize;
+    if (!(g.x >= 0 && g.y >= 0 && g.z >= 0 && g.x < cells.x && g.y < cells.y && g.z < cells.z))
+        return -INFINITY;
+    glm::ivec3 c = glm::min(glm::ivec3(g), cells - 1);
+    glm::vec3 u = g - glm::vec3(c);
+    int brick = brickIndex[(c.z * cells.y + c.y) * cells.x + c.x];
+    if (brick < 0) {
+        int strideY = cells.x + 1, strideZ = strideY * (cells.y + 1);
+        return cellBound(&coarse[c.z * strideZ + c.y * strideY + c.x], strideY, strideZ, u, cellSize);
+    }
+
+    const int side = BRICK_CELLS + 1;
+    glm::vec3 f = u * float(BRICK_CELLS);
+    glm::ivec3 s = glm::min(glm::ivec3(f), glm::ivec3(BRICK_CELLS - 1));
+    const float* v = &brickData[brick * side * side * side + (s.z * side + s.y) * side + s.x];
+    return cellBound(v, side, side * side, f - glm::vec3(s), cellSize / BRICK_CELLS);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "CompiledScene.h"
+#include "ThreadPool.h"
+
+//  Baked lower bounds of the scene distance, so the marcher can cross empty
+//  space with a trilinear lookup instead of evaluating every primitive.
+//  Two levels of a mip pyramid over region: a dense grid of coarse cells,
+//  and only in cells the surface passes near a brick of BRICK_CELLS^3 finer
+//  cells. Vertices hold CompiledScene::sdf; as every sdf is a lower bound of
+//  the true distance and distances change by at most 1 per unit,
+//      trilinear(d) - cell * sqrt(sum over axes of u (1 - u))
+//  (u = position in the cell) is a lower bound anywhere in a cell. Below
+//  exactBelow the bound is too coarse to step with and callers evaluate the
+//  scene (see ofApp::marchSDF).
+//
+class DistanceCache {
+public:
+	static const int BRICK_CELLS = 4;
+
+	void clear();
+	bool isBuilt() const { return !coarse.empty(); }
+	//  bake with about cellsPerAxis coarse cells along the longest side of region
+	void build(const CompiledScene& scene, const Bounds& region, int cellsPerAxis, ThreadPool& pool);
+	//  baked from the same primitives over the same region
+	bool matches(const CompiledScene& scene, const Bounds& region) const;
+
+	//  lower bound of the scene distance at p, -inf outside the region
+	float lowerBound(const glm::vec3& p) const;
+	size_t memoryBytes() const;
+
+	float exactBelow = 0;
+	int brickCount = 0;
+	float bakeSeconds = 0;
+
+private:
+	static vector<char> sceneKey(const CompiledScene& scene);
+	float cellBound(const float* v, int strideY, int strideZ, const glm::vec3& u, float size) const;
+
+	Bounds region;
+	glm::ivec3 cells = glm::ivec3(0);   // coarse cells per axis
+	float cellSize = 0, invCellSize = 0;
+	vector<float> coarse;               // (cells + 1)^3 vertex distances
+	vector<int> brickIndex;             // per coarse cell, -1 = no brick
+	vector<float> brickData;            // (BRICK_CELLS + 1)^3 vertices per brick
+	vector<char> key;
+};
@@ -0,0 +1,64 @@
+#include "HdrImage.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define HDR_IMAGE_X86
+#include <emmintrin.h>
+#endif
+
+//--------------------------------------------------------------
+float toneMapValue(float value, const ToneMapSettings& settings) {
+    float x = value * (settings.exposure / 255);
+    if (settings.reinhard)
+        x = x * (1 + x / (settings.white * settings.white)) / (1 + x);
+    return std::min(std::max(x * 255, 0.0f), 255.0f);
+}
+
+#ifdef HDR_IMAGE_X86
+//--------------------------------------------------------------
+// toneMapValue on four channels, truncated like an ofColor conversion
+//
+static __m128i toneMap4(__m128 value, const ToneMapSettings& settings) {
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 x = _mm_mul_ps(value, _mm_set1_ps(settings.exposure / 255));
+    if (settings.reinhard) {
+        __m128 invWhite2 = _mm_set1_ps(1 / (settings.white * settings.white));
+        x = _mm_div_ps(_mm_mul_ps(x, _mm_add_ps(one, _mm_mul_ps(x, invWhite2))), _mm_add_ps(one, x));
+    }
+    x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(255.0f)), _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(x);
+}
+#endif
+
+//--------------------------------------------------------------
+// 16 channels at a time (four SSE registers, packed down to 16 bytes), the
+// rest one by one
+//
+void toneMapRun(const float* src, unsigned char* dst, int count, const ToneMapSettings& settings) {
+    int i = 0;
+#ifdef HDR_IMAGE_X86
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = toneMap4(_mm_loadu_ps(src + i), settings);
+        __m128i b = toneMap4(_mm_loadu_ps(src + i + 4), settings);
+        __m128i c = toneMap4(_mm_loadu_ps(src + i + 8), settings);
+        __m128i d = toneMap4(_mm_loadu_ps(src + i + 12), settings);
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(dst + i), bytes);
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = (unsigned char)toneMapValue(src[i], settings);
+}
+
+//--------------------------------------------------------------
+// rows of the region are contiguous runs of channels in both images
+//
+void toneMap(const HdrImage& hdr, ofPixels& pixels, const ToneMapSettings& settings,
+    int x0, int y0, int x1, int y1) {
+    unsigned char* data = pixels.getData();
+    for (int y = y0; y < y1; y++)
+        toneMapRun(hdr.row(y) + 3 * x0, data + 3 * (y * hdr.width + x0), 3 * (x1 - x0), settings);
+}
+
+void toneMap(const HdrImage& hdr, ofPixels& pixels, const ToneMapSettings& settings) {
+    toneMap(hdr, pixels, settings, 0, hdr.top, hdr.width, hdr.top + hdr.height);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Linear float RGB frame the renderers shade into. Values are in ofColor
+//  units (255 is white at exposure 1) and never clamped, so light beyond 8
+//  bits is kept until toneMap() quantizes the frame into ofPixels.
+//  Image coordinates (row 0 at the top), RGB interleaved row by row. A strip
+//  of a larger image holds only its rows top .. top + height and is still
+//  addressed in the coordinates of the whole image.
+//
+struct HdrImage {
+	void allocate(int w, int h, int firstRow = 0) { width = w; height = h; top = firstRow; rgb.assign(3 * w * h, 0.0f); }
+	bool isAllocated() const { return !rgb.empty(); }
+	const float* row(int y) const { return &rgb[3 * (y - top) * width]; }
+	glm::vec3 get(int x, int y) const {
+		const float* c = &rgb[3 * ((y - top) * width + x)];
+		return glm::vec3(c[0], c[1], c[2]);
+	}
+	void set(int x, int y, const glm::vec3& color) {
+		float* c = &rgb[3 * ((y - top) * width + x)];
+		c[0] = color.x;
+		c[1] = color.y;
+		c[2] = color.z;
+	}
+
+	int width = 0, height = 0;
+	int top = 0;
+	vector<float> rgb;
+};
+
+//  HDR -> 8 bit per channel. Values are scaled by exposure, then either
+//  clamped to 255 or, with reinhard, compressed by x * (1 + x / white^2) / (1 + x)
+//  (x in units of 255) so everything up to white keeps some gradation.
+//
+struct ToneMapSettings {
+	float exposure = 1;
+	bool reinhard = false;
+	float white = 4;
+};
+
+//  the x0..x1, y0..y1 part of hdr into pixels (the whole image, OF_IMAGE_COLOR)
+void toneMap(const HdrImage& hdr, ofPixels& pixels, const ToneMapSettings& settings,
+	int x0, int y0, int x1, int y1);
+//  count channels from src to dst, 16 at a time
+void toneMapRun(const float* src, unsigned char* dst, int count, const ToneMapSettings& settings);
+void toneMap(const HdrImage& hdr, ofPixels& pixels, const ToneMapSettings& settings);
+//  one channel, 0..255 before quantizing
+float toneMapValue(float value, const ToneMapSettings& settings);
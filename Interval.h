@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ofMain.h"
+
+//  Interval arithmetic. An Interval is every value from lo to hi, and each
+//  operation returns an interval holding the result for any operands picked
+//  from its inputs, so a distance function written with these bounds itself
+//  over a whole box of points (see CompiledScene::primInterval). Infinite
+//  ends are allowed; there is no outward rounding, callers keep a margin.
+//
+struct Interval {
+	float lo, hi;
+
+	Interval() : lo(0), hi(0) { }
+	Interval(float value) : lo(value), hi(value) { }
+	Interval(float lo, float hi) : lo(lo), hi(hi) { }
+};
+
+inline Interval operator+(const Interval& a, const Interval& b) { return Interval(a.lo + b.lo, a.hi + b.hi); }
+inline Interval operator-(const Interval& a, const Interval& b) { return Interval(a.lo - b.hi, a.hi - b.lo); }
+inline Interval operator-(const Interval& a) { return Interval(-a.hi, -a.lo); }
+
+//  0 times an infinite end is 0 here, a zero matrix entry drops the axis
+inline Interval operator*(const Interval& a, float s) {
+	if (s == 0)
+		return Interval(0);
+	return (s > 0) ? Interval(a.lo * s, a.hi * s) : Interval(a.hi * s, a.lo * s);
+}
+
+//  b must be positive
+inline Interval operator/(const Interval& a, const Interval& b) {
+	float lo = std::min(a.lo / b.lo, a.lo / b.hi), hi = std::max(a.hi / b.lo, a.hi / b.hi);
+	return Interval(lo, hi);
+}
+
+//  s must be positive
+inline Interval operator*(const Interval& a, const Interval& s) {
+	return Interval(std::min(a.lo * s.lo, a.lo * s.hi), std::max(a.hi * s.lo, a.hi * s.hi));
+}
+
+inline Interval sqr(const Interval& a) {
+	if (a.lo >= 0)
+		return Interval(a.lo * a.lo, a.hi * a.hi);
+	if (a.hi <= 0)
+		return Interval(a.hi * a.hi, a.lo * a.lo);
+	return Interval(0, std::max(a.lo * a.lo, a.hi * a.hi));
+}
+
+inline Interval sqrt(const Interval& a) { return Interval(std::sqrt(std::max(a.lo, 0.0f)), std::sqrt(std::max(a.hi, 0.0f))); }
+
+inline Interval abs(const Interval& a) {
+	if (a.lo >= 0)
+		return a;
+	if (a.hi <= 0)
+		return -a;
+	return Interval(0, std::max(-a.lo, a.hi));
+}
+
+inline Interval min(const Interval& a, const Interval& b) { return Interval(std::min(a.lo, b.lo), std::min(a.hi, b.hi)); }
+inline Interval max(const Interval& a, const Interval& b) { return Interval(std::max(a.lo, b.lo), std::max(a.hi, b.hi)); }
+//  both ranges, for a branch that could go either way
+inline Interval hull(const Interval& a, const Interval& b) { return Interval(std::min(a.lo, b.lo), std::max(a.hi, b.hi)); }
+
+inline Interval length(const Interval& x, const Interval& y) { return sqrt(sqr(x) + sqr(y)); }
+inline Interval length(const Interval& x, const Interval& y, const Interval& z) { return sqrt(sqr(x) + sqr(y) + sqr(z)); }
+
+//  a box of points, one interval per axis
+//
+struct Interval3 {
+	Interval v[3];
+
+	Interval3() { }
+	Interval3(const glm::vec3& lo, const glm::vec3& hi) {
+		for (int a = 0; a < 3; a++)
+			v[a] = Interval(lo[a], hi[a]);
+	}
+	Interval& operator[](int a) { return v[a]; }
+	const Interval& operator[](int a) const { return v[a]; }
+};
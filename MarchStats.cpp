@@ -0,0 +1,94 @@
+#include "MarchStats.h"
+
+thread_local long long sdfEvaluations = 0;
+
+//--------------------------------------------------------------
+// false colour ramp black -> blue -> cyan -> green -> yellow -> red for v in [0, 1]
+//
+static ofColor heatColor(float v) {
+    static const unsigned char ramp[6][3] = {
+        { 0, 0, 0 }, { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 }
+    };
+    v = ofClamp(v, 0, 1) * 5;
+    int i = std::min(int(v), 4);
+    float f = v - i;
+    return ofColor(ramp[i][0] + f * (ramp[i + 1][0] - ramp[i][0]),
+        ramp[i][1] + f * (ramp[i + 1][1] - ramp[i][1]),
+        ramp[i][2] + f * (ramp[i + 1][2] - ramp[i][2]));
+}
+
+//--------------------------------------------------------------
+void MarchStats::reset(int width, int height, int maxSteps) {
+    this->width = width;
+    this->height = height;
+    this->maxSteps = maxSteps;
+    pixels.assign(width * height, PixelStats());
+    coneEvaluations = 0;
+    cullTests = 0;
+    seconds = 0;
+    threads = 0;
+}
+
+//--------------------------------------------------------------
+void MarchStats::writeSummary(ostream& out) const {
+    long long count[3] = { 0, 0, 0 };
+    long long steps[3] = { 0, 0, 0 };
+    long long totalSteps = 0, totalEvaluations = 0;
+    int mostSteps = 0, mostEvaluations = 0;
+    for (int i = 0; i < pixels.size(); i++) {
+        const PixelStats& s = pixels[i];
+        count[s.end]++;
+        steps[s.end] += s.steps;
+        totalSteps += s.steps;
+        totalEvaluations += s.evaluations;
+        mostSteps = std::max(mostSteps, s.steps);
+        mostEvaluations = std::max(mostEvaluations, s.evaluations);
+    }
+    double n = std::max<size_t>(pixels.size(), 1);
+    const char* names[3] = { "hit", "missed", "out of steps" };
+
+    out << "frame " << width << "x" << height << ", " << seconds << "s on " << threads << " threads, "
+        << n / (seconds * 1e6) << " Mrays/s\n";
+    for (int e = 0; e < 3; e++)
+        out << "  " << names[e] << ": " << count[e] << " pixels (" << 100 * count[e] / n << "%), "
+            << (count[e] ? double(steps[e]) / count[e] : 0) << " steps on average\n";
+    out << "  march steps: " << totalSteps << " (" << totalSteps / n << " per pixel, max " << mostSteps
+        << " of " << maxSteps << ")\n"
+        << "  sdf evaluations: " << totalEvaluations + coneEvaluations << " (" << (totalEvaluations + coneEvaluations) / n
+        << " per pixel, max " << mostEvaluations << " in one pixel)\n"
+        << "  cone pre-pass evaluations: " << coneEvaluations << "\n"
+        << "  tile culling interval tests: " << cullTests << endl;
+}
+
+//--------------------------------------------------------------
+void MarchStats::save(const string& outputPath) const {
+    size_t dot = outputPath.find_last_of('.');
+    size_t slash = outputPath.find_last_of("/\\");
+    string base = (dot != string::npos && (slash == string::npos || dot > slash)) ? outputPath.substr(0, dot) : outputPath;
+
+    int mostEvaluations = 1;
+    for (int i = 0; i < pixels.size(); i++)
+        mostEvaluations = std::max(mostEvaluations, pixels[i].evaluations);
+
+    //steps on a fixed scale (the step budget) so frames compare, evaluations
+    //relative to the worst pixel
+    ofPixels stepMap, evalMap, endMap;
+    stepMap.allocate(width, height, OF_IMAGE_COLOR);
+    evalMap.allocate(width, height, OF_IMAGE_COLOR);
+    endMap.allocate(width, height, OF_IMAGE_COLOR);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            const PixelStats& s = pixels[y * width + x];
+            stepMap.setColor(x, y, heatColor(float(s.steps) / std::max(maxSteps, 1)));
+            evalMap.setColor(x, y, heatColor(float(s.evaluations) / mostEvaluations));
+            endMap.setColor(x, y, (s.end == MARCH_END_HIT) ? ofColor(160) :
+                (s.end == MARCH_END_STEPS) ? ofColor::red : ofColor(0, 0, 80));
+        }
+    ofSaveImage(stepMap, base + "_steps.png");
+    ofSaveImage(evalMap, base + "_evals.png");
+    ofSaveImage(endMap, base + "_end.png");
+
+    writeSummary(cout);
+    ofstream report(ofToDataPath(base + "_stats.txt"));
+    writeSummary(report);
+}
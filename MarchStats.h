@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+
+//  Per-pixel ray marching statistics. Only recorded when the project is built
+//  with RAYMARCH_STATS defined; without it ofApp never touches this class and
+//  sceneSDF does no counting.
+//
+//  steps       : march iterations of the pixel's ray
+//  evaluations : every scene sdf evaluation made for the pixel (march, fallbacks
+//                and shading). The cone pre-pass is shared by a block of pixels
+//                and only counted per frame
+//  end         : why the march stopped
+//
+enum MarchEnd { MARCH_END_HIT, MARCH_END_MISS, MARCH_END_STEPS };
+
+struct PixelStats {
+	int steps = 0;
+	int evaluations = 0;
+	int end = MARCH_END_MISS;     // MarchEnd
+};
+
+//  scene evaluations made by the calling thread, bumped by ofApp::sceneSDF
+extern thread_local long long sdfEvaluations;
+
+class MarchStats {
+public:
+	void reset(int width, int height, int maxSteps);
+	//  x, y in image coordinates (row 0 at the top, like the saved image)
+	void record(int x, int y, int steps, int evaluations, MarchEnd end) {
+		//ignore pixels outside the frame given to reset(), e.g. comparison renders
+		if (x >= width || y >= height)
+			return;
+		PixelStats& s = pixels[y * width + x];
+		s.steps = steps;
+		s.evaluations = evaluations;
+		s.end = end;
+	}
+
+	//  <base>_steps.png, <base>_evals.png, <base>_end.png and <base>_stats.txt
+	//  next to outputPath, plus the summary on cout
+	void save(const string& outputPath) const;
+	void writeSummary(ostream& out) const;
+
+	vector<PixelStats> pixels;
+	int width = 0, height = 0;
+	int maxSteps = 0;
+
+	//  frame counters
+	std::atomic<long long> coneEvaluations{ 0 };
+	std::atomic<long long> cullTests{ 0 };   // interval tests of TileCuller
+	float seconds = 0;
+	int threads = 0;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+//  Interface of the SIMD ray packet kernel (PacketKernelImpl.h), shared by the
+//  SSE and AVX2 translation units. Only plain floats cross this boundary so the
+//  AVX2 file never compiles any glm / std inline code that the linker could
+//  pick for a non-AVX caller. The kernel itself has internal linkage for the
+//  same reason.
+//
+
+//  flat copy of CompiledScene, see PacketMarcher::build()
+//  sphere       : cx cy cz r                                (4 floats)
+//  plane        : height                                    (1 float)
+//  torus        : rotate (3x3, column major) translate t.xy (14 floats)
+//  hollowSphere : rotate translate rht w                    (16 floats)
+//
+struct PacketSceneView {
+	const float* spheres;
+	const float* planes;
+	const float* tori;
+	const float* hollowSpheres;
+	int numSpheres, numPlanes, numTori, numHollowSpheres;
+	int repeat;               // every primitive repeated endlessly on one grid
+	float period[3];
+	float offset[3];          // a cell centre
+	float cellMin[3], cellMax[3];   // box of the primitives around the cell centre, inside the cell
+	int bounded;              // clip rays to the scene box and stop at its far side
+	float boundsMin[3], boundsMax[3];
+};
+
+struct PacketMarchParams {
+	int maxSteps;
+	float hitThreshold;
+	float maxDistance;
+	float relaxation;         // 1 = plain sphere tracing
+	int footprint;            // hit threshold grows with pixelRadius * t
+	float pixelRadius;
+};
+
+//  march count rays sharing one origin. directions and hit points are SoA
+//  (x[count], y[count], z[count]), hit[i] is 1 when ray i hit a surface,
+//  steps[i] the number of scene evaluations it took. tStart (may be null)
+//  is a known-empty distance each ray can start from.
+//
+void marchRaysSSE(const PacketSceneView& scene, const PacketMarchParams& params, const float origin[3],
+	int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+	float* px, float* py, float* pz, int* hit, int* steps);
+void marchRaysAVX2(const PacketSceneView& scene, const PacketMarchParams& params, const float origin[3],
+	int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+	float* px, float* py, float* pz, int* hit, int* steps);
@@ -0,0 +1,181 @@
+#pragma once
+
+//  Packet marching kernel template. Include only from the per instruction set
+//  files (PacketMarch.cpp, PacketMarchAVX2.cpp) after defining the vector type.
+//
+#include <cmath>
+#include "PacketKernel.h"
+
+namespace {
+
+//  V is a SIMD float vector type (VecSSE / VecAVX2) providing
+//  WIDTH, set1, load, store, + - * /, sqrt, min, abs, floor,
+//  max, lt, gt, andMask, orMask, andNot (a & ~b), select(mask, a, b), bits(mask).
+//  The arithmetic is written in the same order as the scalar glm code so
+//  both paths round the same way.
+//
+template<class V>
+inline V modPeriod(V x, float c) {
+	// glm::mod(x + c/2, c) - c/2
+	V half = V::set1(0.5f * c);
+	V vc = V::set1(c);
+	V a = x + half;
+	return (a - vc * V::floor(a / vc)) - half;
+}
+
+template<class V>
+inline V sceneDistance(const PacketSceneView& s, V x, V y, V z) {
+	V closest = V::set1(INFINITY);
+	if (s.repeat) {
+		V cx = modPeriod(x - V::set1(s.offset[0]), s.period[0]);
+		V cy = modPeriod(y - V::set1(s.offset[1]), s.period[1]);
+		V cz = modPeriod(z - V::set1(s.offset[2]), s.period[2]);
+		x = cx + V::set1(s.offset[0]);
+		y = cy + V::set1(s.offset[1]);
+		z = cz + V::set1(s.offset[2]);
+		// the nearest other copy is in a face neighbour: the gap to its box
+		// along that axis, with how far p is outside the own box on the others
+		V c[3] = { cx, cy, cz };
+		V gap[3], out[3];
+		V zero = V::set1(0);
+		for (int a = 0; a < 3; a++) {
+			V period = V::set1(s.period[a]);
+			V lo = V::set1(s.cellMin[a]), hi = V::set1(s.cellMax[a]);
+			gap[a] = V::max(V::min(period + lo - c[a], c[a] + period - hi), zero);
+			out[a] = V::max(V::max(lo - c[a], c[a] - hi), zero);
+			gap[a] = gap[a] * gap[a];
+			out[a] = out[a] * out[a];
+		}
+		V neighbour = V::min(V::min(gap[0] + out[1] + out[2], out[0] + gap[1] + out[2]), out[0] + out[1] + gap[2]);
+		closest = V::sqrt(neighbour);
+	}
+
+	for (int i = 0; i < s.numSpheres; i++) {
+		const float* sp = s.spheres + 4 * i;
+		V ex = V::set1(sp[0]) - x, ey = V::set1(sp[1]) - y, ez = V::set1(sp[2]) - z;
+		V d = V::sqrt(ex * ex + ey * ey + ez * ez) - V::set1(sp[3]);
+		closest = V::min(closest, d);
+	}
+
+	for (int i = 0; i < s.numPlanes; i++)
+		closest = V::min(closest, y - V::set1(s.planes[i]));
+
+	for (int i = 0; i < s.numTori; i++) {
+		const float* t = s.tori + 14 * i;
+		V lx = V::set1(t[0]) * x + V::set1(t[3]) * y + V::set1(t[6]) * z + V::set1(t[9]);
+		V ly = V::set1(t[1]) * x + V::set1(t[4]) * y + V::set1(t[7]) * z + V::set1(t[10]);
+		V lz = V::set1(t[2]) * x + V::set1(t[5]) * y + V::set1(t[8]) * z + V::set1(t[11]);
+		V qx = V::sqrt(lx * lx + ly * ly) - V::set1(t[12]);
+		V d = V::sqrt(qx * qx + lz * lz) - V::set1(t[13]);
+		closest = V::min(closest, d);
+	}
+
+	for (int i = 0; i < s.numHollowSpheres; i++) {
+		const float* h = s.hollowSpheres + 16 * i;
+		V lx = V::set1(h[0]) * x + V::set1(h[3]) * y + V::set1(h[6]) * z + V::set1(h[9]);
+		V ly = V::set1(h[1]) * x + V::set1(h[4]) * y + V::set1(h[7]) * z + V::set1(h[10]);
+		V lz = V::set1(h[2]) * x + V::set1(h[5]) * y + V::set1(h[8]) * z + V::set1(h[11]);
+		V r = V::set1(h[12]), height = V::set1(h[13]), thickness = V::set1(h[14]), w = V::set1(h[15]);
+		V qx = V::sqrt(lx * lx + ly * ly);
+		V qy = lz;
+		V rimX = qx - w, rimY = qy - height;
+		V rim = V::sqrt(rimX * rimX + rimY * rimY);
+		V shell = V::abs(V::sqrt(qx * qx + qy * qy) - r);
+		V d = V::select(V::lt(height * qx, w * qy), rim, shell) - thickness;
+		closest = V::min(closest, d);
+	}
+	return closest;
+}
+
+template<class V>
+void marchRaysT(const PacketSceneView& scene, const PacketMarchParams& params, const float origin[3],
+	int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+	float* px, float* py, float* pz, int* hit, int* steps) {
+	const int W = V::WIDTH;
+	float lane[W];
+	for (int i = 0; i < W; i++)
+		lane[i] = (float)i;
+	V laneIndex = V::load(lane);
+	V threshold = V::set1(params.hitThreshold);
+	V pixelRadius = V::set1(params.pixelRadius);
+	V maxDistance = V::set1(params.maxDistance);
+
+	for (int base = 0; base < count; base += W) {
+		int n = (count - base < W) ? count - base : W;
+		// tail lanes repeat the last ray and start out inactive
+		float bx[W], by[W], bz[W], bt[W];
+		for (int i = 0; i < W; i++) {
+			int k = base + ((i < n) ? i : n - 1);
+			bx[i] = dx[k]; by[i] = dy[k]; bz[i] = dz[k];
+			bt[i] = tStart ? tStart[k] : 0;
+		}
+		V rdx = V::load(bx), rdy = V::load(by), rdz = V::load(bz);
+		V ox = V::set1(origin[0]), oy = V::set1(origin[1]), oz = V::set1(origin[2]);
+		V active = V::lt(laneIndex, V::set1((float)n));
+		V hits = V::lt(laneIndex, V::set1(-1.0f));   // all false
+
+		// same slab test as Bounds::clip, lanes that miss the scene box never start
+		V t = V::set1(0), tFar = V::set1(INFINITY);
+		if (scene.bounded) {
+			V one = V::set1(1.0f);
+			V ix = one / rdx, iy = one / rdy, iz = one / rdz;
+			V t1x = (V::set1(scene.boundsMin[0]) - ox) * ix, t2x = (V::set1(scene.boundsMax[0]) - ox) * ix;
+			V t1y = (V::set1(scene.boundsMin[1]) - oy) * iy, t2y = (V::set1(scene.boundsMax[1]) - oy) * iy;
+			V t1z = (V::set1(scene.boundsMin[2]) - oz) * iz, t2z = (V::set1(scene.boundsMax[2]) - oz) * iz;
+			V tNear = V::max(V::max(V::min(t1x, t2x), V::min(t1y, t2y)), V::min(t1z, t2z));
+			tFar = V::min(V::min(V::max(t1x, t2x), V::max(t1y, t2y)), V::max(t1z, t2z));
+			active = V::andNot(active, V::lt(tFar, V::max(tNear, V::set1(0))));
+			t = V::max(tNear, V::set1(0));
+		}
+		t = V::max(t, V::load(bt));
+		V started = V::gt(t, V::set1(0));
+		V x = V::select(started, ox + rdx * t, ox);
+		V y = V::select(started, oy + rdy * t, oy);
+		V z = V::select(started, oz + rdz * t, oz);
+
+		// over-relaxation state, see ofApp::rayMarching
+		V one = V::set1(1.0f), zero = V::set1(0);
+		V omega = V::set1(params.relaxation);
+		V stepLength = zero, previousRadius = zero, stepCount = zero;
+
+		for (int step = 0; step < params.maxSteps && V::bits(active); step++) {
+			V dist = sceneDistance(scene, x, y, z);
+			stepCount = stepCount + V::andMask(active, one);
+
+			V fail = V::andMask(V::andMask(active, V::gt(omega, one)),
+				V::lt(V::abs(dist) + previousRadius, stepLength));
+			V tBack = t - (stepLength - previousRadius);
+
+			V th = params.footprint ? V::max(threshold, pixelRadius * t) : threshold;
+			V hitNow = V::andNot(V::andMask(active, V::lt(dist, th)), fail);
+			V leaving = scene.bounded ? V::gt(t, tFar) : V::gt(dist, maxDistance);
+			V missNow = V::andNot(V::andMask(active, leaving), fail);
+			hits = V::orMask(hits, hitNow);
+			active = V::andNot(V::andNot(active, hitNow), missNow);
+
+			// finished lanes keep their position, failed lanes restart from the last safe point
+			V advance = V::andNot(active, fail);
+			V stepNow = dist * omega;
+			x = V::select(fail, ox + rdx * tBack, V::select(advance, x + rdx * stepNow, x));
+			y = V::select(fail, oy + rdy * tBack, V::select(advance, y + rdy * stepNow, y));
+			z = V::select(fail, oz + rdz * tBack, V::select(advance, z + rdz * stepNow, z));
+			t = V::select(fail, tBack, V::select(advance, t + stepNow, t));
+			previousRadius = V::select(fail, zero, V::select(advance, dist, previousRadius));
+			stepLength = V::select(fail, zero, V::select(advance, stepNow, stepLength));
+			omega = V::select(fail, one, omega);
+		}
+
+		float rx[W], ry[W], rz[W], rs[W];
+		V::store(rx, x); V::store(ry, y); V::store(rz, z); V::store(rs, stepCount);
+		int mask = V::bits(hits);
+		for (int i = 0; i < n; i++) {
+			px[base + i] = rx[i];
+			py[base + i] = ry[i];
+			pz[base + i] = rz[i];
+			hit[base + i] = (mask >> i) & 1;
+			steps[base + i] = (int)rs[i];
+		}
+	}
+}
+
+}
@@ -0,0 +1,188 @@
+#include "PacketMarch.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define PACKET_MARCH_X86
+#endif
+
+#ifdef PACKET_MARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <emmintrin.h>
+
+namespace {
+
+//  4 wide SSE2 vector for the packet kernel
+//
+struct VecSSE {
+	static const int WIDTH = 4;
+	__m128 v;
+
+	static VecSSE make(__m128 v) { VecSSE r; r.v = v; return r; }
+	static VecSSE set1(float f) { return make(_mm_set1_ps(f)); }
+	static VecSSE load(const float* p) { return make(_mm_loadu_ps(p)); }
+	static void store(float* p, VecSSE a) { _mm_storeu_ps(p, a.v); }
+
+	static VecSSE sqrt(VecSSE a) { return make(_mm_sqrt_ps(a.v)); }
+	static VecSSE min(VecSSE a, VecSSE b) { return make(_mm_min_ps(a.v, b.v)); }
+	static VecSSE max(VecSSE a, VecSSE b) { return make(_mm_max_ps(a.v, b.v)); }
+	static VecSSE abs(VecSSE a) { return make(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+	static VecSSE floor(VecSSE a) {
+		// SSE2 has no round instruction: truncate, then step down where that rounded up
+		__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+		return make(_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))));
+	}
+
+	static VecSSE lt(VecSSE a, VecSSE b) { return make(_mm_cmplt_ps(a.v, b.v)); }
+	static VecSSE gt(VecSSE a, VecSSE b) { return make(_mm_cmpgt_ps(a.v, b.v)); }
+	static VecSSE andMask(VecSSE a, VecSSE b) { return make(_mm_and_ps(a.v, b.v)); }
+	static VecSSE orMask(VecSSE a, VecSSE b) { return make(_mm_or_ps(a.v, b.v)); }
+	static VecSSE andNot(VecSSE a, VecSSE b) { return make(_mm_andnot_ps(b.v, a.v)); }
+	static VecSSE select(VecSSE mask, VecSSE a, VecSSE b) {
+		return make(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+	}
+	static int bits(VecSSE mask) { return _mm_movemask_ps(mask.v); }
+};
+
+inline VecSSE operator+(VecSSE a, VecSSE b) { return VecSSE::make(_mm_add_ps(a.v, b.v)); }
+inline VecSSE operator-(VecSSE a, VecSSE b) { return VecSSE::make(_mm_sub_ps(a.v, b.v)); }
+inline VecSSE operator*(VecSSE a, VecSSE b) { return VecSSE::make(_mm_mul_ps(a.v, b.v)); }
+inline VecSSE operator/(VecSSE a, VecSSE b) { return VecSSE::make(_mm_div_ps(a.v, b.v)); }
+
+}
+
+#include "PacketKernelImpl.h"
+
+void marchRaysSSE(const PacketSceneView& scene, const PacketMarchParams& params, const float origin[3],
+    int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+    float* px, float* py, float* pz, int* hit, int* steps) {
+    marchRaysT<VecSSE>(scene, params, origin, count, dx, dy, dz, tStart, px, py, pz, hit, steps);
+}
+#endif
+
+//--------------------------------------------------------------
+SimdLevel PacketMarcher::detectSimdLevel() {
+#if defined(PACKET_MARCH_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    bool avx2 = false;
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        // the OS has to save the ymm registers too
+        bool ymmState = osxsave && ((_xgetbv(0) & 6) == 6);
+        __cpuidex(info, 7, 0);
+        avx2 = avx && ymmState && (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? SIMD_AVX2 : SIMD_SSE;
+#elif defined(PACKET_MARCH_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+const char* PacketMarcher::levelName(SimdLevel level) {
+    switch (level) {
+    case SIMD_AVX2:
+        return "AVX2 (8 wide)";
+    case SIMD_SSE:
+        return "SSE (4 wide)";
+    default:
+        return "scalar";
+    }
+}
+
+//--------------------------------------------------------------
+// flatten the CompiledScene into the float layout documented in PacketKernel.h
+//
+void PacketMarcher::build(const CompiledScene& scene) {
+    spheres.clear();
+    planes.clear();
+    tori.clear();
+    hollowSpheres.clear();
+
+    for (int i = 0; i < scene.spheres.size(); i++) {
+        const SpherePrim& s = scene.spheres[i];
+        float data[4] = { s.center.x, s.center.y, s.center.z, s.radius };
+        spheres.insert(spheres.end(), data, data + 4);
+    }
+    for (int i = 0; i < scene.planes.size(); i++)
+        planes.push_back(scene.planes[i].height);
+
+    for (int i = 0; i < scene.tori.size(); i++) {
+        const TorusPrim& t = scene.tori[i];
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                tori.push_back(t.toLocal.rotate[c][r]);
+        float data[5] = { t.toLocal.translate.x, t.toLocal.translate.y, t.toLocal.translate.z, t.t.x, t.t.y };
+        tori.insert(tori.end(), data, data + 5);
+    }
+    for (int i = 0; i < scene.hollowSpheres.size(); i++) {
+        const HollowSpherePrim& h = scene.hollowSpheres[i];
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                hollowSpheres.push_back(h.toLocal.rotate[c][r]);
+        float data[7] = { h.toLocal.translate.x, h.toLocal.translate.y, h.toLocal.translate.z,
+            h.rht.x, h.rht.y, h.rht.z, h.w };
+        hollowSpheres.insert(hollowSpheres.end(), data, data + 7);
+    }
+
+    view.spheres = spheres.data();
+    view.planes = planes.data();
+    view.tori = tori.data();
+    view.hollowSpheres = hollowSpheres.data();
+    view.numSpheres = (int)scene.spheres.size();
+    view.numPlanes = (int)scene.planes.size();
+    view.numTori = (int)scene.tori.size();
+    view.numHollowSpheres = (int)scene.hollowSpheres.size();
+
+    //the kernel tests every primitive with one fold for all of them: no BVH,
+    //no CSG models or meshes, and either nothing or everything repeated endlessly on the same grid
+    //without size variation, every copy inside its own cell
+    sceneFits = scene.nodes.empty() && scene.csgModels.empty() && scene.meshes.empty();
+    view.repeat = !scene.repeated.empty();
+    if (view.repeat) {
+        const RepeatedPrim& first = scene.repeated[0];
+        Bounds cell;
+        sceneFits = sceneFits && scene.planes.empty() && scene.repeated.size() == scene.size();
+        for (int i = 0; i < scene.repeated.size(); i++) {
+            const RepeatedPrim& r = scene.repeated[i];
+            for (int a = 0; a < 3; a++)
+                sceneFits = sceneFits && r.repetition.period[a] > 0 && r.repetition.count[a] <= 0;
+            sceneFits = sceneFits && r.period == first.period && r.repetition.sizeJitter <= 0;
+            Bounds box = r.cellBox;
+            box.min += r.origin - first.origin;
+            box.max += r.origin - first.origin;
+            cell.grow(box);
+        }
+        for (int a = 0; a < 3; a++) {
+            sceneFits = sceneFits && cell.min[a] > -0.5f * first.period[a] && cell.max[a] < 0.5f * first.period[a];
+            view.period[a] = first.period[a];
+            view.offset[a] = first.origin[a];
+            view.cellMin[a] = cell.min[a];
+            view.cellMax[a] = cell.max[a];
+        }
+    }
+    view.bounded = scene.bounded;
+    for (int i = 0; i < 3; i++) {
+        view.boundsMin[i] = scene.bounds.min[i];
+        view.boundsMax[i] = scene.bounds.max[i];
+    }
+}
+
+void PacketMarcher::march(const MarchSettings& settings, const glm::vec3& origin,
+    int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+    float* px, float* py, float* pz, int* hit, int* steps) const {
+#ifdef PACKET_MARCH_X86
+    PacketMarchParams params = { settings.maxSteps, settings.hitThreshold, settings.maxDistance,
+        settings.stepScale(), settings.strategy != MARCH_BASIC, settings.pixelRadius };
+    float o[3] = { origin.x, origin.y, origin.z };
+    if (level == SIMD_AVX2)
+        marchRaysAVX2(view, params, o, count, dx, dy, dz, tStart, px, py, pz, hit, steps);
+    else
+        marchRaysSSE(view, params, o, count, dx, dy, dz, tStart, px, py, pz, hit, steps);
+#endif
+}
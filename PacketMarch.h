@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CompiledScene.h"
+#include "PacketKernel.h"
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE, SIMD_AVX2 };
+
+//  Marches packets of 4 (SSE) or 8 (AVX2) neighbouring rays together against
+//  the CompiledScene. The instruction set is picked at runtime; on CPUs (or
+//  builds) without either one isAvailable() is false and callers keep using
+//  the scalar ofApp::rayMarching.
+//
+class PacketMarcher {
+public:
+	PacketMarcher() { level = detectSimdLevel(); }
+
+	void build(const CompiledScene& scene);
+	bool isAvailable() const { return level != SIMD_SCALAR; }
+	//  false for scenes the kernel cannot march (see build())
+	bool fitsScene() const { return sceneFits; }
+	int width() const { return (level == SIMD_AVX2) ? 8 : (level == SIMD_SSE) ? 4 : 1; }
+
+	void march(const MarchSettings& settings, const glm::vec3& origin,
+		int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+		float* px, float* py, float* pz, int* hit, int* steps) const;
+
+	static SimdLevel detectSimdLevel();
+	static const char* levelName(SimdLevel level);
+
+	SimdLevel level;
+
+private:
+	vector<float> spheres, planes, tori, hollowSpheres;
+	PacketSceneView view;
+	bool sceneFits = true;
+};
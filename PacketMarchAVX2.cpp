@@ -0,0 +1,56 @@
+//  AVX2 build of the packet kernel. Only called after PacketMarcher has checked
+//  the CPU, so this whole file is compiled for AVX2 (GCC / Clang need the
+//  pragma, MSVC emits the intrinsics without extra flags).
+//  Keep includes to the kernel header - see the note in PacketKernel.h.
+//
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2")
+#endif
+#include <immintrin.h>
+
+namespace {
+
+//  8 wide AVX2 vector for the packet kernel
+//
+struct VecAVX2 {
+	static const int WIDTH = 8;
+	__m256 v;
+
+	static VecAVX2 make(__m256 v) { VecAVX2 r; r.v = v; return r; }
+	static VecAVX2 set1(float f) { return make(_mm256_set1_ps(f)); }
+	static VecAVX2 load(const float* p) { return make(_mm256_loadu_ps(p)); }
+	static void store(float* p, VecAVX2 a) { _mm256_storeu_ps(p, a.v); }
+
+	static VecAVX2 sqrt(VecAVX2 a) { return make(_mm256_sqrt_ps(a.v)); }
+	static VecAVX2 min(VecAVX2 a, VecAVX2 b) { return make(_mm256_min_ps(a.v, b.v)); }
+	static VecAVX2 max(VecAVX2 a, VecAVX2 b) { return make(_mm256_max_ps(a.v, b.v)); }
+	static VecAVX2 abs(VecAVX2 a) { return make(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+	static VecAVX2 floor(VecAVX2 a) { return make(_mm256_floor_ps(a.v)); }
+
+	static VecAVX2 lt(VecAVX2 a, VecAVX2 b) { return make(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+	static VecAVX2 gt(VecAVX2 a, VecAVX2 b) { return make(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+	static VecAVX2 andMask(VecAVX2 a, VecAVX2 b) { return make(_mm256_and_ps(a.v, b.v)); }
+	static VecAVX2 orMask(VecAVX2 a, VecAVX2 b) { return make(_mm256_or_ps(a.v, b.v)); }
+	static VecAVX2 andNot(VecAVX2 a, VecAVX2 b) { return make(_mm256_andnot_ps(b.v, a.v)); }
+	static VecAVX2 select(VecAVX2 mask, VecAVX2 a, VecAVX2 b) { return make(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+	static int bits(VecAVX2 mask) { return _mm256_movemask_ps(mask.v); }
+};
+
+inline VecAVX2 operator+(VecAVX2 a, VecAVX2 b) { return VecAVX2::make(_mm256_add_ps(a.v, b.v)); }
+inline VecAVX2 operator-(VecAVX2 a, VecAVX2 b) { return VecAVX2::make(_mm256_sub_ps(a.v, b.v)); }
+inline VecAVX2 operator*(VecAVX2 a, VecAVX2 b) { return VecAVX2::make(_mm256_mul_ps(a.v, b.v)); }
+inline VecAVX2 operator/(VecAVX2 a, VecAVX2 b) { return VecAVX2::make(_mm256_div_ps(a.v, b.v)); }
+
+}
+
+#include "PacketKernelImpl.h"
+
+void marchRaysAVX2(const PacketSceneView& scene, const PacketMarchParams& params, const float origin[3],
+    int count, const float* dx, const float* dy, const float* dz, const float* tStart,
+    float* px, float* py, float* pz, int* hit, int* steps) {
+    marchRaysT<VecAVX2>(scene, params, origin, count, dx, dy, dz, tStart, px, py, pz, hit, steps);
+}
+
+#endif
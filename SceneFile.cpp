@@ -0,0 +1,454 @@
+#include "SceneFile.h"
+#include "Shading.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+struct CacheHeader {
+	char magic[8];
+	int version;
+	int objectBytes;          // sizeof(ObjectDesc), catches builds with another layout
+	unsigned long long textHash;
+};
+
+static const char CACHE_MAGIC[8] = { 'R', 'M', 'S', 'C', 'E', 'N', 'E', 0 };
+
+//--------------------------------------------------------------
+// the whole file in one read, straight into data
+//
+static bool readFile(const string& path, string& data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    std::streamoff size = file.tellg();
+    if (size < 0)
+        return false;
+    data.resize((size_t)size);
+    file.seekg(0);
+    return (bool)file.read(&data[0], size) || size == 0;
+}
+
+//--------------------------------------------------------------
+// FNV-1a
+//
+static unsigned long long hashBytes(const string& data) {
+    unsigned long long h = 14695981039346656037ull;
+    for (int i = 0; i < data.size(); i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//--------------------------------------------------------------
+// cache blocks: byte count, the bytes, zero padding to a multiple of 8 so
+// every block starts aligned
+//
+template <class T>
+static void writeBlock(std::ofstream& out, const T* values, size_t count) {
+    unsigned long long bytes = count * sizeof(T);
+    out.write((const char*)&bytes, sizeof(bytes));
+    out.write((const char*)values, bytes);
+    static const char zeros[8] = { 0 };
+    out.write(zeros, (8 - bytes % 8) % 8);
+}
+
+template <class T>
+static void writeBlock(std::ofstream& out, const vector<T>& values) {
+    writeBlock(out, values.data(), values.size());
+}
+
+template <class T>
+static bool readBlock(const char*& p, const char* end, vector<T>& values) {
+    unsigned long long bytes;
+    if (end - p < sizeof(bytes))
+        return false;
+    memcpy(&bytes, p, sizeof(bytes));
+    p += sizeof(bytes);
+    unsigned long long padded = bytes + (8 - bytes % 8) % 8;
+    if (bytes % sizeof(T) != 0 || padded > (unsigned long long)(end - p))
+        return false;
+    values.resize(bytes / sizeof(T));
+    memcpy(values.data(), p, bytes);
+    p += padded;
+    return true;
+}
+
+//--------------------------------------------------------------
+static bool toNumber(const string& word, float& value) {
+    char* end;
+    value = strtof(word.c_str(), &end);
+    return !word.empty() && *end == 0;
+}
+
+//--------------------------------------------------------------
+// count numbers from args[at], false when there are fewer
+//
+static bool readNumbers(const vector<string>& args, int& at, float* values, int count) {
+    for (int i = 0; i < count; i++, at++)
+        if (at >= args.size() || !toNumber(args[at], values[i]))
+            return false;
+    return true;
+}
+
+static bool readVec(const vector<string>& args, int& at, glm::vec3& v) {
+    return readNumbers(args, at, &v[0], 3);
+}
+
+//--------------------------------------------------------------
+static void setColor(ObjectDesc& o, const ofColor& c) {
+    o.color[0] = c.r;
+    o.color[1] = c.g;
+    o.color[2] = c.b;
+    o.color[3] = 255;
+}
+
+//--------------------------------------------------------------
+bool ObjectDesc::operator==(const ObjectDesc& o) const {
+    return type == o.type && mesh == o.mesh && position == o.position && rotation == o.rotation && shape == o.shape
+        && repetition.period == o.repetition.period && repetition.count == o.repetition.count
+        && repetition.sizeJitter == o.repetition.sizeJitter && repetition.colorJitter == o.repetition.colorJitter
+        && memcmp(color, o.color, sizeof(color)) == 0;
+}
+
+//--------------------------------------------------------------
+SceneFile::FileStamp SceneFile::stamp(const string& file) {
+    FileStamp s;
+    std::error_code error;
+    unsigned long long size = fs::file_size(file, error);
+    if (error)
+        return s;
+    fs::file_time_type time = fs::last_write_time(file, error);
+    if (error)
+        return s;
+    s.size = (long long)size;
+    s.time = (long long)time.time_since_epoch().count();
+    return s;
+}
+
+//--------------------------------------------------------------
+bool SceneFile::load(const string& path) {
+    float start = ofGetElapsedTimef();
+    string text;
+    if (!readFile(path, text)) {
+        error = "cannot read " + path;
+        return false;
+    }
+    unsigned long long textHash = hashBytes(text);
+    string cachePath = path + ".bin";
+
+    SceneDesc loaded;
+    vector<FileStamp> stamps;
+    bool cached = readCache(cachePath, textHash, loaded, stamps);
+    if (!cached) {
+        loaded = SceneDesc();
+        string folder = fs::path(path).parent_path().string();
+        if (!parse(text, folder, loaded) || !loadMeshes(loaded, stamps)) {
+            //a half edited file is not tried again before its next save
+            if (path == this->path)
+                textStamp = stamp(path);
+            return false;
+        }
+        writeCache(cachePath, textHash, loaded, stamps);
+    }
+    this->path = path;
+    textStamp = stamp(path);
+    fromCache = cached;
+    keep(loaded, stamps);
+    loadSeconds = ofGetElapsedTimef() - start;
+    return true;
+}
+
+//--------------------------------------------------------------
+bool SceneFile::loadText(const string& text) {
+    float start = ofGetElapsedTimef();
+    SceneDesc loaded;
+    vector<FileStamp> stamps;
+    if (!parse(text, "", loaded) || !loadMeshes(loaded, stamps))
+        return false;
+    path.clear();
+    textStamp = FileStamp();
+    fromCache = false;
+    keep(loaded, stamps);
+    loadSeconds = ofGetElapsedTimef() - start;
+    return true;
+}
+
+//--------------------------------------------------------------
+// the new scene, and only its meshes stay loaded
+//
+void SceneFile::keep(const SceneDesc& desc, const vector<FileStamp>& stamps) {
+    scene = desc;
+    meshStamps = stamps;
+    meshData.clear();
+    meshDataStamps.clear();
+    for (int i = 0; i < desc.meshFiles.size(); i++) {
+        meshData[desc.meshFiles[i]] = desc.meshes[i];
+        meshDataStamps[desc.meshFiles[i]] = stamps[i];
+    }
+    error.clear();
+}
+
+//--------------------------------------------------------------
+bool SceneFile::changed() const {
+    if (path.empty())
+        return false;
+    if (stamp(path) != textStamp)
+        return true;
+    for (int i = 0; i < scene.meshFiles.size(); i++)
+        if (stamp(scene.meshFiles[i]) != meshStamps[i])
+            return true;
+    return false;
+}
+
+//--------------------------------------------------------------
+// one statement per line, see the format in SceneFile.h. Mesh files are only
+// named here, loadMeshes() reads them
+//
+bool SceneFile::parse(const string& text, const string& folder, SceneDesc& out) {
+    std::istringstream lines(text);
+    string line;
+    int number = 0;
+    while (getline(lines, line)) {
+        number++;
+        size_t comment = line.find('#');
+        if (comment != string::npos)
+            line.erase(comment);
+        std::istringstream words(line);
+        vector<string> args;
+        string word;
+        while (words >> word)
+            args.push_back(word);
+        if (args.empty())
+            continue;
+
+        string keyword = args[0];
+        int at = 1;
+        bool ok = true;
+        if (keyword == "camera")
+            ok = readVec(args, at, out.view.camera);
+        else if (keyword == "image") {
+            float size[2] = { 0, 0 };
+            ok = readNumbers(args, at, size, 2) && size[0] >= 1 && size[1] >= 1;
+            out.view.width = (int)size[0];
+            out.view.height = (int)size[1];
+        }
+        else if (keyword == "ambient")
+            ok = readNumbers(args, at, &out.view.ambient, 1);
+        else if (keyword == "light") {
+            //the shader packs at most MAX_SHADED_LIGHTS
+            if (out.lights.size() == MAX_SHADED_LIGHTS) {
+                error = "line " + ofToString(number) + ": more than " + ofToString(MAX_SHADED_LIGHTS) + " lights";
+                return false;
+            }
+            LightDesc light;
+            ok = readVec(args, at, light.position) && readNumbers(args, at, &light.intensity, 1);
+            out.lights.push_back(light);
+        }
+        else if (keyword == "set") {
+            SettingDesc setting;
+            ok = args.size() == 3 && args[1].size() < sizeof(setting.name);
+            if (ok) {
+                strcpy(setting.name, args[1].c_str());
+                if (args[1] == "strategy" && args[2] == "basic")
+                    setting.value = MARCH_BASIC;
+                else if (args[1] == "strategy" && args[2] == "footprint")
+                    setting.value = MARCH_FOOTPRINT;
+                else if (args[1] == "strategy" && args[2] == "relaxed")
+                    setting.value = MARCH_RELAXED;
+                else
+                    ok = toNumber(args[2], setting.value);
+                at = 3;
+                out.settings.push_back(setting);
+            }
+        }
+        else {
+            //objects: type, the type's numbers, then options
+            ObjectDesc o;
+            if (keyword == "sphere") {
+                o.type = OBJECT_SPHERE;
+                setColor(o, ofColor::lightGray);
+                ok = readVec(args, at, o.position) && readNumbers(args, at, &o.shape.x, 1);
+            }
+            else if (keyword == "plane") {
+                o.type = OBJECT_PLANE;
+                setColor(o, ofColor::darkOliveGreen);
+                ok = readNumbers(args, at, &o.position.y, 1);
+            }
+            else if (keyword == "torus") {
+                o.type = OBJECT_TORUS;
+                setColor(o, ofColor::lightGray);
+                o.rotation = glm::vec3(20, 45, 0);
+                ok = readVec(args, at, o.position) && readNumbers(args, at, &o.shape.x, 2);
+            }
+            else if (keyword == "hollowsphere") {
+                o.type = OBJECT_HOLLOW_SPHERE;
+                setColor(o, ofColor::lightGray);
+                o.rotation = glm::vec3(20, -45, 0);
+                o.shape = glm::vec3(0.1, 0.05, 0.05);
+                ok = readVec(args, at, o.position);
+                float radius;
+                if (ok && at < args.size() && toNumber(args[at], radius))
+                    ok = readVec(args, at, o.shape);
+            }
+            else if (keyword == "mesh" && args.size() > 1) {
+                o.type = OBJECT_MESH;
+                setColor(o, ofColor::lightGray);
+                string file = args[at++];
+                if (!folder.empty() && fs::path(file).is_relative())
+                    file = (fs::path(folder) / file).string();
+                o.mesh = (int)(std::find(out.meshFiles.begin(), out.meshFiles.end(), file) - out.meshFiles.begin());
+                if (o.mesh == out.meshFiles.size())
+                    out.meshFiles.push_back(file);
+                ok = readVec(args, at, o.position) && readNumbers(args, at, &o.shape.x, 1);
+            }
+            else {
+                error = "line " + ofToString(number) + ": unknown statement " + keyword;
+                return false;
+            }
+
+            while (ok && at < args.size()) {
+                string option = args[at++];
+                glm::vec3 v;
+                if (option == "jitter") {
+                    ok = readNumbers(args, at, &v.x, 2) && v.x >= 0 && v.x < 1 && v.y >= 0 && v.y <= 1;
+                    o.repetition.sizeJitter = v.x;
+                    o.repetition.colorJitter = v.y;
+                    continue;
+                }
+                ok = readVec(args, at, v);
+                if (option == "color") {
+                    ok = ok && std::min(v.x, std::min(v.y, v.z)) >= 0 && std::max(v.x, std::max(v.y, v.z)) <= 255;
+                    setColor(o, ofColor(v.x, v.y, v.z));
+                }
+                else if (option == "rotate")
+                    o.rotation = v;
+                else if (option == "repeat")
+                    o.repetition.period = v;
+                else if (option == "count") {
+                    ok = ok && std::min(v.x, std::min(v.y, v.z)) >= 0 && glm::vec3(glm::ivec3(v)) == v;
+                    o.repetition.count = glm::ivec3(v);
+                }
+                else
+                    ok = false;
+            }
+            out.objects.push_back(o);
+        }
+
+        if (!ok || at != args.size()) {
+            error = "line " + ofToString(number) + ": cannot read \"" + line + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------------------
+// the meshes loaded before with an unchanged file are shared, not read again
+//
+bool SceneFile::loadMeshes(SceneDesc& out, vector<FileStamp>& stamps) {
+    out.meshes.clear();
+    stamps.clear();
+    for (int i = 0; i < out.meshFiles.size(); i++) {
+        const string& file = out.meshFiles[i];
+        FileStamp current = stamp(file);
+        auto known = meshData.find(file);
+        if (known != meshData.end() && meshDataStamps[file] == current)
+            out.meshes.push_back(known->second);
+        else {
+            shared_ptr<TriMesh> mesh = make_shared<TriMesh>();
+            if (!mesh->load(file)) {
+                error = "cannot load a mesh from " + file;
+                return false;
+            }
+            out.meshes.push_back(mesh);
+        }
+        stamps.push_back(current);
+    }
+    return true;
+}
+
+//--------------------------------------------------------------
+// header, then blocks: objects, lights, settings, view, mesh file stamps and
+// per mesh its name, vertices, triangles, BVH nodes, pseudo normals and box
+//
+void SceneFile::writeCache(const string& cachePath, unsigned long long textHash, const SceneDesc& desc,
+    const vector<FileStamp>& stamps) const {
+    //written aside and renamed, so a cut off write never looks like a cache
+    string partPath = cachePath + ".part";
+    {
+        std::ofstream out(partPath, std::ios::binary);
+        if (!out)
+            return;
+        CacheHeader header;
+        memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = CACHE_VERSION;
+        header.objectBytes = sizeof(ObjectDesc);
+        header.textHash = textHash;
+        out.write((const char*)&header, sizeof(header));
+        writeBlock(out, desc.objects);
+        writeBlock(out, desc.lights);
+        writeBlock(out, desc.settings);
+        writeBlock(out, &desc.view, 1);
+        writeBlock(out, stamps);
+        for (int i = 0; i < desc.meshes.size(); i++) {
+            const TriMesh& mesh = *desc.meshes[i];
+            writeBlock(out, desc.meshFiles[i].data(), desc.meshFiles[i].size());
+            writeBlock(out, mesh.vertices);
+            writeBlock(out, mesh.triangles);
+            writeBlock(out, mesh.nodes);
+            writeBlock(out, mesh.vertexNormals);
+            writeBlock(out, mesh.edgeNormals);
+            writeBlock(out, &mesh.bounds, 1);
+        }
+        if (!out)
+            return;
+    }
+    std::error_code error;
+    fs::rename(partPath, cachePath, error);
+}
+
+//--------------------------------------------------------------
+// false when there is no cache, it was written for another text or build, or
+// one of its mesh files changed since
+//
+bool SceneFile::readCache(const string& cachePath, unsigned long long textHash, SceneDesc& out,
+    vector<FileStamp>& stamps) {
+    string data;
+    if (!readFile(cachePath, data) || data.size() < sizeof(CacheHeader))
+        return false;
+    CacheHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION
+        || header.objectBytes != sizeof(ObjectDesc) || header.textHash != textHash)
+        return false;
+
+    const char* p = data.data() + sizeof(header);
+    const char* end = data.data() + data.size();
+    vector<ViewDesc> view;
+    if (!readBlock(p, end, out.objects) || !readBlock(p, end, out.lights) || !readBlock(p, end, out.settings)
+        || !readBlock(p, end, view) || view.size() != 1 || !readBlock(p, end, stamps))
+        return false;
+    out.view = view[0];
+
+    for (int i = 0; i < stamps.size(); i++) {
+        vector<char> name;
+        if (!readBlock(p, end, name))
+            return false;
+        string file(name.begin(), name.end());
+        if (stamp(file) != stamps[i])
+            return false;
+        shared_ptr<TriMesh> mesh = make_shared<TriMesh>();
+        vector<Bounds> bounds;
+        if (!readBlock(p, end, mesh->vertices) || !readBlock(p, end, mesh->triangles) || !readBlock(p, end, mesh->nodes)
+            || !readBlock(p, end, mesh->vertexNormals) || !readBlock(p, end, mesh->edgeNormals)
+            || !readBlock(p, end, bounds) || bounds.size() != 1)
+            return false;
+        mesh->bounds = bounds[0];
+        out.meshFiles.push_back(file);
+        out.meshes.push_back(mesh);
+    }
+    return p == end;
+}
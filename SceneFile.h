@@ -0,0 +1,120 @@
+#pragma once
+
+#include "CompiledScene.h"
+#include "TriMesh.h"
+
+//  One object line of a scene file. shape holds the type's size parameters:
+//      sphere          radius
+//      torus           ring and tube radius
+//      hollow sphere   radius, opening height and thickness (HollowSphere::rht)
+//      mesh            length of the longest side
+//  Types and parameters the line leaves out take the object constructors'
+//  defaults, so a description fully determines its SceneObject.
+//
+enum SceneObjectType { OBJECT_SPHERE, OBJECT_PLANE, OBJECT_TORUS, OBJECT_HOLLOW_SPHERE, OBJECT_MESH };
+
+struct ObjectDesc {
+	int type;
+	int mesh = -1;                      // index in SceneDesc::meshFiles
+	glm::vec3 position = glm::vec3(0);
+	glm::vec3 rotation = glm::vec3(0);  // degrees, positioned and rotated types only
+	glm::vec3 shape = glm::vec3(0);
+	Repetition repetition;              // period 0 = a single copy
+	unsigned char color[4];             // rgb, alpha unused
+
+	bool operator==(const ObjectDesc& o) const;
+	bool operator!=(const ObjectDesc& o) const { return !(*this == o); }
+};
+
+struct LightDesc {
+	glm::vec3 position;
+	float intensity;
+};
+
+//  set lines, applied by name to the GUI sliders (see ofApp::applyScene)
+struct SettingDesc {
+	char name[16];
+	float value;
+};
+
+//  camera, ambient light and image size; width 0 keeps the app's
+struct ViewDesc {
+	glm::vec3 camera = glm::vec3(0, 0, 10);
+	float ambient = 4;
+	int width = 0, height = 0;
+};
+
+struct SceneDesc {
+	vector<ObjectDesc> objects;
+	vector<LightDesc> lights;
+	vector<SettingDesc> settings;
+	ViewDesc view;
+	vector<string> meshFiles;                 // resolved against the scene file's folder
+	vector<shared_ptr<TriMesh>> meshes;       // loaded and built, one per meshFiles entry
+};
+
+//  Text scene description, one statement per line, # starts a comment:
+//      camera X Y Z                     render camera position (it looks down -z)
+//      image W H                        image size
+//      ambient I                        ambient light intensity
+//      light X Y Z I                    point light, up to MAX_SHADED_LIGHTS (32)
+//      set NAME VALUE                   GUI setting, e.g. set strategy relaxed,
+//                                       set shadows 1 (see ofApp::applyScene)
+//      sphere X Y Z R
+//      plane Y                          horizontal plane at height Y
+//      torus X Y Z R r
+//      hollowsphere X Y Z [R H T]
+//      mesh FILE X Y Z SIZE             OBJ or PLY file, relative to this one
+//  Object lines may end with any of
+//      color R G B    rotate X Y Z    repeat PX PY PZ
+//      count CX CY CZ                   copies along each repeated axis,
+//                                       0 = endless (Repetition::count)
+//      jitter SIZE COLOR                Repetition::sizeJitter and colorJitter
+//  count and jitter only matter with repeat.
+//
+//  load() parses the text and loads the meshes, then writes everything,
+//  meshes with their BVH, as one flat binary file next to it (path + ".bin").
+//  The next load() of an unchanged text with unchanged mesh files reads that
+//  instead: one read of the file and a copy per array, no parsing and no BVH
+//  builds. Meshes stay loaded between load() calls and are read again only
+//  when their file changed, so reloading an edited scene costs its text.
+//
+class SceneFile {
+public:
+	static const int CACHE_VERSION = 2;
+
+	//  false with error set when the text has errors or a mesh cannot be
+	//  loaded, the previous scene then stays
+	bool load(const string& path);
+	//  the text, without a file: no cache, meshes relative to the working folder
+	bool loadText(const string& text);
+	//  the file or one of its meshes changed on disk since load()
+	bool changed() const;
+
+	SceneDesc scene;
+	string path;
+	string error;
+	bool fromCache = false;     // the last load() read the binary cache
+	float loadSeconds = 0;
+
+private:
+	struct FileStamp {
+		long long size = -1;
+		long long time = 0;
+		bool operator==(const FileStamp& o) const { return size == o.size && time == o.time; }
+		bool operator!=(const FileStamp& o) const { return !(*this == o); }
+	};
+	static FileStamp stamp(const string& file);
+
+	bool parse(const string& text, const string& folder, SceneDesc& out);
+	bool loadMeshes(SceneDesc& out, vector<FileStamp>& stamps);
+	bool readCache(const string& cachePath, unsigned long long textHash, SceneDesc& out, vector<FileStamp>& stamps);
+	void writeCache(const string& cachePath, unsigned long long textHash, const SceneDesc& desc,
+		const vector<FileStamp>& stamps) const;
+	void keep(const SceneDesc& desc, const vector<FileStamp>& stamps);
+
+	FileStamp textStamp;
+	vector<FileStamp> meshStamps;
+	std::map<string, shared_ptr<TriMesh>> meshData;   // by file, kept for reloads
+	std::map<string, FileStamp> meshDataStamps;
+};
@@ -0,0 +1,107 @@
+#include "Shading.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define SHADING_X86
+#include <emmintrin.h>
+#endif
+
+//--------------------------------------------------------------
+// append a light, keeping the arrays padded with intensity 0 lights. these
+// sit far above the scene so they never divide by a zero distance
+//
+void LightPack::add(const glm::vec3& position, float lightIntensity) {
+    if (count == MAX_SHADED_LIGHTS)
+        return;
+    if (count == x.size()) {
+        x.resize(count + SHADE_WIDTH, 0.0f);
+        y.resize(count + SHADE_WIDTH, 1e6f);
+        z.resize(count + SHADE_WIDTH, 0.0f);
+        intensity.resize(count + SHADE_WIDTH, 0.0f);
+    }
+    x[count] = position.x;
+    y[count] = position.y;
+    z[count] = position.z;
+    intensity[count] = lightIntensity;
+    count++;
+}
+
+#ifdef SHADING_X86
+
+//--------------------------------------------------------------
+// x^power for a whole power, by squaring
+//
+static __m128 powWhole(__m128 x, int power) {
+    __m128 result = _mm_set1_ps(1.0f);
+    for (; power > 0; power >>= 1) {
+        if (power & 1)
+            result = _mm_mul_ps(result, x);
+        x = _mm_mul_ps(x, x);
+    }
+    return result;
+}
+
+static float horizontalSum(__m128 v) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+//--------------------------------------------------------------
+// four lights per iteration: the diffuse term uses dot(n, light position)
+// like the scalar phong always did, the specular one the half vector between
+// the directions to the light and to the eye
+//
+void shadeLights(const LightPack& lights, const glm::vec3& p, const glm::vec3& n, const glm::vec3& eye,
+    float power, const float* visibility, float& diffuse, float& specular) {
+    __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+    __m128 nx = _mm_set1_ps(n.x), ny = _mm_set1_ps(n.y), nz = _mm_set1_ps(n.z);
+    __m128 ex = _mm_set1_ps(eye.x - p.x), ey = _mm_set1_ps(eye.y - p.y), ez = _mm_set1_ps(eye.z - p.z);
+    __m128 zero = _mm_setzero_ps();
+    __m128 diffuseSum = zero, specularSum = zero;
+    int whole = (int)(power + 0.5f);
+
+    for (int i = 0; i < lights.padded(); i += SHADE_WIDTH) {
+        __m128 lx = _mm_loadu_ps(&lights.x[i]), ly = _mm_loadu_ps(&lights.y[i]), lz = _mm_loadu_ps(&lights.z[i]);
+        __m128 dx = _mm_sub_ps(lx, px), dy = _mm_sub_ps(ly, py), dz = _mm_sub_ps(lz, pz);
+        __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+        __m128 lambert = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+        lambert = _mm_max_ps(lambert, zero);
+
+        __m128 hx = _mm_add_ps(dx, ex), hy = _mm_add_ps(dy, ey), hz = _mm_add_ps(dz, ez);
+        __m128 hLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hy, hy)), _mm_mul_ps(hz, hz)));
+        __m128 highlight = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+        highlight = _mm_max_ps(_mm_div_ps(highlight, hLength), zero);
+
+        __m128 falloff = _mm_div_ps(_mm_loadu_ps(&lights.intensity[i]), r2);
+        if (visibility)
+            falloff = _mm_mul_ps(falloff, _mm_loadu_ps(&visibility[i]));
+        diffuseSum = _mm_add_ps(diffuseSum, _mm_mul_ps(falloff, lambert));
+        specularSum = _mm_add_ps(specularSum, _mm_mul_ps(falloff, powWhole(highlight, whole)));
+    }
+    diffuse = horizontalSum(diffuseSum);
+    specular = horizontalSum(specularSum);
+}
+
+#else
+
+//--------------------------------------------------------------
+void shadeLights(const LightPack& lights, const glm::vec3& p, const glm::vec3& n, const glm::vec3& eye,
+    float power, const float* visibility, float& diffuse, float& specular) {
+    diffuse = 0;
+    specular = 0;
+    float whole = (float)(int)(power + 0.5f);
+    for (int i = 0; i < lights.count; i++) {
+        glm::vec3 light(lights.x[i], lights.y[i], lights.z[i]);
+        glm::vec3 toLight = light - p;
+        float lambert = std::max(glm::dot(n, light), 0.0f);
+        float highlight = std::max(glm::dot(n, glm::normalize(toLight + (eye - p))), 0.0f);
+        float falloff = lights.intensity[i] / glm::dot(toLight, toLight);
+        if (visibility)
+            falloff *= visibility[i];
+        diffuse += falloff * lambert;
+        specular += falloff * pow(highlight, whole);
+    }
+}
+
+#endif
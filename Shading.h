@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ofMain.h"
+
+// lights shadeLights() works on at a time, and the most it packs
+static const int SHADE_WIDTH = 4;
+static const int MAX_SHADED_LIGHTS = 32;
+
+//  The point lights as SoA (ofApp::lights[1..], lights[0] is the ambient
+//  light), padded to a multiple of SHADE_WIDTH with dark lights far away so
+//  the SIMD loop has no tail. Rebuilt by ofApp::updateLights().
+//
+struct LightPack {
+	void clear() { count = 0; x.clear(); y.clear(); z.clear(); intensity.clear(); }
+	void add(const glm::vec3& position, float lightIntensity);
+	int padded() const { return (count + SHADE_WIDTH - 1) / SHADE_WIDTH * SHADE_WIDTH; }
+
+	int count = 0;
+	vector<float> x, y, z, intensity;
+};
+
+//  Phong light at surface point p with normal n seen from eye, summed over
+//  every light SHADE_WIDTH lights at a time. visibility (null = all lit)
+//  holds the shadow term of each light, padded() long. diffuse and specular
+//  receive the light for the material's colours, specular highlights are
+//  raised to power (rounded to a whole number).
+//
+void shadeLights(const LightPack& lights, const glm::vec3& p, const glm::vec3& n, const glm::vec3& eye,
+	float power, const float* visibility, float& diffuse, float& specular);
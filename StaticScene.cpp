@@ -0,0 +1,24 @@
+#include "StaticScene.h"
+#include "ofApp.h"
+
+//--------------------------------------------------------------
+SceneObject* StaticSphere::toObject() const {
+    return new Sphere(center, radius);
+}
+
+//--------------------------------------------------------------
+SceneObject* StaticPlane::toObject() const {
+    return new Plane(glm::vec3(0, height, 0), glm::vec3(0, 1, 0));
+}
+
+//--------------------------------------------------------------
+TransformedObject* StaticTorus::toObject() const {
+    return new Torus(glm::vec3(0), t, ofColor::lightGray, glm::vec3(0));
+}
+
+//--------------------------------------------------------------
+TransformedObject* StaticHollowSphere::toObject() const {
+    HollowSphere* object = new HollowSphere(glm::vec3(0), ofColor::lightGray, glm::vec3(0));
+    object->rht = rht;
+    return object;
+}
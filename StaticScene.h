@@ -0,0 +1,267 @@
+#pragma once
+
+#include "CompiledScene.h"
+#include "glm/gtx/euler_angles.hpp"
+#include <tuple>
+#include <utility>
+
+class SceneObject;
+class TransformedObject;
+
+//  Compile-time scenes. A scene is a value whose type spells out its
+//  primitives and operators, e.g.
+//      auto scene = staticUnion(
+//          staticObject<0>(StaticPlane{ -2 }, ofColor::darkOliveGreen),
+//          staticObject<1>(StaticSphere{ glm::vec3(0, 1, -3), 1.5 }),
+//          staticObject<2>(staticPlaced(StaticTorus{ glm::vec2(1, 0.5) }, glm::vec3(0, 0, -2), glm::vec3(20, 45, 0))),
+//          staticObject<3>(staticRepeated(StaticSphere{ glm::vec3(0), 0.2 }, glm::vec3(3))));
+//  Every node is a small struct with an inline
+//      float operator()(const glm::vec3& p, int& obj) const
+//  and StaticUnion expands over its parts at compile time, so staticMarch()
+//  instantiated for a scene type marches one straight-line distance function:
+//  no virtual calls, no loops over primitive arrays, no switch on primitive
+//  types, nothing the compiler cannot inline. Only the parameters (centres,
+//  radii, transforms, periods) are runtime values. obj is set by the
+//  StaticObject<N> that is closest, N being its index in ofApp::scene.
+//
+//  addObjects() makes the scene objects the static scene describes, one per
+//  StaticObject at its index, so ofApp::scene (shading, normals, trace mode)
+//  is built from the same description that is marched. The primitives use
+//  the same maths as CompiledScene, so both give the same distances.
+//  StaticRepeated looks at the nearest copy only (like ofApp::opRep), which
+//  is exact while the shape stays inside its cell. StaticSubtract and
+//  StaticIntersect have no scene object and can only be marched.
+//
+//  toObject() of the primitives is in StaticScene.cpp. middle() is the
+//  centre of a shape, where repetition puts cell (0, 0, 0) like
+//  CompiledScene does.
+//
+
+struct StaticSphere {
+	glm::vec3 center;
+	float radius;
+
+	float operator()(const glm::vec3& p, int&) const { return glm::length(center - p) - radius; }
+	glm::vec3 middle() const { return center; }
+	SceneObject* toObject() const;
+};
+
+//  horizontal plane at height, solid below
+struct StaticPlane {
+	float height;
+
+	float operator()(const glm::vec3& p, int&) const { return p.y - height; }
+	glm::vec3 middle() const { return glm::vec3(0, height, 0); }
+	SceneObject* toObject() const;
+};
+
+//  around the local z axis, t = ring and tube radius
+struct StaticTorus {
+	glm::vec2 t;
+
+	float operator()(const glm::vec3& p, int&) const {
+		glm::vec2 q(glm::length(glm::vec2(p.x, p.y)) - t.x, p.z);
+		return glm::length(q) - t.y;
+	}
+	glm::vec3 middle() const { return glm::vec3(0); }
+	TransformedObject* toObject() const;   // at the origin, unturned
+};
+
+//  see HollowSphere
+struct StaticHollowSphere {
+	glm::vec3 rht;
+	float w;
+
+	StaticHollowSphere(glm::vec3 rht = glm::vec3(0.1, 0.05, 0.05)) : rht(rht), w(sqrt(rht.x * rht.x - rht.y * rht.y)) { }
+	float operator()(const glm::vec3& p, int&) const {
+		glm::vec2 q(glm::length(glm::vec2(p.x, p.y)), p.z);
+		return ((rht.y * q.x < w * q.y) ? glm::length(q - glm::vec2(w, rht.y)) : abs(glm::length(q) - rht.x)) - rht.z;
+	}
+	glm::vec3 middle() const { return glm::vec3(0); }
+	TransformedObject* toObject() const;
+};
+
+//  a shape moved and turned like a TransformedObject. only shapes whose
+//  object is a TransformedObject made around the origin (torus, hollow
+//  sphere) can be placed, others do not compile
+template<class S>
+struct StaticPlaced {
+	AffineTransform toLocal;
+	glm::vec3 position, rotation;
+	S shape;
+
+	float operator()(const glm::vec3& p, int& obj) const { return shape(toLocal.apply(p), obj); }
+	glm::vec3 middle() const { return position; }
+	auto toObject() const {
+		auto object = shape.toObject();
+		object->position = position;
+		object->rotation = rotation;
+		return object;
+	}
+};
+
+//  endless copies of a shape every period (0 = no copies along that axis),
+//  cell (0, 0, 0) centred on the shape
+template<class S>
+struct StaticRepeated {
+	glm::vec3 origin;
+	glm::vec3 period;
+	S shape;
+
+	glm::vec3 middle() const { return origin; }
+	auto toObject() const {
+		auto object = shape.toObject();
+		object->repetition.period = period;
+		return object;
+	}
+
+	float operator()(const glm::vec3& p, int& obj) const {
+		glm::vec3 local = p - origin;
+		for (int a = 0; a < 3; a++)
+			if (period[a] > 0)
+				local[a] -= period[a] * floor(local[a] / period[a] + 0.5f);
+		return shape(local + origin, obj);
+	}
+};
+
+//  the shape of scene object N
+template<int N, class S>
+struct StaticObject {
+	S shape;
+	ofColor color;
+
+	float operator()(const glm::vec3& p, int& obj) const {
+		obj = N;
+		return shape(p, obj);
+	}
+	void addObjects(vector<SceneObject*>& objects) const {
+		if (objects.size() <= N)
+			objects.resize(N + 1, nullptr);
+		auto object = shape.toObject();
+		object->diffuseColor = color;
+		objects[N] = object;
+	}
+};
+
+//  closest of the parts, obj of the closest
+template<class... Parts>
+struct StaticUnion {
+	std::tuple<Parts...> parts;
+
+	float operator()(const glm::vec3& p, int& obj) const {
+		return closest(p, obj, std::index_sequence_for<Parts...>());
+	}
+	void addObjects(vector<SceneObject*>& objects) const {
+		std::apply([&](const Parts&... part) { (part.addObjects(objects), ...); }, parts);
+	}
+
+private:
+	template<size_t... I>
+	float closest(const glm::vec3& p, int& obj, std::index_sequence<I...>) const {
+		float best = INFINITY;
+		(closer(std::get<I>(parts), p, best, obj), ...);
+		return best;
+	}
+	template<class S>
+	static void closer(const S& part, const glm::vec3& p, float& best, int& obj) {
+		int partObj = obj;
+		float d = part(p, partObj);
+		if (d < best) {
+			best = d;
+			obj = partObj;
+		}
+	}
+};
+
+//  a with b cut out / only where a and b overlap, obj from a
+template<class A, class B>
+struct StaticSubtract {
+	A a;
+	B b;
+
+	float operator()(const glm::vec3& p, int& obj) const {
+		int cutObj;
+		return std::max(a(p, obj), -b(p, cutObj));
+	}
+};
+
+template<class A, class B>
+struct StaticIntersect {
+	A a;
+	B b;
+
+	float operator()(const glm::vec3& p, int& obj) const {
+		int otherObj;
+		return std::max(a(p, obj), b(p, otherObj));
+	}
+};
+
+//  builders, so scene types are deduced instead of written out
+//
+template<class... Parts>
+StaticUnion<Parts...> staticUnion(Parts... parts) { return StaticUnion<Parts...>{ std::make_tuple(parts...) }; }
+
+template<int N, class S>
+StaticObject<N, S> staticObject(S shape, ofColor color = ofColor::lightGray) { return StaticObject<N, S>{ shape, color }; }
+
+template<class A, class B>
+StaticSubtract<A, B> staticSubtract(A a, B b) { return StaticSubtract<A, B>{ a, b }; }
+
+template<class A, class B>
+StaticIntersect<A, B> staticIntersect(A a, B b) { return StaticIntersect<A, B>{ a, b }; }
+
+template<class S>
+StaticRepeated<S> staticRepeated(S shape, glm::vec3 period) { return StaticRepeated<S>{ shape.middle(), period, shape }; }
+
+//  rotation in degrees, same order and inverse as TransformedObject::updateTransform
+template<class S>
+StaticPlaced<S> staticPlaced(S shape, glm::vec3 position, glm::vec3 rotation) {
+	AffineTransform toLocal;
+	toLocal.rotate = glm::transpose(glm::mat3(glm::eulerAngleXYZ(glm::radians(rotation.y), glm::radians(rotation.x),
+		glm::radians(rotation.z))));
+	toLocal.translate = -(toLocal.rotate * position);
+	return StaticPlaced<S>{ toLocal, position, rotation, shape };
+}
+
+//  ofApp::rayMarching for a static scene: the same steps, thresholds and
+//  relaxed over-relaxation, from tStart until a hit or until the scene is
+//  further than march.maxDistance (static scenes have no bounding box)
+//
+template<class Scene>
+bool staticMarch(const Scene& scene, const MarchSettings& march, const glm::vec3& origin, const glm::vec3& dir, float tStart,
+	HitRecord& record) {
+	float t = tStart;
+	float omega = march.stepScale();
+	float stepLength = 0, previousRadius = 0;
+	glm::vec3 p = origin;
+	if (t > 0)
+		p = origin + dir * t;
+	record = HitRecord();
+	bool hit = false;
+	for (int i = 0; i < march.maxSteps; i++) {
+		float dist = scene(p, record.obj);
+		record.steps++;
+		record.dist = dist;
+		if (omega > 1 && abs(dist) + previousRadius < stepLength) {
+			t -= stepLength - previousRadius;
+			p = origin + dir * t;
+			omega = 1;
+			stepLength = 0;
+			previousRadius = 0;
+			continue;
+		}
+		if (dist < march.threshold(t)) {
+			hit = true;
+			break;
+		}
+		else if (dist > march.maxDistance)
+			break;
+		stepLength = dist * omega;
+		previousRadius = dist;
+		p = p + (dir * stepLength);
+		t += stepLength;
+	}
+	record.t = t;
+	record.p = p;
+	return hit;
+}
@@ -0,0 +1,230 @@
+#include "StripWriter.h"
+#include <array>
+
+//--------------------------------------------------------------
+static string extensionOf(const string& path) {
+    size_t dot = path.rfind('.');
+    if (dot == string::npos)
+        return "";
+    string ext = path.substr(dot + 1);
+    for (int i = 0; i < ext.size(); i++)
+        ext[i] = tolower(ext[i]);
+    return ext;
+}
+
+//--------------------------------------------------------------
+static std::array<unsigned int, 256> crcTable() {
+    std::array<unsigned int, 256> table;
+    for (unsigned int n = 0; n < 256; n++) {
+        unsigned int c = n;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}
+
+//--------------------------------------------------------------
+// table driven crc-32 of a PNG chunk (type and data). the table is built
+// once by the static initializer, which is thread safe, so encoder threads
+// of several writers can share it
+//
+static unsigned int crc32(const unsigned char* data, size_t size, unsigned int crc = 0) {
+    static const std::array<unsigned int, 256> table = crcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putBigEndian(vector<unsigned char>& out, unsigned int value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+//--------------------------------------------------------------
+bool StripWriter::knownFormat(const string& path) {
+    string ext = extensionOf(path);
+    return ext == "ppm" || ext == "png" || ext == "pfm";
+}
+
+//--------------------------------------------------------------
+StripWriter::~StripWriter() {
+    if (encoder.joinable())
+        close();
+}
+
+//--------------------------------------------------------------
+// write the file header and start the encoder thread
+//
+bool StripWriter::open(const string& path, int w, int h, const ToneMapSettings& toneMap, int queued) {
+    string ext = extensionOf(path);
+    if (ext == "png")
+        format = FORMAT_PNG;
+    else if (ext == "pfm")
+        format = FORMAT_PFM;
+    else if (ext == "ppm")
+        format = FORMAT_PPM;
+    else
+        return false;
+
+    width = w;
+    height = h;
+    toneMapping = toneMap;
+    maxQueued = std::max(queued, 1);
+    rowsWritten = 0;
+    failed = false;
+    closing = false;
+    adlerA = 1;
+    adlerB = 0;
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    if (format == FORMAT_PPM)
+        file << "P6\n" << width << " " << height << "\n255\n";
+    else if (format == FORMAT_PFM)
+        //negative scale = little endian floats
+        file << "PF\n" << width << " " << height << "\n-1.0\n";
+    else {
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        file.write((const char*)signature, 8);
+        vector<unsigned char> header;
+        putBigEndian(header, width);
+        putBigEndian(header, height);
+        header.push_back(8);    // bits per channel
+        header.push_back(2);    // RGB
+        header.push_back(0);    // deflate
+        header.push_back(0);    // adaptive filtering (every row uses filter 0)
+        header.push_back(0);    // not interlaced
+        writePngChunk("IHDR", header);
+    }
+
+    encoder = std::thread(&StripWriter::encoderLoop, this);
+    return bool(file);
+}
+
+//--------------------------------------------------------------
+void StripWriter::write(HdrImage&& strip) {
+    std::unique_lock<std::mutex> guard(queueLock);
+    queueChanged.wait(guard, [this] { return queue.size() < maxQueued; });
+    queue.push_back(std::move(strip));
+    queueChanged.notify_all();
+}
+
+//--------------------------------------------------------------
+// let the encoder drain the queue, then end the file
+//
+bool StripWriter::close() {
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        closing = true;
+    }
+    queueChanged.notify_all();
+    if (encoder.joinable())
+        encoder.join();
+
+    if (format == FORMAT_PNG)
+        writePngChunk("IEND", vector<unsigned char>());
+    if (rowsWritten != height)
+        failed = true;
+    file.close();
+    return !failed && !file.fail();
+}
+
+//--------------------------------------------------------------
+void StripWriter::encoderLoop() {
+    while (true) {
+        HdrImage strip;
+        {
+            std::unique_lock<std::mutex> guard(queueLock);
+            queueChanged.wait(guard, [this] { return !queue.empty() || closing; });
+            if (queue.empty())
+                return;
+            strip = std::move(queue.front());
+            queue.pop_front();
+        }
+        //a slot is free, the renderer may hand over its next strip
+        queueChanged.notify_all();
+        encode(strip);
+    }
+}
+
+//--------------------------------------------------------------
+void StripWriter::encode(const HdrImage& strip) {
+    int run = 3 * width;
+    if (format == FORMAT_PPM) {
+        vector<unsigned char> bytes(run * strip.height);
+        for (int y = 0; y < strip.height; y++)
+            toneMapRun(strip.row(strip.top + y), &bytes[y * run], run, toneMapping);
+        file.write((const char*)bytes.data(), bytes.size());
+    }
+    else if (format == FORMAT_PFM) {
+        //PFM rows go bottom to top, in linear units where 1 is white
+        float scale = toneMapping.exposure / 255;
+        vector<float> values(run);
+        for (int y = strip.top + strip.height - 1; y >= strip.top; y--) {
+            const float* src = strip.row(y);
+            for (int i = 0; i < run; i++)
+                values[i] = src[i] * scale;
+            file.write((const char*)values.data(), values.size() * sizeof(float));
+        }
+    }
+    else {
+        //scanlines with their filter byte, then the same bytes in stored
+        //deflate blocks of at most 64k
+        vector<unsigned char> raw((run + 1) * strip.height);
+        for (int y = 0; y < strip.height; y++) {
+            raw[y * (run + 1)] = 0;
+            toneMapRun(strip.row(strip.top + y), &raw[y * (run + 1) + 1], run, toneMapping);
+        }
+        //5552 bytes is the most the sums take before they could overflow
+        for (size_t start = 0; start < raw.size(); start += 5552) {
+            size_t end = std::min(raw.size(), start + 5552);
+            for (size_t i = start; i < end; i++) {
+                adlerA += raw[i];
+                adlerB += adlerA;
+            }
+            adlerA %= 65521;
+            adlerB %= 65521;
+        }
+
+        bool last = rowsWritten + strip.height == height;
+        vector<unsigned char> data;
+        data.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+        if (rowsWritten == 0) {
+            //zlib header: deflate, 32k window, no dictionary
+            data.push_back(0x78);
+            data.push_back(0x01);
+        }
+        for (size_t start = 0; start < raw.size(); start += 65535) {
+            size_t size = std::min(raw.size() - start, (size_t)65535);
+            data.push_back((last && start + size == raw.size()) ? 1 : 0);
+            data.push_back(size & 0xff);
+            data.push_back(size >> 8);
+            data.push_back(~size & 0xff);
+            data.push_back((~size >> 8) & 0xff);
+            data.insert(data.end(), raw.begin() + start, raw.begin() + start + size);
+        }
+        if (last)
+            putBigEndian(data, (adlerB << 16) | adlerA);
+        writePngChunk("IDAT", data);
+    }
+    rowsWritten += strip.height;
+    if (!file)
+        failed = true;
+}
+
+//--------------------------------------------------------------
+void StripWriter::writePngChunk(const char* type, const vector<unsigned char>& data) {
+    vector<unsigned char> length, crc;
+    putBigEndian(length, data.size());
+    putBigEndian(crc, crc32(data.data(), data.size(), crc32((const unsigned char*)type, 4)));
+    file.write((const char*)length.data(), 4);
+    file.write(type, 4);
+    file.write((const char*)data.data(), data.size());
+    file.write((const char*)crc.data(), 4);
+}
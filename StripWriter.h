@@ -0,0 +1,55 @@
+#pragma once
+
+#include "HdrImage.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+
+//  Writes an image strip by strip for renders too big to hold in memory
+//  (ofApp::renderStrips). write() hands a finished strip to a background
+//  thread that tone maps and encodes it while the next strip renders; at most
+//  maxQueued strips wait, so memory stays at a few strips whatever the size
+//  of the image. The format comes from the file extension:
+//    .ppm  binary 8 bit RGB
+//    .png  8 bit RGB in stored (uncompressed) deflate blocks, one IDAT chunk
+//          per strip, so no compression library is needed
+//    .pfm  32 bit float RGB, the HDR values with exposure but no tone curve
+//  8 bit formats are written top to bottom, PFM bottom to top: strips must
+//  come in file order, see bottomUp().
+//
+class StripWriter {
+public:
+	~StripWriter();
+
+	bool open(const string& path, int width, int height, const ToneMapSettings& toneMap, int maxQueued = 2);
+	void write(HdrImage&& strip);    // blocks while maxQueued strips wait
+	bool close();                    // finish the file, false when anything failed
+	bool bottomUp() const { return format == FORMAT_PFM; }
+	static bool knownFormat(const string& path);
+
+private:
+	enum Format { FORMAT_PPM, FORMAT_PNG, FORMAT_PFM };
+
+	void encoderLoop();
+	void encode(const HdrImage& strip);
+	void writePngChunk(const char* type, const vector<unsigned char>& data);
+
+	Format format = FORMAT_PPM;
+	int width = 0, height = 0;
+	ToneMapSettings toneMapping;
+	int maxQueued = 2;
+	int rowsWritten = 0;
+	bool failed = false;
+
+	std::ofstream file;
+	std::thread encoder;
+	std::mutex queueLock;
+	std::condition_variable queueChanged;
+	std::deque<HdrImage> queue;
+	bool closing = false;
+
+	//running adler-32 of the PNG's zlib stream
+	unsigned int adlerA = 1, adlerB = 0;
+};
@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+
+int ThreadPool::hardwareThreads() {
+    int n = (int)std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+ThreadPool::ThreadPool(int numThreads) {
+    if (numThreads <= 0)
+        numThreads = hardwareThreads();
+    for (int i = 0; i < numThreads; i++)
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    for (int i = 0; i < numThreads; i++)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    wakeCond.notify_all();
+    for (int i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+//--------------------------------------------------------------
+// Jobs are dealt round robin so every worker starts with its own share,
+// stealing only evens out the tail.
+//
+void ThreadPool::submit(std::function<void()> job) {
+    pending++;
+    int index;
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        index = nextQueue;
+        nextQueue = (nextQueue + 1) % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        queued++;
+    }
+    wakeCond.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> guard(stateLock);
+    doneCond.wait(guard, [this] { return pending == 0; });
+}
+
+//--------------------------------------------------------------
+bool ThreadPool::popJob(int index, std::function<void()>& job) {
+    //own queue first, newest job
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        if (!queues[index]->jobs.empty()) {
+            job = std::move(queues[index]->jobs.back());
+            queues[index]->jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    //steal the oldest job from somebody else
+    for (int i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(int index) {
+    std::function<void()> job;
+    while (true) {
+        if (popJob(index, job)) {
+            job();
+            job = nullptr;
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> guard(stateLock);
+                doneCond.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(stateLock);
+        wakeCond.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
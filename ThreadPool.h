@@ -0,0 +1,45 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+
+//  Work-stealing thread pool used by the tile renderer.
+//  Every worker owns a queue of jobs. A worker pops jobs from the back of its
+//  own queue and, once that runs dry, steals from the front of the others.
+//
+class ThreadPool {
+public:
+	ThreadPool(int numThreads = 0);   // 0 = one worker per hardware thread
+	~ThreadPool();
+
+	void submit(std::function<void()> job);
+	void wait();                       // block until every submitted job has finished
+
+	int size() const { return (int)workers.size(); }
+	static int hardwareThreads();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	void workerLoop(int index);
+	bool popJob(int index, std::function<void()>& job);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	std::mutex stateLock;
+	std::condition_variable wakeCond, doneCond;
+	std::atomic<int> queued{ 0 };      // jobs sitting in a queue
+	std::atomic<int> pending{ 0 };     // jobs submitted but not finished
+	int nextQueue = 0;
+	bool stopping = false;
+};
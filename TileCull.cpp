@@ -0,0 +1,211 @@
+#include "TileCull.h"
+
+//--------------------------------------------------------------
+// gap between a box and a box of intervals, 0 when they touch or overlap
+//
+static float boxGap(const Bounds& b, const Interval3& box) {
+    glm::vec3 gap;
+    for (int a = 0; a < 3; a++)
+        gap[a] = std::max(0.0f, std::max(b.min[a] - box[a].hi, box[a].lo - b.max[a]));
+    return glm::length(gap);
+}
+
+//--------------------------------------------------------------
+// The finite primitives lie between tMin and tMax from the eye; planes,
+// endless repetitions and endless CSG models are also tested in front of
+// and behind that. Leaves start out as the whole scene.
+//
+void TileCuller::build(const CompiledScene& compiled, const MarchSettings& settings, const glm::vec3& eyePosition,
+    const glm::vec3& origin, const glm::vec3& stepU, const glm::vec3& stepV, int x0, int y0, int x1, int y1) {
+    scene = &compiled;
+    march = &settings;
+    eye = eyePosition;
+    viewOrigin = origin;
+    du = stepU;
+    dv = stepV;
+    tileX = x0;
+    tileY = y0;
+    leavesX = (x1 - x0 + LEAF_SIZE - 1) / LEAF_SIZE;
+    int leavesY = (y1 - y0 + LEAF_SIZE - 1) / LEAF_SIZE;
+    prims.clear();
+    leafFirst.assign(leavesX * leavesY, -1);
+    leaves.assign(leafFirst.size(), PrimSpan());
+    tests = 0;
+
+    tMin = tMax = 0;
+    if (!scene->bounds.isEmpty()) {
+        tMin = scene->bounds.distance(eye);
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 p((corner & 1) ? scene->bounds.max.x : scene->bounds.min.x,
+                (corner & 2) ? scene->bounds.max.y : scene->bounds.min.y,
+                (corner & 4) ? scene->bounds.max.z : scene->bounds.min.z);
+            tMax = std::max(tMax, glm::length(p - eye));
+        }
+        //a ray can stop up to the hit threshold short of a primitive
+        float reach = march->threshold(2 * tMax);
+        tMin = std::max(tMin - reach, 0.0f);
+        tMax += reach;
+    }
+
+    vector<Slab> slabs;
+    frustumSlabs(x0, y0, x1, y1, slabs);
+    vector<PrimRef> kept;
+    for (int i = 0; i < scene->planes.size(); i++)
+        if (reaches({ PRIM_PLANE, i }, slabs))
+            kept.push_back({ PRIM_PLANE, i });
+    for (int i = 0; i < scene->repeated.size(); i++)
+        if (scene->repeated[i].endless && reaches({ PRIM_REPEATED, i }, slabs))
+            kept.push_back({ PRIM_REPEATED, i });
+    for (int i = 0; i < scene->plainCsgModels; i++)
+        if (!scene->csgModels[i].finite() && reaches({ PRIM_CSG, i }, slabs))
+            kept.push_back({ PRIM_CSG, i });
+
+    if (scene->nodes.empty()) {
+        for (int i = 0; i < scene->bvhPrims.size(); i++)
+            if (reaches(scene->bvhPrims[i], slabs))
+                kept.push_back(scene->bvhPrims[i]);
+    }
+    else {
+        int stack[128];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVHNode& node = scene->nodes[stack[--top]];
+            bool touches = false;
+            for (int s = 0; s < slabs.size() && !touches; s++)
+                touches = !slabs[s].endlessOnly && boxGap(node.bounds, slabs[s].box) <= slabs[s].margin;
+            if (!touches)
+                continue;
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; i++)
+                    if (reaches(scene->bvhPrims[i], slabs))
+                        kept.push_back(scene->bvhPrims[i]);
+                continue;
+            }
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+    }
+    split(kept, x0, y0, x1, y1);
+
+    for (int i = 0; i < leaves.size(); i++)
+        if (leafFirst[i] >= 0)
+            leaves[i].prims = prims.data() + leafFirst[i];
+}
+
+//--------------------------------------------------------------
+const PrimSpan* TileCuller::at(int i, int j) const {
+    int leaf = ((j - tileY) / LEAF_SIZE) * leavesX + (i - tileX) / LEAF_SIZE;
+    return (leafFirst[leaf] < 0) ? nullptr : &leaves[leaf];
+}
+
+//--------------------------------------------------------------
+// Rays of pixels [x0, x1) x [y0, y1) run through the quad of view plane
+// points q (relative to the eye) of its corner pixels. A point at depth t
+// lies at s * q with s between t / the longest corner q and t / the
+// distance to the view plane, so the slab from t0 to t1 is inside the box
+// of the corners at those two s. Slabs get longer with depth, like the
+// quad's width. Unbounded scenes add the depths before tMin and after tMax
+// for the endless primitives; with the footprint strategies the threshold
+// out there has no end and keeps them all.
+//
+void TileCuller::frustumSlabs(int x0, int y0, int x1, int y1, vector<Slab>& slabs) const {
+    glm::vec3 q[4];
+    float longest = 0;
+    for (int c = 0; c < 4; c++) {
+        q[c] = viewOrigin + float((c & 1) ? x1 - 1 : x0) * du + float((c & 2) ? y1 - 1 : y0) * dv - eye;
+        longest = std::max(longest, glm::length(q[c]));
+    }
+    float plane = abs(glm::dot(q[0], glm::normalize(glm::cross(du, dv))));
+
+    auto slabBox = [&](float s0, float s1) {
+        Interval3 box(glm::vec3(INFINITY), glm::vec3(-INFINITY));
+        for (int c = 0; c < 4; c++)
+            for (float s : { s0, s1 })
+                for (int a = 0; a < 3; a++) {
+                    //0 * infinity along an axis the corner does not move on
+                    float v = eye[a] + ((q[c][a] == 0) ? 0 : s * q[c][a]);
+                    box[a].lo = std::min(box[a].lo, v);
+                    box[a].hi = std::max(box[a].hi, v);
+                }
+        return box;
+    };
+
+    slabs.clear();
+    if (!scene->bounded && tMin > 0)
+        slabs.push_back({ slabBox(0, tMin / plane), march->threshold(tMin), true });
+    if (tMax > 0) {
+        for (int k = 0; k < SLABS; k++) {
+            float t0, t1;
+            if (tMin > 0) {
+                t0 = tMin * pow(tMax / tMin, float(k) / SLABS);
+                t1 = tMin * pow(tMax / tMin, float(k + 1) / SLABS);
+            }
+            else {
+                t0 = tMax * k / SLABS;
+                t1 = tMax * (k + 1) / SLABS;
+            }
+            slabs.push_back({ slabBox(t0 / longest, t1 / plane), march->threshold(t1), false });
+        }
+    }
+    if (!scene->bounded)
+        slabs.push_back({ slabBox(tMax / longest, INFINITY), march->threshold(INFINITY), true });
+}
+
+//--------------------------------------------------------------
+bool TileCuller::endless(const PrimRef& prim) const {
+    return prim.type == PRIM_PLANE || (prim.type == PRIM_REPEATED && scene->repeated[prim.index].endless)
+        || (prim.type == PRIM_CSG && !scene->csgModels[prim.index].finite());
+}
+
+//--------------------------------------------------------------
+// can the primitive come within the hit threshold of any slab at its depths
+//
+bool TileCuller::reaches(const PrimRef& prim, const vector<Slab>& slabs) {
+    bool anyDepth = endless(prim);
+    for (int s = 0; s < slabs.size(); s++) {
+        if (slabs[s].endlessOnly && !anyDepth)
+            continue;
+        tests++;
+        if (scene->primInterval(prim, slabs[s].box).lo <= slabs[s].margin)
+            return true;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------
+// Quarters on the leaf grid, each keeping what reaches its own frustum.
+// Leaves left with more than LIST_MAX primitives march the whole scene.
+//
+void TileCuller::split(const vector<PrimRef>& kept, int x0, int y0, int x1, int y1) {
+    if (x1 - x0 <= LEAF_SIZE && y1 - y0 <= LEAF_SIZE) {
+        int leaf = ((y0 - tileY) / LEAF_SIZE) * leavesX + (x0 - tileX) / LEAF_SIZE;
+        if (kept.size() > LIST_MAX)
+            return;
+        leafFirst[leaf] = (int)prims.size();
+        leaves[leaf].count = (int)kept.size();
+        prims.insert(prims.end(), kept.begin(), kept.end());
+        return;
+    }
+
+    int midX = x1, midY = y1;
+    if (x1 - x0 > LEAF_SIZE)
+        midX = x0 + std::max(LEAF_SIZE, (x1 - x0) / 2 / LEAF_SIZE * LEAF_SIZE);
+    if (y1 - y0 > LEAF_SIZE)
+        midY = y0 + std::max(LEAF_SIZE, (y1 - y0) / 2 / LEAF_SIZE * LEAF_SIZE);
+    int xs[3] = { x0, midX, x1 }, ys[3] = { y0, midY, y1 };
+    vector<Slab> slabs;
+    for (int b = 0; b < 2; b++)
+        for (int a = 0; a < 2; a++) {
+            if (xs[a] == xs[a + 1] || ys[b] == ys[b + 1])
+                continue;
+            vector<PrimRef> quarter;
+            if (!kept.empty()) {
+                frustumSlabs(xs[a], ys[b], xs[a + 1], ys[b + 1], slabs);
+                for (int i = 0; i < kept.size(); i++)
+                    if (reaches(kept[i], slabs))
+                        quarter.push_back(kept[i]);
+            }
+            split(quarter, xs[a], ys[b], xs[a + 1], ys[b + 1]);
+        }
+}
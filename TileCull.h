@@ -0,0 +1,58 @@
+#pragma once
+
+#include "CompiledScene.h"
+
+//  primitives a block of pixels can reach, a range of TileCuller's list
+//
+struct PrimSpan {
+	const PrimRef* prims;
+	int count;
+};
+
+//  Primitives that matter to the rays of one screen tile. The rays of the
+//  tile's pixels fill a frustum from the eye through a quad of the view
+//  plane. Cut along the rays into SLABS slabs, every primitive is bounded
+//  over the box of each slab with interval arithmetic
+//  (CompiledScene::primInterval) and dropped when it stays further than the
+//  hit threshold from all of them: no ray of the tile can hit it, so
+//  marching against the rest finds the same surfaces. BVH nodes are dropped
+//  by their boxes first. The tile is then split in quarters down to
+//  LEAF_SIZE pixels, each quarter testing only what its parent kept, so a
+//  pixel's march costs what lies in front of it rather than the whole scene.
+//  Only for primary rays: shadow and shading evaluations leave the frustum.
+//
+class TileCuller {
+public:
+	static const int LEAF_SIZE = 8;     // the block size of the cone pre-pass
+	static const int SLABS = 8;
+	static const int LIST_MAX = 16;     // leaves keeping more go through the BVH
+
+	//  tile [x0, x1) x [y0, y1), pixel (i, j) looking from eye through
+	//  viewOrigin + i * du + j * dv
+	void build(const CompiledScene& scene, const MarchSettings& march, const glm::vec3& eye,
+		const glm::vec3& viewOrigin, const glm::vec3& du, const glm::vec3& dv, int x0, int y0, int x1, int y1);
+	//  primitives for pixel (i, j), nullptr = march the whole scene
+	const PrimSpan* at(int i, int j) const;
+
+	int tests = 0;                      // interval evaluations made by build()
+
+private:
+	struct Slab {
+		Interval3 box;
+		float margin;                   // hit threshold at its far end
+		bool endlessOnly;               // outside the depths of the finite primitives
+	};
+	void frustumSlabs(int x0, int y0, int x1, int y1, vector<Slab>& slabs) const;
+	bool endless(const PrimRef& prim) const;
+	bool reaches(const PrimRef& prim, const vector<Slab>& slabs);
+	void split(const vector<PrimRef>& kept, int x0, int y0, int x1, int y1);
+
+	const CompiledScene* scene = nullptr;
+	const MarchSettings* march = nullptr;
+	glm::vec3 eye, viewOrigin, du, dv;
+	float tMin = 0, tMax = 0;           // depths of the finite primitives, tMax = 0 without any
+	int tileX = 0, tileY = 0, leavesX = 0;
+	vector<PrimRef> prims;              // every leaf's list, back to back
+	vector<int> leafFirst;              // into prims, -1 = whole scene
+	vector<PrimSpan> leaves;
+};
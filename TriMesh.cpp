@@ -0,0 +1,703 @@
+#include "TriMesh.h"
+#include <fstream>
+#include <sstream>
+
+// deeper nodes become leaves, so the traversal stacks below cannot overflow
+static const int MESH_MAX_DEPTH = 56;
+
+//--------------------------------------------------------------
+static bool readFile(const string& path, string& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    data = contents.str();
+    return true;
+}
+
+//--------------------------------------------------------------
+// polygon as a fan of triangles around its first vertex
+//
+static void addPolygon(const vector<int>& polygon, vector<glm::ivec3>& triangles) {
+    for (int i = 1; i + 1 < polygon.size(); i++)
+        triangles.push_back(glm::ivec3(polygon[0], polygon[i], polygon[i + 1]));
+}
+
+//--------------------------------------------------------------
+bool TriMesh::load(const string& path) {
+    string ext = path.substr(path.find_last_of('.') + 1);
+    for (int i = 0; i < ext.size(); i++)
+        ext[i] = tolower(ext[i]);
+    bool loaded = false;
+    if (ext == "obj")
+        loaded = loadObj(path);
+    else if (ext == "ply")
+        loaded = loadPly(path);
+    if (!loaded || triangles.empty())
+        return false;
+    build();
+    return true;
+}
+
+//--------------------------------------------------------------
+// v and f lines only. Face entries may carry /texture/normal indices, which
+// are skipped, and negative indices count back from the last vertex.
+//
+bool TriMesh::loadObj(const string& path) {
+    string data;
+    if (!readFile(path, data))
+        return false;
+    vertices.clear();
+    triangles.clear();
+
+    const char* p = data.c_str();
+    const char* end = p + data.size();
+    vector<int> polygon;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            char* next;
+            glm::vec3 v;
+            p += 2;
+            for (int a = 0; a < 3; a++) {
+                v[a] = strtof(p, &next);
+                p = next;
+            }
+            vertices.push_back(v);
+        }
+        else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            p += 2;
+            polygon.clear();
+            while (true) {
+                while (p < end && (*p == ' ' || *p == '\t'))
+                    p++;
+                if (p >= end || *p == '\n' || *p == '\r')
+                    break;
+                char* next;
+                long index = strtol(p, &next, 10);
+                if (next == p)
+                    return false;
+                polygon.push_back((index > 0) ? int(index - 1) : int(vertices.size() + index));
+                p = next;
+                while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+                    p++;
+            }
+            addPolygon(polygon, triangles);
+        }
+        while (p < end && *p != '\n')
+            p++;
+        p++;
+    }
+
+    for (int i = 0; i < triangles.size(); i++)
+        for (int k = 0; k < 3; k++)
+            if (triangles[i][k] < 0 || triangles[i][k] >= vertices.size())
+                return false;
+    return true;
+}
+
+enum PlyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_UNKNOWN };
+
+static const int plyTypeSize[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+
+//--------------------------------------------------------------
+// PLY property type by either of its names
+//
+static int plyType(const string& name) {
+    const char* names[][2] = { { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+        { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" } };
+    for (int t = 0; t < PLY_UNKNOWN; t++)
+        if (name == names[t][0] || name == names[t][1])
+            return t;
+    return PLY_UNKNOWN;
+}
+
+//  one property of a PLY element, a list has a count before its values
+//
+struct PlyProperty {
+    string name;
+    int type = PLY_UNKNOWN;     // PlyType
+    int countType = PLY_UNKNOWN;  // lists only
+    bool list = false;
+};
+
+struct PlyElement {
+    string name;
+    int count = 0;
+    vector<PlyProperty> properties;
+};
+
+//  values of a PLY body in order, ascii or binary of either byte order
+//
+class PlyReader {
+public:
+    PlyReader(const char* p, const char* end, bool ascii, bool swap) : p(p), end(end), ascii(ascii), swap(swap) { }
+
+    double next(int type) {
+        if (ascii) {
+            char* after;
+            double value = strtod(p, &after);
+            ok = ok && after != p;
+            p = after;
+            return value;
+        }
+        int size = plyTypeSize[type];
+        if (size == 0 || p + size > end) {
+            ok = false;
+            return 0;
+        }
+        unsigned char bytes[8];
+        for (int i = 0; i < size; i++)
+            bytes[i] = p[swap ? size - 1 - i : i];
+        p += size;
+        switch (type) {
+        case PLY_INT8:
+            return *(signed char*)bytes;
+        case PLY_UINT8:
+            return bytes[0];
+        case PLY_INT16:
+            return *(int16_t*)bytes;
+        case PLY_UINT16:
+            return *(uint16_t*)bytes;
+        case PLY_INT32:
+            return *(int32_t*)bytes;
+        case PLY_UINT32:
+            return *(uint32_t*)bytes;
+        case PLY_FLOAT32:
+            return *(float*)bytes;
+        default:
+            return *(double*)bytes;
+        }
+    }
+
+    bool ok = true;
+
+private:
+    const char* p;
+    const char* end;
+    bool ascii, swap;
+};
+
+//--------------------------------------------------------------
+// vertex x, y, z and face vertex_indices (or vertex_index); other elements
+// and properties are read past
+//
+bool TriMesh::loadPly(const string& path) {
+    string data;
+    if (!readFile(path, data) || data.compare(0, 3, "ply") != 0)
+        return false;
+    size_t headerEnd = data.find("end_header");
+    if (headerEnd == string::npos)
+        return false;
+    size_t bodyStart = data.find('\n', headerEnd);
+    if (bodyStart == string::npos)
+        return false;
+    vertices.clear();
+    triangles.clear();
+
+    std::istringstream header(data.substr(0, headerEnd));
+    string line, format;
+    vector<PlyElement> elements;
+    while (std::getline(header, line)) {
+        std::istringstream words(line);
+        string keyword;
+        words >> keyword;
+        if (keyword == "format")
+            words >> format;
+        else if (keyword == "element") {
+            elements.push_back(PlyElement());
+            words >> elements.back().name >> elements.back().count;
+        }
+        else if (keyword == "property" && !elements.empty()) {
+            PlyProperty prop;
+            string type, countType;
+            words >> type;
+            if (type == "list") {
+                prop.list = true;
+                words >> countType >> type;
+                prop.countType = plyType(countType);
+            }
+            prop.type = plyType(type);
+            words >> prop.name;
+            elements.back().properties.push_back(prop);
+        }
+    }
+    if (format != "ascii" && format != "binary_little_endian" && format != "binary_big_endian")
+        return false;
+
+    PlyReader reader(data.c_str() + bodyStart + 1, data.c_str() + data.size(), format == "ascii",
+        format == "binary_big_endian");
+    vector<int> polygon;
+    for (const PlyElement& element : elements) {
+        bool isVertex = element.name == "vertex", isFace = element.name == "face";
+        for (int i = 0; i < element.count && reader.ok; i++) {
+            glm::vec3 v(0);
+            for (const PlyProperty& prop : element.properties) {
+                if (prop.list) {
+                    int n = (int)reader.next(prop.countType);
+                    bool indices = isFace && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+                    polygon.clear();
+                    for (int k = 0; k < n && reader.ok; k++) {
+                        int index = (int)reader.next(prop.type);
+                        if (indices)
+                            polygon.push_back(index);
+                    }
+                    if (indices)
+                        addPolygon(polygon, triangles);
+                    continue;
+                }
+                double value = reader.next(prop.type);
+                if (isVertex && prop.name == "x")
+                    v.x = value;
+                else if (isVertex && prop.name == "y")
+                    v.y = value;
+                else if (isVertex && prop.name == "z")
+                    v.z = value;
+            }
+            if (isVertex)
+                vertices.push_back(v);
+        }
+    }
+    if (!reader.ok)
+        return false;
+
+    for (int i = 0; i < triangles.size(); i++)
+        for (int k = 0; k < 3; k++)
+            if (triangles[i][k] < 0 || triangles[i][k] >= vertices.size())
+                return false;
+    return true;
+}
+
+//--------------------------------------------------------------
+bool TriMesh::savePly(const string& path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file << "ply\nformat binary_little_endian 1.0\n"
+        << "element vertex " << vertices.size() << "\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face " << triangles.size() << "\nproperty list uchar int vertex_indices\nend_header\n";
+    file.write((const char*)vertices.data(), vertices.size() * sizeof(glm::vec3));
+    for (int i = 0; i < triangles.size(); i++) {
+        unsigned char three = 3;
+        file.write((const char*)&three, 1);
+        file.write((const char*)&triangles[i], sizeof(glm::ivec3));
+    }
+    return (bool)file;
+}
+
+//--------------------------------------------------------------
+// BVH over the triangles (reordering them to its leaves and the vertices to
+// the triangles, unused vertices are dropped), then the pseudo normals
+//
+void TriMesh::build() {
+    float start = ofGetElapsedTimef();
+    int count = (int)triangles.size();
+    vector<Bounds> triBox(count);
+    vector<glm::vec3> centroid(count);
+    vector<int> order(count);
+    bounds = Bounds();
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++)
+            triBox[i].grow(vertices[triangles[i][k]]);
+        centroid[i] = triBox[i].center();
+        order[i] = i;
+        bounds.grow(triBox[i]);
+    }
+
+    nodes.clear();
+    if (count > 0) {
+        nodes.reserve(2 * count / LEAF_SIZE + 1);
+        nodes.push_back(BVHNode());
+        buildNode(0, order, triBox, centroid, 0, count, 0);
+    }
+    vector<glm::ivec3> sorted(count);
+    for (int i = 0; i < count; i++)
+        sorted[i] = triangles[order[i]];
+    triangles.swap(sorted);
+    nodes.shrink_to_fit();
+
+    //vertices in the order the triangles first use them, so a leaf's
+    //vertices are close together in memory too
+    vector<int> remap(vertices.size(), -1);
+    vector<glm::vec3> used;
+    used.reserve(vertices.size());
+    for (int i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++) {
+            int& v = triangles[i][k];
+            if (remap[v] < 0) {
+                remap[v] = (int)used.size();
+                used.push_back(vertices[v]);
+            }
+            v = remap[v];
+        }
+    vertices.swap(used);
+
+    buildPseudoNormals();
+    buildSeconds = ofGetElapsedTimef() - start;
+}
+
+//--------------------------------------------------------------
+// Same binned surface area heuristic as CompiledScene::buildNode, over
+// order[first .. first + count). Where no split beats a leaf but the node
+// is still large, it is halved at the median centroid instead.
+//
+void TriMesh::buildNode(int nodeIndex, vector<int>& order, const vector<Bounds>& triBox,
+    const vector<glm::vec3>& centroid, int first, int count, int depth) {
+    Bounds box, centroids;
+    for (int i = first; i < first + count; i++) {
+        box.grow(triBox[order[i]]);
+        centroids.grow(centroid[order[i]]);
+    }
+    nodes[nodeIndex].bounds = box;
+    nodes[nodeIndex].first = first;
+    nodes[nodeIndex].count = count;
+    if (count <= LEAF_SIZE || depth >= MESH_MAX_DEPTH)
+        return;
+
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+    if (extent[axis] <= 0)
+        return;
+
+    Bounds binBox[BINS];
+    int binCount[BINS] = { 0 };
+    float scale = BINS / extent[axis];
+    auto binOf = [&](int tri) { return std::min(BINS - 1, int((centroid[tri][axis] - centroids.min[axis]) * scale)); };
+    for (int i = first; i < first + count; i++) {
+        int b = binOf(order[i]);
+        binBox[b].grow(triBox[order[i]]);
+        binCount[b]++;
+    }
+
+    float rightCost[BINS];
+    Bounds accum;
+    int accumCount = 0;
+    for (int b = BINS - 1; b > 0; b--) {
+        accum.grow(binBox[b]);
+        accumCount += binCount[b];
+        rightCost[b] = accumCount ? accumCount * accum.area() : 0;
+    }
+    int bestSplit = -1;
+    float bestCost = count * box.area();
+    accum = Bounds();
+    accumCount = 0;
+    for (int b = 0; b < BINS - 1; b++) {
+        accum.grow(binBox[b]);
+        accumCount += binCount[b];
+        if (accumCount == 0 || accumCount == count)
+            continue;
+        float cost = accumCount * accum.area() + rightCost[b + 1];
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+
+    int mid;
+    if (bestSplit >= 0) {
+        mid = int(std::partition(order.begin() + first, order.begin() + first + count,
+            [&](int tri) { return binOf(tri) <= bestSplit; }) - order.begin());
+    }
+    else if (count > 4 * LEAF_SIZE) {
+        mid = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count,
+            [&](int a, int b) { return centroid[a][axis] < centroid[b][axis]; });
+    }
+    else
+        return;
+
+    int left = (int)nodes.size();
+    nodes[nodeIndex].first = left;
+    nodes[nodeIndex].count = 0;
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    buildNode(left, order, triBox, centroid, first, mid - first, depth + 1);
+    buildNode(left + 1, order, triBox, centroid, mid, first + count - mid, depth + 1);
+}
+
+//--------------------------------------------------------------
+// Vertices: face normals weighted by the angle at the vertex. Edges: the
+// sum of the normals of the faces sharing it, found by sorting the edges
+// by their two vertices.
+//
+void TriMesh::buildPseudoNormals() {
+    int count = (int)triangles.size();
+    vector<glm::vec3> faceNormal(count);
+    vertexNormals.assign(vertices.size(), glm::vec3(0));
+    vector<std::pair<uint64_t, int>> edges;
+    edges.reserve(3 * count);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 v[3] = { vertices[triangles[i][0]], vertices[triangles[i][1]], vertices[triangles[i][2]] };
+        glm::vec3 n = glm::cross(v[1] - v[0], v[2] - v[0]);
+        float len = glm::length(n);
+        faceNormal[i] = (len > 0) ? n / len : glm::vec3(0);
+        for (int k = 0; k < 3; k++) {
+            glm::vec3 e1 = v[(k + 1) % 3] - v[k], e2 = v[(k + 2) % 3] - v[k];
+            float l1 = glm::length(e1), l2 = glm::length(e2);
+            if (l1 > 0 && l2 > 0)
+                vertexNormals[triangles[i][k]] += acos(glm::clamp(glm::dot(e1, e2) / (l1 * l2), -1.0f, 1.0f)) * faceNormal[i];
+            uint64_t a = (uint32_t)triangles[i][k], b = (uint32_t)triangles[i][(k + 1) % 3];
+            edges.push_back({ (std::min(a, b) << 32) | std::max(a, b), 3 * i + k });
+        }
+    }
+    for (int i = 0; i < vertexNormals.size(); i++) {
+        float len = glm::length(vertexNormals[i]);
+        if (len > 0)
+            vertexNormals[i] /= len;
+    }
+
+    std::sort(edges.begin(), edges.end());
+    edgeNormals.assign(3 * count, glm::vec3(0));
+    for (int first = 0; first < edges.size(); ) {
+        int last = first;
+        glm::vec3 n(0);
+        while (last < edges.size() && edges[last].first == edges[first].first)
+            n += faceNormal[edges[last++].second / 3];
+        for (int i = first; i < last; i++)
+            edgeNormals[edges[i].second] = n;
+        first = last;
+    }
+}
+
+//--------------------------------------------------------------
+// Closest point of triangle tri to p (Ericson, Real-Time Collision
+// Detection 5.1.5), squared distance returned. feature: 0 inside the face,
+// 1 + k vertex k, 4 + k the edge from vertex k to k + 1.
+//
+float TriMesh::closestPoint(int tri, const glm::vec3& p, glm::vec3& closest, int& feature) const {
+    const glm::vec3& a = vertices[triangles[tri][0]];
+    const glm::vec3& b = vertices[triangles[tri][1]];
+    const glm::vec3& c = vertices[triangles[tri][2]];
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0 && d2 <= 0) {
+        closest = a;
+        feature = 1;
+    }
+    else {
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        float vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+        if (d3 >= 0 && d4 <= d3) {
+            closest = b;
+            feature = 2;
+        }
+        else if (d6 >= 0 && d5 <= d6) {
+            closest = c;
+            feature = 3;
+        }
+        else if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+            closest = a + ab * (d1 / (d1 - d3));
+            feature = 4;
+        }
+        else if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+            closest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            feature = 5;
+        }
+        else if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+            closest = a + ac * (d2 / (d2 - d6));
+            feature = 6;
+        }
+        else {
+            float denom = 1 / (va + vb + vc);
+            closest = a + ab * (vb * denom) + ac * (vc * denom);
+            feature = 0;
+        }
+    }
+    glm::vec3 d = p - closest;
+    return glm::dot(d, d);
+}
+
+//--------------------------------------------------------------
+// slab test of a node box against the ray between tMin and tMax
+//
+static bool hitBox(const Bounds& b, const glm::vec3& o, const glm::vec3& invD, float tMin, float tMax, float& tNear) {
+    glm::vec3 t1 = (b.min - o) * invD, t2 = (b.max - o) * invD;
+    glm::vec3 lo = glm::min(t1, t2), hi = glm::max(t1, t2);
+    tNear = std::max(std::max(lo.x, lo.y), std::max(lo.z, tMin));
+    float tFar = std::min(std::min(hi.x, hi.y), std::min(hi.z, tMax));
+    return tNear <= tFar;
+}
+
+//--------------------------------------------------------------
+// Nodes are pushed with their entry t, nearer child on top, and dropped
+// when popped behind the closest hit so far. Triangles by Moller-Trumbore,
+// both sides.
+//
+bool TriMesh::intersect(const glm::vec3& o, const glm::vec3& d, float tMin, float tMax, float& t, glm::vec3& normal) const {
+    if (nodes.empty())
+        return false;
+    glm::vec3 invD = 1.0f / d;
+    int hitTri = -1;
+    int stack[MESH_MAX_DEPTH + 8];
+    float stackT[MESH_MAX_DEPTH + 8];
+    int top = 0;
+    float tNear;
+    if (!hitBox(nodes[0].bounds, o, invD, tMin, tMax, tNear))
+        return false;
+    stack[top] = 0;
+    stackT[top++] = tNear;
+    while (top > 0) {
+        top--;
+        if (stackT[top] >= tMax)
+            continue;
+        const BVHNode& node = nodes[stack[top]];
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const glm::vec3& a = vertices[triangles[i][0]];
+                glm::vec3 e1 = vertices[triangles[i][1]] - a, e2 = vertices[triangles[i][2]] - a;
+                glm::vec3 pvec = glm::cross(d, e2);
+                float det = glm::dot(e1, pvec);
+                if (det == 0)
+                    continue;
+                float invDet = 1 / det;
+                glm::vec3 tvec = o - a;
+                float u = glm::dot(tvec, pvec) * invDet;
+                if (u < 0 || u > 1)
+                    continue;
+                glm::vec3 qvec = glm::cross(tvec, e1);
+                float v = glm::dot(d, qvec) * invDet;
+                if (v < 0 || u + v > 1)
+                    continue;
+                float hit = glm::dot(e2, qvec) * invDet;
+                if (hit > tMin && hit < tMax) {
+                    tMax = hit;
+                    hitTri = i;
+                }
+            }
+            continue;
+        }
+        float tA, tB;
+        bool hitA = hitBox(nodes[node.first].bounds, o, invD, tMin, tMax, tA);
+        bool hitB = hitBox(nodes[node.first + 1].bounds, o, invD, tMin, tMax, tB);
+        if (hitA && hitB) {
+            bool aFirst = tA <= tB;
+            stack[top] = aFirst ? node.first + 1 : node.first;
+            stackT[top++] = aFirst ? tB : tA;
+            stack[top] = aFirst ? node.first : node.first + 1;
+            stackT[top++] = aFirst ? tA : tB;
+        }
+        else if (hitA || hitB) {
+            stack[top] = hitA ? node.first : node.first + 1;
+            stackT[top++] = hitA ? tA : tB;
+        }
+    }
+    if (hitTri < 0)
+        return false;
+    t = tMax;
+    const glm::vec3& a = vertices[triangles[hitTri][0]];
+    normal = glm::normalize(glm::cross(vertices[triangles[hitTri][1]] - a, vertices[triangles[hitTri][2]] - a));
+    return true;
+}
+
+//--------------------------------------------------------------
+float TriMesh::distance(const glm::vec3& p, glm::vec3* grad) const {
+    return nearest(p, INFINITY, grad);
+}
+
+//--------------------------------------------------------------
+float TriMesh::lowerBound(const glm::vec3& p, float exactBelow) const {
+    return nearest(p, exactBelow, nullptr);
+}
+
+//--------------------------------------------------------------
+// Nearest triangle: nodes are pushed with their squared box distance,
+// nearer child on top, and dropped when popped no closer than the nearest
+// triangle so far. The sign is that of p - closest along the pseudo normal
+// of the feature the closest point lies on.
+// While the nearest so far is further than exactBelow, nodes within
+// LOWER_BOUND_SLACK of it are dropped too. When that dropped one nearer than
+// the nearest triangle, the closest dropped node bounds the distance from
+// below, without a sign (the closest point is not known); should that bound
+// fall under exactBelow the query runs again without dropping.
+//
+float TriMesh::nearest(const glm::vec3& p, float exactBelow, glm::vec3* grad) const {
+    if (nodes.empty())
+        return INFINITY;
+    float exactBelow2 = exactBelow * exactBelow;
+    float slack2 = LOWER_BOUND_SLACK * LOWER_BOUND_SLACK;
+    float dropped = INFINITY;
+    auto boxDistance2 = [&](const Bounds& b) {
+        glm::vec3 q = glm::max(glm::max(b.min - p, p - b.max), glm::vec3(0));
+        return glm::dot(q, q);
+    };
+    float best = INFINITY;
+    int bestTri = -1, bestFeature = 0;
+    glm::vec3 bestPoint;
+    int stack[MESH_MAX_DEPTH + 8];
+    float stackD[MESH_MAX_DEPTH + 8];
+    int top = 0;
+    stack[top] = 0;
+    stackD[top++] = boxDistance2(nodes[0].bounds);
+    while (top > 0) {
+        top--;
+        if (stackD[top] >= best)
+            continue;
+        if (best > exactBelow2 && stackD[top] * slack2 >= best) {
+            dropped = std::min(dropped, stackD[top]);
+            continue;
+        }
+        const BVHNode& node = nodes[stack[top]];
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                glm::vec3 closest;
+                int feature;
+                float d2 = closestPoint(i, p, closest, feature);
+                if (d2 < best) {
+                    best = d2;
+                    bestTri = i;
+                    bestFeature = feature;
+                    bestPoint = closest;
+                }
+            }
+            continue;
+        }
+        float dA = boxDistance2(nodes[node.first].bounds), dB = boxDistance2(nodes[node.first + 1].bounds);
+        bool aFirst = dA <= dB;
+        if (std::max(dA, dB) < best) {
+            stack[top] = aFirst ? node.first + 1 : node.first;
+            stackD[top++] = std::max(dA, dB);
+        }
+        if (std::min(dA, dB) < best) {
+            stack[top] = aFirst ? node.first : node.first + 1;
+            stackD[top++] = std::min(dA, dB);
+        }
+    }
+
+    if (dropped < best) {
+        if (dropped < exactBelow2)
+            return nearest(p, INFINITY, grad);
+        return sqrt(dropped);
+    }
+
+    glm::vec3 pseudoNormal;
+    if (bestFeature == 0) {
+        const glm::vec3& a = vertices[triangles[bestTri][0]];
+        pseudoNormal = glm::cross(vertices[triangles[bestTri][1]] - a, vertices[triangles[bestTri][2]] - a);
+    }
+    else if (bestFeature <= 3)
+        pseudoNormal = vertexNormals[triangles[bestTri][bestFeature - 1]];
+    else
+        pseudoNormal = edgeNormals[3 * bestTri + bestFeature - 4];
+    glm::vec3 offset = p - bestPoint;
+    float dist = sqrt(best);
+    float sign = (glm::dot(offset, pseudoNormal) < 0) ? -1.0f : 1.0f;
+    if (grad) {
+        float len = glm::length(pseudoNormal);
+        if (dist > 1e-6f)
+            *grad = sign * offset / dist;
+        else
+            *grad = (len > 0) ? pseudoNormal / len : glm::vec3(0, 1, 0);
+    }
+    return sign * dist;
+}
+
+//--------------------------------------------------------------
+size_t TriMesh::memoryBytes() const {
+    return vertices.size() * sizeof(glm::vec3) + triangles.size() * sizeof(glm::ivec3) + nodes.size() * sizeof(BVHNode)
+        + vertexNormals.size() * sizeof(glm::vec3) + edgeNormals.size() * sizeof(glm::vec3);
+}
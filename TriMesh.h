@@ -0,0 +1,68 @@
+#pragma once
+
+#include "CompiledScene.h"
+
+//  Triangle mesh for both render modes. Vertices and triangles (three
+//  vertex indices) sit in two flat arrays, the triangles reordered by
+//  build() so every leaf of the SAH BVH (same BVHNode layout as the
+//  scene's) owns a contiguous range of them. Both queries walk the BVH
+//  nearer child first and skip nodes that cannot beat the best so far:
+//      intersect()  closest ray hit, nodes entered behind it are skipped
+//      distance()   signed distance to the nearest triangle, nodes further
+//                   than it are skipped
+//      lowerBound() the same, far from the surface also skipping nodes
+//                   only a little nearer
+//  The sign comes from the angle weighted pseudo normal of the closest
+//  feature (face, edge or vertex), which is exact for closed meshes with
+//  consistent winding. load() reads Wavefront OBJ (v and f lines, polygons
+//  as fans) and PLY (ascii or binary, float or double coordinates).
+//
+class TriMesh {
+public:
+	static const int LEAF_SIZE = 4;
+	static const int BINS = 16;
+	static constexpr float LOWER_BOUND_SLACK = 1.5f;
+
+	//  by file extension, then build(). false when the file is unreadable
+	//  or holds no triangles
+	bool load(const string& path);
+	bool loadObj(const string& path);
+	bool loadPly(const string& path);
+	//  binary little endian PLY of the vertices and triangles
+	bool savePly(const string& path) const;
+	//  BVH and pseudo normals, after changing vertices or triangles.
+	//  reorders both
+	void build();
+
+	//  closest hit with t in (tMin, tMax), d need not be unit length
+	bool intersect(const glm::vec3& o, const glm::vec3& d, float tMin, float tMax, float& t, glm::vec3& normal) const;
+	//  signed distance, negative inside. grad receives its gradient: from
+	//  the closest point to p, or the pseudo normal on the surface
+	float distance(const glm::vec3& p, glm::vec3* grad = nullptr) const;
+	//  distance() where it is below exactBelow, further out possibly less
+	//  (down to 1 / LOWER_BOUND_SLACK of it) and positive inside too: enough
+	//  to step a march from outside with, and much cheaper where many
+	//  triangles are about as far
+	float lowerBound(const glm::vec3& p, float exactBelow) const;
+
+	int triangleCount() const { return (int)triangles.size(); }
+	size_t memoryBytes() const;
+
+	vector<glm::vec3> vertices;
+	vector<glm::ivec3> triangles;
+	Bounds bounds;
+	float buildSeconds = 0;
+
+private:
+	friend class SceneFile;   // reads and writes the built arrays to its binary cache
+
+	void buildNode(int nodeIndex, vector<int>& order, const vector<Bounds>& triBox, const vector<glm::vec3>& centroid,
+		int first, int count, int depth);
+	void buildPseudoNormals();
+	float nearest(const glm::vec3& p, float exactBelow, glm::vec3* grad) const;
+	float closestPoint(int tri, const glm::vec3& p, glm::vec3& closest, int& feature) const;
+
+	vector<BVHNode> nodes;
+	vector<glm::vec3> vertexNormals;    // angle weighted normals of the faces around each vertex
+	vector<glm::vec3> edgeNormals;      // 3 per triangle, edge k runs from its vertex k to k + 1
+};
@@ -0,0 +1,541 @@
+//  Benchmark suite for the SDF and shading hot paths.
+//
+//  micro: ns per call of every primitive sdf (virtual and flat), sceneSDF,
+//         getNormalRM, phong and rayMarching on fixed random inputs,
+//         distance cache lookups, and loading, building and querying a
+//         million triangle mesh, also as part of a scene file read as text
+//         and from its binary cache; a fixed scene marched through the
+//         runtime sceneSDF and as a compile-time StaticScene type
+//  macro: full frames of fixed reference scenes at several resolutions and
+//         object counts (and a field of a million repeated spheres),
+//         reporting Mrays/s and scene evaluations per pixel; the larger
+//         scenes again with the distance cache, with its bake time and size;
+//         the mesh marched and ray traced; the fixed scene both ways
+//
+//  Build the project with RAYMARCH_BENCH defined and without the usual
+//  main.cpp (same as the headless renderer). Results are CSV lines
+//      suite,name,config,value,unit
+//  on cout (and in --output FILE), so runs can be diffed between releases.
+//
+#ifdef RAYMARCH_BENCH
+
+#include "ofApp.h"
+#include <chrono>
+#include <fstream>
+#include <random>
+
+static std::ofstream csvFile;
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const string& suite, const string& name, const string& config, double value, const string& unit) {
+    std::ostringstream line;
+    line << suite << "," << name << "," << config << "," << value << "," << unit;
+    cout << line.str() << endl;
+    if (csvFile.is_open())
+        csvFile << line.str() << endl;
+}
+
+//--------------------------------------------------------------
+// points in the box around the reference scenes, same sequence every run
+//
+static vector<glm::vec3> randomPoints(int count, float extent) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coord(-extent, extent);
+    vector<glm::vec3> points(count);
+    for (int i = 0; i < count; i++)
+        points[i] = glm::vec3(coord(rng), coord(rng), coord(rng));
+    return points;
+}
+
+//--------------------------------------------------------------
+// ns per call of fn(input), calls repeated over the inputs until at least
+// minCalls were made. sum keeps the optimizer from dropping the loop
+//
+template<class T, class F>
+static double nsPerCall(const vector<T>& points, int minCalls, F fn) {
+    float sum = 0;
+    int calls = 0;
+    double start = now();
+    while (calls < minCalls) {
+        for (int i = 0; i < points.size(); i++)
+            sum += fn(points[i]);
+        calls += (int)points.size();
+    }
+    double seconds = now() - start;
+    volatile float sink = sum;
+    (void)sink;
+    return seconds * 1e9 / calls;
+}
+
+//--------------------------------------------------------------
+static void clearScene(ofApp& app) {
+    for (int i = 0; i < app.scene.size(); i++)
+        delete app.scene[i];
+    app.scene.clear();
+    app.sceneObjects.clear();
+    app.staticMarcher = nullptr;
+}
+
+//--------------------------------------------------------------
+// reference scene: objects spheres, tori and hollow spheres on a grid in
+// front of the camera, no ground plane and no repetition (so the scene is
+// bounded and gets a BVH from 8 objects on)
+//
+static void referenceScene(ofApp& app, int objects) {
+    clearScene(app);
+    int side = (int)ceil(cbrt((double)objects));
+    float spacing = 8.0f / side;
+    for (int i = 0; i < objects; i++) {
+        int x = i % side, y = (i / side) % side, z = i / (side * side);
+        glm::vec3 p(-4 + spacing * (x + 0.5f), -3 + 0.75f * spacing * (y + 0.5f), -spacing * z);
+        float size = 0.35f * spacing;
+        if (i % 3 == 0)
+            app.scene.push_back(new Sphere(p, size, ofColor::skyBlue));
+        else if (i % 3 == 1)
+            app.scene.push_back(new Torus(p, glm::vec2(0.7f * size, 0.3f * size), ofColor::orangeRed));
+        else {
+            HollowSphere* h = new HollowSphere(p, ofColor::cyan);
+            h->rht = glm::vec3(size, 0.5f * size, 0.1f * size);
+            app.scene.push_back(h);
+        }
+    }
+    app.compileScene();
+}
+
+//--------------------------------------------------------------
+// a million spheres: one sphere repeated 1000 x 1000 times on the floor with
+// size and colour variation
+//
+static void instancedField(ofApp& app) {
+    clearScene(app);
+    app.scene.push_back(new Sphere(glm::vec3(0, -1.5, -1000), 0.6, ofColor::skyBlue));
+    Repetition& repetition = app.scene.back()->repetition;
+    repetition.period = glm::vec3(2, 0, 2);
+    repetition.count = glm::ivec3(1000, 1, 1000);
+    repetition.sizeJitter = 0.3;
+    repetition.colorJitter = 0.5;
+    app.compileScene();
+}
+
+//--------------------------------------------------------------
+// stand-in for a scanned asset: a closed torus of rings x sides quads with
+// small bumps, two triangles per quad wound outwards
+//
+static shared_ptr<TriMesh> bumpyTorus(int rings, int sides) {
+    shared_ptr<TriMesh> mesh = make_shared<TriMesh>();
+    for (int i = 0; i < rings; i++)
+        for (int j = 0; j < sides; j++) {
+            float u = TWO_PI * i / rings, v = TWO_PI * j / sides;
+            float r = 0.4f + 0.03f * sin(7 * u) * sin(5 * v);
+            mesh->vertices.push_back(glm::vec3((1 + r * cos(v)) * cos(u), (1 + r * cos(v)) * sin(u), r * sin(v)));
+        }
+    for (int i = 0; i < rings; i++)
+        for (int j = 0; j < sides; j++) {
+            int a = i * sides + j, b = ((i + 1) % rings) * sides + j;
+            int c = ((i + 1) % rings) * sides + (j + 1) % sides, d = i * sides + (j + 1) % sides;
+            mesh->triangles.push_back(glm::ivec3(a, b, c));
+            mesh->triangles.push_back(glm::ivec3(a, c, d));
+        }
+    mesh->build();
+    return mesh;
+}
+
+//--------------------------------------------------------------
+static void meshScene(ofApp& app, shared_ptr<TriMesh> mesh) {
+    clearScene(app);
+    app.scene.push_back(new Mesh(mesh, glm::vec3(0), 5, ofColor::lightSteelBlue, glm::vec3(0, 40, 0)));
+    app.compileScene();
+}
+
+//--------------------------------------------------------------
+static void microBenchmarks(ofApp& app, int minCalls) {
+    vector<glm::vec3> points = randomPoints(1 << 14, 3);
+    const char* names[] = { "sphere", "torus", "hollowSphere" };
+
+    for (int type = 0; type < 3; type++) {
+        clearScene(app);
+        if (type == 0)
+            app.scene.push_back(new Sphere(glm::vec3(0), 1));
+        else if (type == 1)
+            app.scene.push_back(new Torus(glm::vec3(0), glm::vec2(1, 0.5)));
+        else
+            app.scene.push_back(new HollowSphere(glm::vec3(0)));
+        app.compileScene();
+
+        const SceneObject* obj = app.scene[0];
+        report("micro", string(names[type]) + ".sdf", "virtual", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+            return obj->sdf(p);
+        }), "ns/eval");
+        report("micro", string(names[type]) + ".sdf", "compiled", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+            int objIndex;
+            return app.compiled.sdf(p, objIndex);
+        }), "ns/eval");
+    }
+
+    for (int objects : { 8, 64, 512 }) {
+        referenceScene(app, objects);
+        string config = to_string(objects) + " objects";
+        report("micro", "sceneSDFVirtual", config, nsPerCall(points, minCalls / 4, [&](const glm::vec3& p) {
+            int objIndex;
+            return app.sceneSDFVirtual(p, objIndex);
+        }), "ns/eval");
+        report("micro", "sceneSDF", config, nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+            int objIndex;
+            return app.sceneSDF(p, objIndex);
+        }), "ns/eval");
+    }
+
+    //the 512 object scene, cache baked over it
+    app.cacheToggle = true;
+    app.updateMarchSettings();
+    referenceScene(app, 512);
+    report("micro", "distanceCache.lowerBound", "512 objects", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+        return app.distanceCache.lowerBound(p);
+    }), "ns/eval");
+    report("micro", "marchSDF", "512 objects cached", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+        int objIndex;
+        return app.marchSDF(p, objIndex, app.march.hitThreshold);
+    }), "ns/eval");
+    app.cacheToggle = false;
+    app.updateMarchSettings();
+
+    //culling the 32x32 tiles of a 640x400 frame of the same scene
+    app.imageWidth = 640;
+    app.imageHeight = 400;
+    app.updateMarchSettings();
+    vector<glm::ivec2> tiles;
+    for (int y = 0; y < app.imageHeight; y += 32)
+        for (int x = 0; x < app.imageWidth; x += 32)
+            tiles.push_back(glm::ivec2(x, y));
+    glm::vec3 origin = app.renderCam.view.toWorld(0, 0);
+    glm::vec3 du = app.renderCam.view.toWorld(1.0f / app.imageWidth, 0) - origin;
+    glm::vec3 dv = app.renderCam.view.toWorld(0, 1.0f / app.imageHeight) - origin;
+    report("micro", "TileCuller.build", "512 objects 32x32", nsPerCall(tiles, minCalls / 256, [&](const glm::ivec2& tile) {
+        TileCuller culler;
+        culler.build(app.compiled, app.march, app.renderCam.position, origin, du, dv, tile.x, tile.y, tile.x + 32, tile.y + 32);
+        return (float)culler.tests;
+    }) / 1000, "us/tile");
+
+    //the CSG part, its tree walked recursively and its program on the stack machine
+    app.setupCsgScene();
+    const CsgObject* part = (const CsgObject*)app.scene[0];
+    const CsgModel& model = app.compiled.csgModels[0];
+    report("micro", "csg", "tree nodes", part->tree.nodes.size(), "nodes");
+    report("micro", "csg", "program", model.count, "instructions");
+    report("micro", "csg.sdf", "recursive tree", nsPerCall(points, minCalls / 4, [&](const glm::vec3& p) {
+        return part->sdf(p);
+    }), "ns/eval");
+    report("micro", "csg.sdf", "stack machine", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+        return app.compiled.csgSdf(model, p);
+    }), "ns/eval");
+    report("micro", "sceneSDF", "csg part", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+        int objIndex;
+        return app.sceneSDF(p, objIndex);
+    }), "ns/eval");
+
+    instancedField(app);
+    report("micro", "sceneSDF", "instanced field", nsPerCall(points, minCalls, [&](const glm::vec3& p) {
+        int objIndex;
+        return app.sceneSDF(p, objIndex);
+    }), "ns/eval");
+
+    //shading runs on surface points of the 64 object scene
+    referenceScene(app, 64);
+    app.updateLights();
+    app.updateMarchSettings();
+    vector<glm::vec3> surface;
+    vector<HitRecord> hits;
+    for (int j = 0; j < 64; j++)
+        for (int i = 0; i < 64; i++) {
+            HitRecord hit;
+            if (app.rayMarching(app.renderCam.getRay((i + 0.5f) / 64, (j + 0.5f) / 64), hit)) {
+                surface.push_back(hit.p);
+                hits.push_back(hit);
+            }
+        }
+    report("micro", "getNormalRM", "tetrahedral", nsPerCall(surface, minCalls / 8, [&](const glm::vec3& p) {
+        return app.getNormalRM(p).x;
+    }), "ns/call");
+    report("micro", "getNormalRM", "hit gradient", nsPerCall(hits, minCalls, [&](const HitRecord& hit) {
+        return app.getNormalRM(hit).x;
+    }), "ns/call");
+    report("micro", "phong", "64 objects", nsPerCall(surface, minCalls / 64, [&](const glm::vec3& p) {
+        return app.phong(p, glm::vec3(0, 1, 0), ofColor::cyan, ofColor::lightGray, 30).x;
+    }), "ns/call");
+    report("micro", "shadeRM", "64 objects", nsPerCall(hits, minCalls / 64, [&](const HitRecord& hit) {
+        return app.shadeRM(hit).x;
+    }), "ns/call");
+
+    //quantizing a 1280x800 HDR frame, highlights up to 4x over white
+    HdrImage frame;
+    frame.allocate(1280, 800);
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> radiance(0, 1020);
+    for (int i = 0; i < frame.rgb.size(); i++)
+        frame.rgb[i] = radiance(rng);
+    ofPixels pixels;
+    pixels.allocate(1280, 800, OF_IMAGE_COLOR);
+    vector<int> rows(800);
+    for (bool reinhard : { false, true }) {
+        ToneMapSettings settings;
+        settings.reinhard = reinhard;
+        report("micro", "toneMap", reinhard ? "reinhard" : "clamp", nsPerCall(rows, minCalls / 1024, [&](int) {
+            toneMap(frame, pixels, settings);
+            return (float)pixels.getData()[0];
+        }) / (1280 * 800), "ns/pixel");
+    }
+
+    //whole rays through the middle of the image
+    vector<glm::vec3> directions;
+    for (int j = 0; j < 64; j++)
+        for (int i = 0; i < 64; i++)
+            directions.push_back(app.renderCam.getRay(0.25f + i / 128.0f, 0.25f + j / 128.0f).d);
+    report("micro", "rayMarching", "64 objects", nsPerCall(directions, minCalls / 64, [&](const glm::vec3& d) {
+        glm::vec3 p;
+        return app.rayMarching(Ray(app.renderCam.position, d), p) ? p.z : 0.0f;
+    }), "ns/ray");
+    report("micro", "closestHit", "64 objects", nsPerCall(directions, minCalls / 64, [&](const glm::vec3& d) {
+        HitRecord hit;
+        glm::vec3 normal;
+        return app.closestHit(Ray(app.renderCam.position, d), 0, INFINITY, hit, normal) ? hit.t : 0.0f;
+    }), "ns/ray");
+
+    //the compiled-in scene marched through sceneSDF and as its StaticScene
+    //type: same rays, same steps, so ns/eval is ns/ray over the mean steps
+    app.setupStaticScene();
+    auto fixed = app.staticMarcher;
+    app.staticMarcher = nullptr;
+    long long dynamicSteps = 0, staticSteps = 0;
+    for (const glm::vec3& d : directions) {
+        HitRecord hit;
+        app.rayMarching(Ray(app.renderCam.position, d), hit);
+        dynamicSteps += hit.steps;
+        fixed(app.renderCam.position, d, 0, hit);
+        staticSteps += hit.steps;
+    }
+    double dynamicNs = nsPerCall(directions, minCalls / 64, [&](const glm::vec3& d) {
+        HitRecord hit;
+        return app.rayMarching(Ray(app.renderCam.position, d), hit) ? hit.t : 0.0f;
+    });
+    double staticNs = nsPerCall(directions, minCalls / 64, [&](const glm::vec3& d) {
+        HitRecord hit;
+        return fixed(app.renderCam.position, d, 0, hit) ? hit.t : 0.0f;
+    });
+    report("micro", "rayMarching", "static scene dynamic", dynamicNs, "ns/ray");
+    report("micro", "rayMarching", "static scene compiled", staticNs, "ns/ray");
+    report("micro", "rayMarching", "static scene dynamic", dynamicNs * directions.size() / dynamicSteps, "ns/eval");
+    report("micro", "rayMarching", "static scene compiled", staticNs * directions.size() / staticSteps, "ns/eval");
+    clearScene(app);
+
+    //a million triangle mesh through a binary PLY file, then its two queries
+    string config = "1M triangles";
+    string path = "bench_mesh.ply";
+    bumpyTorus(1000, 512)->savePly(path);
+    shared_ptr<TriMesh> mesh = make_shared<TriMesh>();
+    double start = now();
+    if (!mesh->load(path))
+        return;
+    report("micro", "TriMesh.load", config + " ply", now() - start, "s");
+    report("micro", "TriMesh.build", config, mesh->buildSeconds, "s");
+    report("micro", "TriMesh", config, mesh->memoryBytes() / (1024.0 * 1024.0), "MB");
+
+    //a scene file using it, parsed with the mesh loaded and built, then from
+    //the binary cache that load wrote
+    string scenePath = "bench_scene.txt";
+    std::ofstream(scenePath) << "light 3 5 3 10\nsphere 0 -3 0 1\nmesh " << path << " 0 0 0 5 rotate 0 40 0\n";
+    remove((scenePath + ".bin").c_str());
+    SceneFile text, cached;
+    if (text.load(scenePath) && cached.load(scenePath) && cached.fromCache) {
+        report("micro", "SceneFile.load", "text " + config, text.loadSeconds, "s");
+        report("micro", "SceneFile.load", "cached " + config, cached.loadSeconds, "s");
+    }
+    remove(scenePath.c_str());
+    remove((scenePath + ".bin").c_str());
+    remove(path.c_str());
+    vector<glm::vec3> nearMesh = randomPoints(1 << 14, 1.5);
+    report("micro", "TriMesh.distance", config, nsPerCall(nearMesh, minCalls / 16, [&](const glm::vec3& p) {
+        return mesh->distance(p);
+    }), "ns/query");
+    report("micro", "TriMesh.intersect", config, nsPerCall(nearMesh, minCalls / 16, [&](const glm::vec3& p) {
+        glm::vec3 o(0, 0, 4), normal;
+        float t;
+        return mesh->intersect(o, glm::normalize(p - o), 0, INFINITY, t, normal) ? t : 0.0f;
+    }), "ns/ray");
+    meshScene(app, mesh);
+    report("micro", "sceneSDF", "mesh " + config, nsPerCall(nearMesh, minCalls / 16, [&](const glm::vec3& p) {
+        int obj;
+        return app.sceneSDF(p, obj);
+    }), "ns/eval");
+}
+
+//--------------------------------------------------------------
+// one frame into a scratch buffer, timed without saving
+//
+static void renderFrame(ofApp& app, const string& scene, int width, int height) {
+    app.imageWidth = width;
+    app.imageHeight = height;
+    app.updateLights();
+    app.updateMarchSettings();
+    bool usePackets = app.usePacketMarcher();
+
+    HdrImage frame;
+    frame.allocate(width, height);
+    ofPixels pixels;
+    pixels.allocate(width, height, OF_IMAGE_COLOR);
+    std::atomic<long long> evaluations(0);
+    double start = now();
+    app.renderTiles([&](int x0, int y0, int x1, int y1) {
+        evaluations += app.marchTile(x0, y0, x1, y1, frame, usePackets);
+    });
+    toneMap(frame, pixels, app.toneMapping);
+    double seconds = now() - start;
+
+    string config = scene + " " + to_string(width) + "x" + to_string(height);
+    report("macro", "rayMarchLoop", config, width * height / (seconds * 1e6), "Mrays/s");
+    report("macro", "rayMarchLoop", config, double(evaluations) / (width * height), "evals/pixel");
+}
+
+//--------------------------------------------------------------
+// one ray traced frame, same as renderFrame
+//
+static void traceFrame(ofApp& app, const string& scene, int width, int height) {
+    app.imageWidth = width;
+    app.imageHeight = height;
+    app.updateLights();
+    app.updateMarchSettings();
+
+    HdrImage frame;
+    frame.allocate(width, height);
+    double start = now();
+    app.renderTiles([&](int x0, int y0, int x1, int y1) {
+        app.traceTile(x0, y0, x1, y1, frame);
+    });
+    double seconds = now() - start;
+    report("macro", "rayTrace", scene + " " + to_string(width) + "x" + to_string(height), width * height / (seconds * 1e6), "Mrays/s");
+}
+
+static void macroBenchmarks(ofApp& app, bool quick) {
+    vector<glm::ivec2> resolutions = { { 320, 200 }, { 640, 400 } };
+    if (!quick)
+        resolutions.push_back({ 1280, 800 });
+
+    //the interactive scene: one hollow sphere repeated over all space
+    clearScene(app);
+    app.scene.push_back(new HollowSphere(glm::vec3(0, 0, 0), ofColor::cyan));
+    app.scene.back()->repetition.period = glm::vec3(3);
+    app.compileScene();
+    for (auto& r : resolutions)
+        renderFrame(app, "default", r.x, r.y);
+
+    //the compiled-in scene, runtime path against its StaticScene type
+    app.setupStaticScene();
+    auto fixed = app.staticMarcher;
+    for (auto& r : resolutions) {
+        app.staticMarcher = nullptr;
+        renderFrame(app, "static scene dynamic", r.x, r.y);
+        app.staticMarcher = fixed;
+        renderFrame(app, "static scene compiled", r.x, r.y);
+    }
+    clearScene(app);
+
+    instancedField(app);
+    for (auto& r : resolutions)
+        renderFrame(app, "instanced field", r.x, r.y);
+
+    app.setupCsgScene();
+    for (auto& r : resolutions)
+        renderFrame(app, "csg part", r.x, r.y);
+
+    meshScene(app, bumpyTorus(1000, 512));
+    for (auto& r : resolutions) {
+        renderFrame(app, "mesh 1M triangles", r.x, r.y);
+        traceFrame(app, "mesh 1M triangles", r.x, r.y);
+    }
+
+    for (int objects : { 1, 8, 64, 512 }) {
+        referenceScene(app, objects);
+        for (auto& r : resolutions)
+            renderFrame(app, to_string(objects) + " objects", r.x, r.y);
+    }
+
+    //the same scenes stepping through the baked distance cache
+    app.cacheToggle = true;
+    app.updateMarchSettings();
+    for (int objects : { 64, 512 }) {
+        string config = to_string(objects) + " objects cached";
+        referenceScene(app, objects);
+        report("macro", "distanceCache", config, app.distanceCache.bakeSeconds, "s bake");
+        report("macro", "distanceCache", config, app.distanceCache.memoryBytes() / (1024.0 * 1024.0), "MB");
+        for (auto& r : resolutions)
+            renderFrame(app, config, r.x, r.y);
+    }
+    app.cacheToggle = false;
+    app.updateMarchSettings();
+
+    //and marching every tile against the primitives it can reach
+    app.cullToggle = true;
+    for (int objects : { 64, 512 }) {
+        referenceScene(app, objects);
+        for (auto& r : resolutions)
+            renderFrame(app, to_string(objects) + " objects culled", r.x, r.y);
+    }
+    app.setupCsgScene();
+    for (auto& r : resolutions)
+        renderFrame(app, "csg part culled", r.x, r.y);
+    app.cullToggle = false;
+
+    //shadow rays: three point lights per lit pixel
+    referenceScene(app, 64);
+    app.shadowToggle = true;
+    for (auto& r : resolutions)
+        renderFrame(app, "64 objects shadows", r.x, r.y);
+    app.shadowToggle = false;
+}
+
+//--------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    bool runMicro = true, runMacro = true, quick = false;
+    int threads = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--micro")
+            runMacro = false;
+        else if (arg == "--macro")
+            runMicro = false;
+        else if (arg == "--quick")
+            quick = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (arg == "--output" && i + 1 < argc)
+            csvFile.open(argv[++i]);
+        else {
+            cout << "usage: " << argv[0] << " [--micro | --macro] [--quick] [--threads N] [--output FILE]" << endl;
+            return (arg == "--help") ? 0 : 1;
+        }
+    }
+
+    ofApp app;
+    app.verbose = false;
+    app.image.setUseTexture(false);
+    app.setupScene();
+    app.useDefaultSettings();
+    app.threadSlider = threads;
+    app.updateLights();
+
+    report("info", "simd", PacketMarcher::levelName(app.packetMarcher.level), app.packetMarcher.width(), "lanes");
+    report("info", "threads", "", app.getPool().size(), "threads");
+
+    int minCalls = quick ? (1 << 18) : (1 << 21);
+    if (runMicro)
+        microBenchmarks(app, minCalls);
+    if (runMacro)
+        macroBenchmarks(app, quick);
+
+    app.exit();
+    return 0;
+}
+
+#endif
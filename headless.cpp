@@ -0,0 +1,193 @@
+//  Headless batch renderer. Renders one frame with rayMarchLoop() or
+//  rayTrace() without opening a window or creating a GL context, saves it and
+//  prints the wall time and rays per second.
+//
+//  Build the project with RAYMARCH_HEADLESS defined and without the usual
+//  main.cpp (which calls ofRunApp), e.g.
+//      raymarch --width 1920 --height 1080 --output frame.png --threads 8 --strategy relaxed
+//  Relative output paths go through ofToDataPath like every ofImage::save.
+//  --scene renders a scene file (see SceneFile.h); options after it override
+//  the settings it makes, options before it are overridden:
+//      raymarch --scene shapes.txt --strategy relaxed --output shapes.png
+//  Posters too big for memory render with --strips, straight into a .png, .ppm
+//  or .pfm (float HDR) file. The .png is not compressed (see StripWriter.h):
+//      raymarch --width 20000 --height 14000 --strips 64 --output poster.png
+//
+#ifdef RAYMARCH_HEADLESS
+
+#include "ofApp.h"
+#include <chrono>
+
+static void printUsage(const char* program) {
+    cout << "usage: " << program << " [options]\n"
+        << "  --width N             image width (default 1200)\n"
+        << "  --height N            image height (default 800)\n"
+        << "  --output PATH         output image (default Output.png)\n"
+        << "  --threads N           render threads, 0 = one per hardware thread (default 0)\n"
+        << "  --mode march|trace    ray marcher or ray tracer (default march)\n"
+        << "  --strategy basic|footprint|relaxed   march strategy (default basic)\n"
+        << "  --no-packets          march every pixel on its own instead of SIMD packets\n"
+        << "  --cone                run the cone pre-pass before marching\n"
+        << "  --cache               step through empty space by a baked distance cache\n"
+        << "  --cull                march each 8x8 block against the primitives it can reach\n"
+        << "  --shadows             soft shadows from the point lights\n"
+        << "  --no-repeat           turn off the domain repetition of the scene objects\n"
+        << "  --csg                 render the CSG demo part instead of the default scene\n"
+        << "  --mesh PATH           render a triangle mesh from an .obj or .ply file instead\n"
+        << "  --scene PATH          render a scene file instead of data/scene.txt or the default scene\n"
+        << "  --static              render the compiled-in scene, marched as a StaticScene type\n"
+        << "  --aa N                adaptive anti-aliasing with up to N rays per pixel\n"
+        << "  --aa-contrast X       neighbour luminance range that gets more rays (default 0.1)\n"
+        << "  --aa-tolerance X      luminance standard error a pixel stops at (default 0.01)\n"
+        << "  --exposure X          scale of the HDR frame before quantizing (default 1)\n"
+        << "  --reinhard            compress highlights instead of clipping them\n"
+        << "  --strips N            render N rows at a time and stream them to the output\n"
+        << "                        (.png, .ppm or .pfm), no anti-aliasing. the .png is\n"
+        << "                        uncompressed: 3 bytes a pixel, like the .ppm\n"
+        << "  --tile N              tile size in pixels (default 32)" << endl;
+}
+
+//--------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    ofApp app;
+    bool trace = false;
+    bool repeat = true;
+    bool csg = false;
+    bool fixed = false;
+    string meshPath;
+    int aaSamples = 0;
+    int stripRows = 0;
+
+    //no GL context: keep the image on the CPU. options are set on top of the
+    //default settings and the scene's
+    app.image.setUseTexture(false);
+    app.useDefaultSettings();
+    if (std::find(argv + 1, argv + argc, string("--scene")) == argv + argc)
+        app.setupScene();
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--width" && hasValue)
+            app.imageWidth = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)
+            app.imageHeight = atoi(argv[++i]);
+        else if (arg == "--output" && hasValue)
+            app.outputPath = argv[++i];
+        else if (arg == "--threads" && hasValue)
+            app.threadSlider = atoi(argv[++i]);
+        else if (arg == "--tile" && hasValue)
+            app.tileSize = atoi(argv[++i]);
+        else if (arg == "--mode" && hasValue) {
+            string mode = argv[++i];
+            if (mode != "march" && mode != "trace") {
+                printUsage(argv[0]);
+                return 1;
+            }
+            trace = (mode == "trace");
+        }
+        else if (arg == "--strategy" && hasValue) {
+            string name = argv[++i];
+            if (name == "basic")
+                app.strategySlider = MARCH_BASIC;
+            else if (name == "footprint")
+                app.strategySlider = MARCH_FOOTPRINT;
+            else if (name == "relaxed")
+                app.strategySlider = MARCH_RELAXED;
+            else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--no-packets")
+            app.packetToggle = false;
+        else if (arg == "--cone")
+            app.coneToggle = true;
+        else if (arg == "--cache")
+            app.cacheToggle = true;
+        else if (arg == "--cull")
+            app.cullToggle = true;
+        else if (arg == "--shadows")
+            app.shadowToggle = true;
+        else if (arg == "--no-repeat")
+            repeat = false;
+        else if (arg == "--csg")
+            csg = true;
+        else if (arg == "--static")
+            fixed = true;
+        else if (arg == "--mesh" && hasValue)
+            meshPath = argv[++i];
+        else if (arg == "--scene" && hasValue) {
+            if (!app.loadScene(argv[++i]))
+                return 1;
+        }
+        else if (arg == "--aa" && hasValue) {
+            aaSamples = atoi(argv[++i]);
+            app.aaToggle = aaSamples > 1;
+            app.aaSamplesSlider = std::max(aaSamples, 1);
+        }
+        else if (arg == "--aa-contrast" && hasValue)
+            app.aaContrastSlider = atof(argv[++i]);
+        else if (arg == "--aa-tolerance" && hasValue)
+            app.antiAlias.tolerance = atof(argv[++i]);
+        else if (arg == "--exposure" && hasValue)
+            app.exposureSlider = atof(argv[++i]);
+        else if (arg == "--reinhard")
+            app.reinhardToggle = true;
+        else if (arg == "--strips" && hasValue)
+            stripRows = atoi(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return (arg == "--help") ? 0 : 1;
+        }
+    }
+    if (app.imageWidth <= 0 || app.imageHeight <= 0 || app.tileSize <= 0 || app.threadSlider < 0 || aaSamples < 0
+        || app.exposureSlider <= 0 || stripRows < 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (fixed && !repeat) {
+        cout << "--no-repeat cannot change the compiled-in scene" << endl;
+        return 1;
+    }
+    if (fixed)
+        app.setupStaticScene();
+    if (csg)
+        app.setupCsgScene();
+    if (!meshPath.empty() && !app.setupMeshScene(meshPath))
+        return 1;
+    if (!repeat)
+        for (int i = 0; i < app.scene.size(); i++)
+            app.scene[i]->repetition = Repetition();
+
+    cout << (trace ? "ray tracing " : "ray marching ") << app.imageWidth << "x" << app.imageHeight
+        << ", " << app.scene.size() << " objects, SIMD " << PacketMarcher::levelName(app.packetMarcher.level) << endl;
+
+    if (stripRows > 0 && !StripWriter::knownFormat(app.outputPath)) {
+        cout << "--strips writes .png, .ppm or .pfm files" << endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool saved;
+    if (stripRows > 0)
+        saved = app.renderStrips(trace ? ofApp::RENDER_TRACE : ofApp::RENDER_MARCH, app.outputPath, stripRows);
+    else if (trace)
+        saved = app.rayTrace();
+    else
+        saved = app.rayMarchLoop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "wall time " << seconds << "s (including image save), "
+        << (app.imageWidth * app.imageHeight) / (seconds * 1e6) << " Mrays/s" << endl;
+    if (saved)
+        cout << "saved " << app.outputPath << endl;
+    else if (stripRows == 0)
+        cout << "cannot write " << app.outputPath << endl;
+
+    app.exit();
+    return saved ? 0 : 1;
+}
+
+#endif
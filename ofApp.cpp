@@ -4,26 +4,121 @@
  image from a prefixed camera along the z axis. this will save the image as
  Output.png. F4 key can be used to preview it in the program window. F3 to render.
  Now updated with Lambert and Phong shading. Sliders available to adjust settings.
+ The scene comes from data/scene.txt when there is one (format in SceneFile.h),
+ saving the file while the program runs reloads it.
  */
 
- // Intersect Ray with Plane  (wrapper on glm::intersect*
+// cone pre-pass: a cone stuck at a silhouette is not worth following further
+static const int CONE_MAX_STEPS = 64;
+// block size of the first, one ray per block pass of a background render
+static const int PREVIEW_BLOCK = 8;
+// anti-aliasing rays are added this many at a time between variance checks
+static const int AA_BATCH = 4;
+// scene file in the data folder, and how often update() looks for edits to it
+static const char* SCENE_FILE = "scene.txt";
+static const float SCENE_CHECK_SECONDS = 0.5;
+// how far a static scene's distances may be from sceneSDF's (rounding)
+static const float STATIC_SCENE_TOLERANCE = 1e-4;
+
+// the scene without a scene file
+static const char* DEFAULT_SCENE =
+    "camera 0 0 10\n"
+    "ambient 4\n"
+    "light 3 5 3 10\n"
+    "light -4 3 0 7\n"
+    "light 1 7 -4 8\n"
+    "hollowsphere 0 0 0 color 0 255 255 repeat 3 3 3\n";
+
+ // Intersect Ray with Sphere, the nearer root inside (tMin, tMax)
  //
-bool Plane::intersect(const Ray& ray, glm::vec3& point, glm::vec3& normalAtIntersect) {
-    float dist;
-    bool hit = glm::intersectRayPlane(ray.p, ray.d, position, this->normal, dist);
-    if (hit) {
-        Ray r = ray;
-        point = r.evalPoint(dist);
-        normalAtIntersect = this->normal;
-    }
-    return (hit);
+bool Sphere::intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const {
+    glm::vec3 oc = ray.p - position;
+    float b = glm::dot(oc, ray.d);
+    float c = glm::dot(oc, oc) - radius * radius;
+    float disc = b * b - c;
+    if (disc < 0)
+        return false;
+    float root = sqrt(disc);
+    t = -b - root;
+    if (t <= tMin)
+        t = -b + root;
+    if (t <= tMin || t >= tMax)
+        return false;
+    normal = (ray.p + t * ray.d - position) / radius;
+    return true;
+}
+
+ // Intersect Ray with Plane
+ //
+bool Plane::intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normalAtIntersect) const {
+    float denom = glm::dot(ray.d, this->normal);
+    if (abs(denom) < 1e-6f)
+        return false;
+    t = glm::dot(position - ray.p, this->normal) / denom;
+    if (t <= tMin || t >= tMax)
+        return false;
+    normalAtIntersect = this->normal;
+    return true;
+}
+
+
+//--------------------------------------------------------------
+// world -> mesh coordinates: object space over the scale, moved to the
+// mesh's own centre. The world box is the scaled mesh box turned by the
+// rotation like the torus boxes of CompiledScene.
+//
+MeshPrim Mesh::placement() const {
+    MeshPrim m;
+    m.mesh = data.get();
+    glm::vec3 extent = data->bounds.max - data->bounds.min;
+    float longest = std::max(std::max(extent.x, extent.y), extent.z);
+    m.scale = (longest > 0) ? size / longest : 1;
+    m.toMesh.rotate = toLocal.rotate / m.scale;
+    m.toMesh.translate = toLocal.translate / m.scale + data->bounds.center();
+    m.margin = 0.1f * glm::length(extent);
+    glm::mat3 toWorld = glm::transpose(toLocal.rotate);
+    glm::vec3 half = 0.5f * m.scale * extent, reach;
+    for (int i = 0; i < 3; i++)
+        reach[i] = abs(toWorld[0][i]) * half.x + abs(toWorld[1][i]) * half.y + abs(toWorld[2][i]) * half.z;
+    m.bounds.min = position - reach;
+    m.bounds.max = position + reach;
+    m.obj = -1;
+    return m;
+}
+
+ // Intersect Ray with Mesh, through its BVH in mesh coordinates. The
+ // direction is not renormalized there so t stays the world t.
+ //
+bool Mesh::intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const {
+    MeshPrim m = placement();
+    glm::vec3 n;
+    if (!data->intersect(m.toMesh.apply(ray.p), m.toMesh.rotate * ray.d, tMin, tMax, t, n))
+        return false;
+    normal = glm::normalize(glm::transpose(m.toMesh.rotate) * n);
+    return true;
 }
 
+//--------------------------------------------------------------
+float Mesh::sdf(const glm::vec3& p) const {
+    if (!data)
+        return INFINITY;
+    MeshPrim m = placement();
+    return data->distance(m.toMesh.apply(p)) * m.scale;
+}
+
+//--------------------------------------------------------------
+void Mesh::compile(CompiledScene& out, int index) const {
+    if (!data || data->triangleCount() == 0)
+        return;
+    MeshPrim m = placement();
+    m.obj = index;
+    out.meshes.push_back(m);
+}
 
 // Convert (u, v) to (x, y, z) 
 // We assume u,v is in [0, 1]
 //
-glm::vec3 ViewPlane::toWorld(float u, float v) {
+glm::vec3 ViewPlane::toWorld(float u, float v) const {
     float w = width();
     float h = height();
     return (glm::vec3((u * w) + min.x, (v * h) + min.y, position.z));
@@ -32,7 +127,7 @@ glm::vec3 ViewPlane::toWorld(float u, float v) {
 // Get a ray from the current camera position to the (u, v) position on
 // the ViewPlane
 //
-Ray RenderCam::getRay(float u, float v) {
+Ray RenderCam::getRay(float u, float v) const {
     glm::vec3 pointOnPlane = view.toWorld(u, v);
     return(Ray(position, glm::normalize(pointOnPlane - position)));
 }
@@ -48,26 +143,6 @@ void ofApp::setup() {
 
     ofEnableDepthTest();
 
-    //adding lights
-    Light l1(glm::vec3(3, 5, 3), 10), l2(glm::vec3(-4, 3, 0), 7), l3(glm::vec3(1, 7, -4), 8);
-    Light ambient(renderCam.position, 3);
-    lights.push_back(ambient);
-    lights.push_back(l1);
-    lights.push_back(l2);
-    lights.push_back(l3);
-
-    //adding object to scene
-    //scene.push_back(new Plane(glm::vec3(0, -2, 0), glm::vec3(0, 1, 0)));
-    //scene.push_back(new Sphere(glm::vec3(0, 1, -3), 1.5, ofColor::greenYellow));
-    //scene.push_back(new Sphere(glm::vec3(2, 2, -1), 1, ofColor::skyBlue));
-    //scene.push_back(new Sphere(glm::vec3(2, 1, -6), 2, ofColor::orangeRed));
-    scene.push_back(new HollowSphere(glm::vec3(0, 0, 0), ofColor::cyan));
-    //scene.push_back(new Torus(glm::vec3(0, 0, -2), glm::vec2(1, 0.5), ofColor::blue));
-    //scene.push_back(new Sphere(glm::vec3(0, 0, 0), 0.5, ofColor::greenYellow));
-
-    //allocateing storage for image
-    image.allocate(imageWidth, imageHeight, ofImageType::OF_IMAGE_COLOR);
-
     //slider setup
     gui.setup();
     gui.add(powerSlider.setup("Phong Power", 30, 2, 100));
@@ -75,11 +150,356 @@ void ofApp::setup() {
     gui.add(lightIntensitySlider1.setup("Light 1 intensity", 10, 1, 20));
     gui.add(lightIntensitySlider2.setup("Light 2 intensity", 7, 1, 20));
     gui.add(lightIntensitySlider3.setup("Light 3 intensity", 8, 1, 20));
+    gui.add(threadSlider.setup("Render threads", ThreadPool::hardwareThreads(), 1, ThreadPool::hardwareThreads()));
+    gui.add(strategySlider.setup("March: basic/footprint/relaxed", MARCH_BASIC, MARCH_BASIC, MARCH_RELAXED));
+    gui.add(packetToggle.setup(string("SIMD packets (") + PacketMarcher::levelName(packetMarcher.level) + ")",
+        packetMarcher.isAvailable()));
+    gui.add(coneToggle.setup("Cone pre-pass", false));
+    gui.add(cacheToggle.setup("Distance cache", false));
+    gui.add(cullToggle.setup("Tile culling", false));
+    gui.add(shadowToggle.setup("Soft shadows", false));
+    gui.add(penumbraSlider.setup("Shadow penumbra k (hardness)", 8, 2, 64));
+    gui.add(aaToggle.setup("Adaptive anti-aliasing", false));
+    gui.add(aaSamplesSlider.setup("AA max rays per pixel", 16, 4, 64));
+    gui.add(aaContrastSlider.setup("AA contrast threshold", 0.1, 0.01, 0.5));
+    gui.add(exposureSlider.setup("Exposure", 1, 0.25, 4));
+    gui.add(reinhardToggle.setup("Reinhard tone mapping", false));
+
+    //after the sliders, the scene file may set them
+    setupScene();
+}
+
+//--------------------------------------------------------------
+// lights, scene objects and camera from the scene file, or DEFAULT_SCENE
+// without one. Needs no window or GL context, the headless renderer
+// (headless.cpp) calls this instead of setup()
+//
+void ofApp::setupScene() {
+    if (ofFile::doesFileExist(SCENE_FILE) && loadScene(ofToDataPath(SCENE_FILE)))
+        return;
+    sceneFile.loadText(DEFAULT_SCENE);
+    applyScene(sceneFile.scene);
+}
+
+//--------------------------------------------------------------
+// read a scene file (or its binary cache) and make it the scene. false,
+// keeping the scene, when it has errors
+//
+bool ofApp::loadScene(const string& path) {
+    if (!sceneFile.load(path)) {
+        cout << sceneFile.error << endl;
+        return false;
+    }
+    int made = applyScene(sceneFile.scene);
+    if (verbose)
+        cout << path << ": " << scene.size() << " objects (" << made << " new), "
+            << lights.size() - 1 << " lights, loaded in " << sceneFile.loadSeconds << "s"
+            << (sceneFile.fromCache ? " from its cache" : "") << endl;
+    return true;
+}
+
+//--------------------------------------------------------------
+static SceneObject* makeObject(const ObjectDesc& o, const SceneDesc& desc) {
+    ofColor color(o.color[0], o.color[1], o.color[2]);
+    SceneObject* obj;
+    switch (o.type) {
+    case OBJECT_SPHERE:
+        obj = new Sphere(o.position, o.shape.x, color);
+        break;
+    case OBJECT_PLANE:
+        obj = new Plane(o.position, glm::vec3(0, 1, 0), color);
+        break;
+    case OBJECT_TORUS:
+        obj = new Torus(o.position, glm::vec2(o.shape.x, o.shape.y), color, o.rotation);
+        break;
+    case OBJECT_HOLLOW_SPHERE: {
+        HollowSphere* h = new HollowSphere(o.position, color, o.rotation);
+        h->rht = o.shape;
+        obj = h;
+        break;
+    }
+    default:
+        obj = new Mesh(desc.meshes[o.mesh], o.position, o.shape.x, color, o.rotation);
+        break;
+    }
+    obj->repetition = o.repetition;
+    return obj;
+}
+
+//--------------------------------------------------------------
+// make the scene, lights, camera and settings those of a scene description.
+// Objects described the same as by the last applyScene (and for meshes with
+// the same mesh data) are kept, only the others are made. Returns how many
+// were made
+//
+int ofApp::applyScene(const SceneDesc& desc) {
+    stopRender();
+    bool described = sceneObjects.size() == scene.size();
+    vector<bool> kept(scene.size(), false);
+    vector<SceneObject*> objects;
+    int made = 0;
+    for (int i = 0; i < desc.objects.size(); i++) {
+        const ObjectDesc& o = desc.objects[i];
+        SceneObject* obj = nullptr;
+        for (int j = 0; described && j < scene.size() && !obj; j++) {
+            if (kept[j] || sceneObjects[j] != o)
+                continue;
+            if (o.type == OBJECT_MESH && ((Mesh*)scene[j])->data != desc.meshes[o.mesh])
+                continue;
+            kept[j] = true;
+            obj = scene[j];
+        }
+        if (!obj) {
+            obj = makeObject(o, desc);
+            made++;
+        }
+        objects.push_back(obj);
+    }
+    for (int j = 0; j < scene.size(); j++)
+        if (!kept[j])
+            delete scene[j];
+    scene = objects;
+    sceneObjects = desc.objects;
+    staticMarcher = nullptr;
+
+    //lights[0] is the ambient light, at the camera
+    renderCam.position = desc.view.camera;
+    previewCam.setPosition(renderCam.position);
+    lights.clear();
+    lights.push_back(Light(renderCam.position, desc.view.ambient));
+    for (int i = 0; i < desc.lights.size(); i++)
+        lights.push_back(Light(desc.lights[i].position, desc.lights[i].intensity));
+    ambientLightSlider = desc.view.ambient;
+    ofxFloatSlider* intensitySliders[] = { &lightIntensitySlider1, &lightIntensitySlider2, &lightIntensitySlider3 };
+    for (int i = 0; i < 3 && i < desc.lights.size(); i++)
+        *intensitySliders[i] = desc.lights[i].intensity;
+    if (desc.view.width > 0) {
+        imageWidth = desc.view.width;
+        imageHeight = desc.view.height;
+    }
+    for (int i = 0; i < desc.settings.size(); i++)
+        if (!applySetting(desc.settings[i].name, desc.settings[i].value))
+            cout << "unknown setting " << desc.settings[i].name << endl;
+
+    restartRender();
+    return made;
+}
+
+//--------------------------------------------------------------
+// a set line of a scene file, false for a name it has no slider for
+//
+bool ofApp::applySetting(const string& name, float value) {
+    if (name == "power")
+        powerSlider = value;
+    else if (name == "threads")
+        threadSlider = value;
+    else if (name == "strategy")
+        strategySlider = value;
+    else if (name == "packets")
+        packetToggle = value != 0;
+    else if (name == "cone")
+        coneToggle = value != 0;
+    else if (name == "cache")
+        cacheToggle = value != 0;
+    else if (name == "cull")
+        cullToggle = value != 0;
+    else if (name == "shadows")
+        shadowToggle = value != 0;
+    else if (name == "penumbra")
+        penumbraSlider = value;
+    else if (name == "aa")
+        aaToggle = value != 0;
+    else if (name == "aa-samples")
+        aaSamplesSlider = value;
+    else if (name == "aa-contrast")
+        aaContrastSlider = value;
+    else if (name == "exposure")
+        exposureSlider = value;
+    else if (name == "reinhard")
+        reinhardToggle = value != 0;
+    else
+        return false;
+    return true;
+}
+
+//--------------------------------------------------------------
+// replace the scene by a CSG part: a plate with a smoothly blended boss, a
+// bore through both, a grid of holes and a ring around the boss
+//
+void ofApp::setupCsgScene() {
+    stopRender();
+    for (int i = 0; i < scene.size(); i++)
+        delete scene[i];
+    scene.clear();
+    sceneObjects.clear();
+    sceneFile = SceneFile();   // no longer watched
+    staticMarcher = nullptr;
+
+    CsgObject* part = new CsgObject(glm::vec3(0, -0.5, 0), ofColor::lightSteelBlue, glm::vec3(30, 20, 0));
+    CsgTree& t = part->tree;
+    int plate = t.intersect(t.box(glm::vec3(3, 0.4, 2)), t.sphere(3.4), 0.2);
+    int boss = t.transform(t.cylinder(1.2, 0.8), glm::vec3(0, 0.6, 0));
+    int body = t.unite(plate, boss, 0.4);
+    int bore = t.cylinder(0.6, 2);
+    int holes = t.repeat(t.cylinder(0.18, 1), glm::vec3(0.8, 0, 0.8), glm::ivec3(7, 0, 5));
+    int ring = t.transform(t.torus(1.45, 0.12), glm::vec3(0, 0.9, 0), glm::vec3(0, 90, 0));
+    int keepOut = t.cylinder(1.7, 1);
+    int drilled = t.subtract(body, t.unite(t.subtract(holes, keepOut), bore), 0.05);
+    t.unite(drilled, ring, 0.1);
+    scene.push_back(part);
+
+    restartRender();
+}
+
+//--------------------------------------------------------------
+// replace the scene by a fixed one compiled in as a StaticScene type, which
+// rayMarching then marches with (see staticMarcher). The scene objects for
+// shading and everything else are made from the same description; should
+// its distances still disagree with sceneSDF's, the scene is marched
+// through sceneSDF
+//
+void ofApp::setupStaticScene() {
+    stopRender();
+    for (int i = 0; i < scene.size(); i++)
+        delete scene[i];
+    scene.clear();
+    sceneObjects.clear();
+    sceneFile = SceneFile();   // no longer watched
+    staticMarcher = nullptr;
+
+    auto fixed = staticUnion(
+        staticObject<0>(StaticPlane{ -2 }, ofColor::darkOliveGreen),
+        staticObject<1>(StaticSphere{ glm::vec3(0, 1, -3), 1.5 }, ofColor::greenYellow),
+        staticObject<2>(StaticSphere{ glm::vec3(2, 2, -1), 1 }, ofColor::skyBlue),
+        staticObject<3>(StaticSphere{ glm::vec3(2, 1, -6), 2 }, ofColor::orangeRed),
+        staticObject<4>(staticPlaced(StaticTorus{ glm::vec2(1, 0.5) }, glm::vec3(0, 0, -2), glm::vec3(20, 45, 0)), ofColor::blue),
+        staticObject<5>(staticRepeated(staticPlaced(StaticHollowSphere(), glm::vec3(0), glm::vec3(20, -45, 0)), glm::vec3(3)),
+            ofColor::cyan));
+    fixed.addObjects(scene);
+    compileScene();
+
+    //both paths at a grid of points around the camera's view
+    for (int i = 0; i < 1000; i++) {
+        glm::vec3 p = glm::vec3(i % 10, (i / 10) % 10, i / 100) * 1.2f - glm::vec3(5.4f, 4.4f, 9.4f);
+        int staticObj, sceneObj;
+        float staticDist = fixed(p, staticObj), sceneDist = sceneSDF(p, sceneObj);
+        if (abs(staticDist - sceneDist) > STATIC_SCENE_TOLERANCE || staticObj != sceneObj) {
+            cout << "the static scene does not match its objects at " << p << ", marching it through sceneSDF" << endl;
+            restartRender();
+            return;
+        }
+    }
+    staticMarcher = [this, fixed](const glm::vec3& origin, const glm::vec3& dir, float tStart, HitRecord& hit) {
+        return staticMarch(fixed, march, origin, dir, tStart, hit);
+    };
+    //compiled above already, a started render still starts over (restartRender)
+    if (renderActive)
+        startRender(renderMode);
+}
+
+//--------------------------------------------------------------
+// replace the scene by a triangle mesh read from an OBJ or PLY file, 4 units
+// across and turned a little towards the camera. false, keeping the scene,
+// when the file cannot be loaded
+//
+bool ofApp::setupMeshScene(const string& path) {
+    shared_ptr<TriMesh> data = make_shared<TriMesh>();
+    float start = ofGetElapsedTimef();
+    if (!data->load(path)) {
+        cout << "could not load a mesh from " << path << endl;
+        return false;
+    }
+    if (verbose)
+        cout << path << ": " << data->triangleCount() << " triangles, " << data->vertices.size() << " vertices, "
+            << data->memoryBytes() / (1024.0f * 1024.0f) << " MB, loaded in " << ofGetElapsedTimef() - start
+            << "s (BVH " << data->buildSeconds << "s)" << endl;
+
+    stopRender();
+    for (int i = 0; i < scene.size(); i++)
+        delete scene[i];
+    scene.clear();
+    sceneObjects.clear();
+    sceneFile = SceneFile();   // no longer watched
+    staticMarcher = nullptr;
+    scene.push_back(new Mesh(data, glm::vec3(0), 4, ofColor::lightSteelBlue, glm::vec3(20, 15, 0)));
+    restartRender();
+    return true;
+}
+
+//--------------------------------------------------------------
+// slider values for runs without the GUI (headless and benchmark builds),
+// same defaults as setup() gives the sliders
+//
+void ofApp::useDefaultSettings() {
+    powerSlider = 30;
+    ambientLightSlider = 4;
+    lightIntensitySlider1 = 10;
+    lightIntensitySlider2 = 7;
+    lightIntensitySlider3 = 8;
+    threadSlider = 0;
+    strategySlider = MARCH_BASIC;
+    packetToggle = packetMarcher.isAvailable();
+    coneToggle = false;
+    cacheToggle = false;
+    cullToggle = false;
+    shadowToggle = false;
+    penumbraSlider = 8;
+    aaToggle = false;
+    aaSamplesSlider = 16;
+    aaContrastSlider = 0.1;
+    exposureSlider = 1;
+    reinhardToggle = false;
 }
 
 //--------------------------------------------------------------
 void ofApp::update() {
+    //moving the render camera or a geometry setting restarts the render. lighting
+    //changes only re-shade a finished frame from its G-buffer, anti-aliasing
+    //changes only redo the anti-aliasing pass and tone mapping changes only
+    //quantize the HDR frame again. the anti-aliasing pass these end with runs
+    //in the background like the render
+    if (renderActive && renderSettings() != jobSettings)
+        startRender(renderMode);
+    else if (renderActive && (lightSettings() != jobLights || shadowSettings() != jobShadows)) {
+        if (renderDone)
+            reshadeRender();
+        else
+            startRender(renderMode);
+    }
+    else if (renderActive && antiAliasSettings() != jobAntiAlias) {
+        if (renderDone)
+            startAntialias();
+        else
+            startRender(renderMode);
+    }
+    else if (renderActive && toneMapSettings() != jobToneMap) {
+        if (renderDone)
+            retoneRender();
+        else
+            startRender(renderMode);
+    }
 
+    //saving the scene file reloads it, remaking only the objects that changed
+    if (ofGetElapsedTimef() - sceneCheckTime > SCENE_CHECK_SECONDS) {
+        sceneCheckTime = ofGetElapsedTimef();
+        if (sceneFile.changed())
+            loadScene(sceneFile.path);
+    }
+
+    if (uploadedVersion != renderVersion) {
+        std::lock_guard<std::mutex> guard(displayLock);
+        uploadedVersion = renderVersion;
+        renderTexture.loadData(displayPixels);
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::exit() {
+    stopRender();
+    for (int i = 0; i < scene.size(); i++)
+        delete scene[i];
+    scene.clear();
+    compiled.clear();
 }
 
 //--------------------------------------------------------------
@@ -109,11 +529,9 @@ void ofApp::draw() {
 
     theCam->end();
 
-    //draw saved image on screen
-    if (bShowImage) {
-        image.load("Output.png");
-        image.draw(glm::vec3(0, 0, 0));
-    }
+    //draw the render in progress
+    if (bShowImage && renderTexture.isAllocated())
+        renderTexture.draw(0, 0);
     //draw slider
     ofDisableDepthTest();
     gui.draw();
@@ -130,13 +548,46 @@ void ofApp::keyPressed(int key) {
         theCam = &previewCam;
         break;
     case OF_KEY_F3:
-        rayTrace();
+        startRender(RENDER_TRACE);
         break;
     case OF_KEY_F4:
         bShowImage = !bShowImage;
         break;
     case 'm':
-        rayMarchLoop();
+        startRender(RENDER_MARCH);
+        break;
+    case 's':
+        saveRender();
+        break;
+    case 'b':
+        stopRender();
+        sdfThroughput();
+        break;
+    case 'p':
+        stopRender();
+        comparePacketMarch();
+        break;
+    case 'r':
+        stopRender();
+        compareMarchStrategies();
+        break;
+    case 'c':
+        stopRender();
+        compareConePrepass();
+        break;
+    case 'a':
+        stopRender();
+        compareAntiAlias();
+        break;
+    case 'g':
+        setupCsgScene();
+        break;
+    case 'k':
+        setupStaticScene();
+        break;
+    case 't':
+        stopRender();
+        compareTileCulling();
         break;
     default:
         break;
@@ -210,147 +661,1375 @@ void ofApp::progressBar(float progress, int& prevPos) {
 }
 
 //--------------------------------------------------------------
-void ofApp::rayTrace() {
-    //update light intensity value from slider
+// (re)create the pool when the requested thread count changed
+//
+ThreadPool& ofApp::getPool() {
+    int wanted = (numThreads > 0) ? numThreads : ThreadPool::hardwareThreads();
+    if (!pool || pool->size() != wanted)
+        pool.reset(new ThreadPool(wanted));
+    return *pool;
+}
+
+//--------------------------------------------------------------
+void ofApp::renderTiles(std::function<void(int, int, int, int)> renderTile, int rowBegin, int rowEnd) {
+    ThreadPool& workers = getPool();
+    if (rowEnd < 0)
+        rowEnd = imageHeight;
+    int tilesX = (imageWidth + tileSize - 1) / tileSize;
+    int tilesY = (rowEnd - rowBegin + tileSize - 1) / tileSize;
+    int tileCount = tilesX * tilesY;
+
+    std::atomic<int> tilesDone(0);
+    std::mutex progressLock;
+    int previousPos = -1;
+
+    float startTime = ofGetElapsedTimef();
+    for (int t = 0; t < tileCount; t++) {
+        int x0 = (t % tilesX) * tileSize;
+        int y0 = rowBegin + (t / tilesX) * tileSize;
+        int x1 = std::min(x0 + tileSize, imageWidth);
+        int y1 = std::min(y0 + tileSize, rowEnd);
+        workers.submit([=, &renderTile, &tilesDone, &progressLock, &previousPos] {
+            renderTile(x0, y0, x1, y1);
+            float progress = float(++tilesDone) / tileCount;
+            //whoever gets the lock draws the bar, the others just move on
+            std::unique_lock<std::mutex> guard(progressLock, std::try_to_lock);
+            if (guard.owns_lock() && verbose)
+                progressBar(progress, previousPos);
+        });
+    }
+    workers.wait();
+    float seconds = ofGetElapsedTimef() - startTime;
+
+    if (!verbose)
+        return;
+    progressBar(1, previousPos);
+    cout << "\n" << imageWidth << "x" << (rowEnd - rowBegin) << " in " << seconds << "s on "
+        << workers.size() << " threads, "
+        << (imageWidth * (rowEnd - rowBegin)) / (seconds * 1e6f) << " Mrays/s" << endl;
+}
+
+//--------------------------------------------------------------
+void ofApp::updateLights() {
+    //update light intensity value from slider. the sliders cover the ambient
+    //light and the first three point lights, the others keep the scene file's
     lights[0].intensity = ambientLightSlider;
-    lights[1].intensity = lightIntensitySlider1;
-    lights[2].intensity = lightIntensitySlider2;
-    lights[3].intensity = lightIntensitySlider3;
+    const ofxFloatSlider* intensitySliders[] = { &lightIntensitySlider1, &lightIntensitySlider2, &lightIntensitySlider3 };
+    for (int i = 1; i <= 3 && i < lights.size(); i++)
+        lights[i].intensity = *intensitySliders[i - 1];
+    phongPower = powerSlider;
+    numThreads = threadSlider;
+
+    lightPack.clear();
+    for (int i = 1; i < lights.size(); i++)
+        lightPack.add(lights[i].position, lights[i].intensity);
+    toneMapping.exposure = exposureSlider;
+    toneMapping.reinhard = reinhardToggle;
+}
 
-    float viewWidth = renderCam.view.width();
-    float viewHeight = renderCam.view.height();
-    float widthIncrament = 1.0 / imageWidth;
-    float heightIncrament = 1.0 / imageHeight;
-    bool hit = false;
-    int closestObject;
-    glm::vec3 closestIntersectPt, tempIntersectPt;
-    glm::vec3 closestIntersectNorm, tempIntersectNorm;
+//--------------------------------------------------------------
+bool ofApp::rayTrace() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    //anti-aliasing finds its edges in the G-buffer
+    GBuffer* edges = nullptr;
+    if (antiAlias.enabled) {
+        gbuffer.allocate(imageWidth, imageHeight);
+        edges = &gbuffer;
+    }
 
-    Ray renderRay(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0)); //placeholder
+    workFrame.allocate(imageWidth, imageHeight);
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        traceTile(x0, y0, x1, y1, workFrame, edges);
+    });
+    if (antiAlias.enabled) {
+        baseFrame = workFrame;
+        antialiasPass(RENDER_TRACE, workFrame, false);
+    }
 
-    float progress = 0.0;
-    int previousPos = -1;
+    //save image
+    image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+    toneMap(workFrame, image.getPixels(), toneMapping);
+    image.update();
+    return image.save(outputPath);
+}
+
+//--------------------------------------------------------------
+// ray trace one tile with the objects' intersect()
+//
+void ofApp::traceTile(int x0, int y0, int x1, int y1, HdrImage& frame, GBuffer* gbuffer) const {
+    float widthIncrament = 1.0 / imageWidth;
+    float heightIncrament = 1.0 / imageHeight;
 
-    //loop through each pixel
-    for (int i = 1; i <= imageWidth; i++) {
-        for (int j = 1; j <= imageHeight; j++) {
+    //loop through each pixel of the tile
+    for (int i = x0; i < x1; i++) {
+        for (int j = y0; j < y1; j++) {
             //get ray for each pixel from the camera
-            renderRay = renderCam.getRay(widthIncrament * (i - 1), heightIncrament * (j - 1));
-            //loop though scene object to check intersection
-            for (int k = 0; k < scene.size(); k++) {
-                //find closest object
-                if (scene[k]->intersect(renderRay, tempIntersectPt, tempIntersectNorm) && hit == false) {
-                    closestObject = k;
-                    closestIntersectPt = tempIntersectPt;
-                    closestIntersectNorm = tempIntersectNorm;
-                    hit = true;
-                }
-                else if (scene[k]->intersect(renderRay, tempIntersectPt, tempIntersectNorm) && hit == true) {
-                    if (glm::length(renderCam.position - tempIntersectPt) <= glm::length(renderCam.position - closestIntersectPt)) {
-                        closestObject = k;
-                        closestIntersectPt = tempIntersectPt;
-                        closestIntersectNorm = tempIntersectNorm;
-                    }
-                }
-            }
+            Ray renderRay = renderCam.getRay(widthIncrament * i, heightIncrament * j);
+            GBufferTexel* texel = gbuffer ? &gbuffer->at(i, imageHeight - 1 - j) : nullptr;
+            frame.set(i, imageHeight - 1 - j, traceRay(renderRay, texel));
+        }
+    }
+}
 
-            //after figured out closest object, get the color of the object where ray is hit
-            if (hit) {
-                ofColor diffuseCol = scene[closestObject]->diffuseColor;
-                ofColor spectralCol = scene[closestObject]->specularColor;
-                ofColor lShading = lambert(closestIntersectPt, closestIntersectNorm, diffuseCol);
-                ofColor pShading = phong(closestIntersectPt, closestIntersectNorm, diffuseCol, spectralCol, powerSlider);
+//--------------------------------------------------------------
+// colour of one ray from its closest hit, black for a miss
+//
+glm::vec3 ofApp::traceRay(const Ray& renderRay, GBufferTexel* texel) const {
+    HitRecord hit;
+    glm::vec3 normal;
+    if (!closestHit(renderRay, 0, INFINITY, hit, normal)) {
+        //backgroun color
+        if (texel)
+            texel->obj = -1;
+        return glm::vec3(0);
+    }
 
-                image.setColor(i, imageHeight - j, pShading);
-                hit = false;
-            }
-            else
-                //backgroun color
-                image.setColor(i, imageHeight - j, ofColor::black);
+    //get the color of the object where ray is hit, per copy like shadeRM
+    ofColor diffuseCol = objectColor(hit.obj, hit.p);
+    ofColor spectralCol = scene[hit.obj]->specularColor;
+    const float* visibility = nullptr;
+    if (texel) {
+        texel->set(hit.p, normal, hit.obj);
+        for (int l = 0; l < GBUFFER_LIGHTS && l + 1 < lights.size(); l++)
+            texel->visibility[l] = lightVisibility(hit.p, normal, l + 1);
+        visibility = texel->visibility;
+    }
+    return phong(hit.p, normal, diffuseCol, spectralCol, phongPower, visibility);
+}
+
+//--------------------------------------------------------------
+// Closest hit of the ray with t in (tMin, tMax) over every scene object,
+// one intersection per object. tMax shrinks to each hit found, so later
+// objects only look in front of it. Objects with a formula (analytic())
+// are solved directly, the others are sphere traced through their flat
+// scene primitive, which the shrinking tMax cuts short too; their normal
+// is only computed for the final hit. hit.steps counts the distance
+// evaluations of the traced ones.
+//
+bool ofApp::closestHit(const Ray& ray, float tMin, float tMax, HitRecord& hit, glm::vec3& normal) const {
+    hit.obj = -1;
+    hit.steps = 0;
+    bool traced = false;
+    for (int k = 0; k < scene.size(); k++) {
+        float t;
+        glm::vec3 n;
+        if (scene[k]->analytic()) {
+            if (!scene[k]->intersect(ray, tMin, tMax, t, n))
+                continue;
+            normal = n;
+            traced = false;
+        }
+        else {
+            if (!traceObject(k, ray, tMin, tMax, t, hit.steps))
+                continue;
+            traced = true;
         }
+        tMax = t;
+        hit.obj = k;
+    }
+    if (hit.obj < 0)
+        return false;
+
+    hit.t = tMax;
+    hit.p = ray.p + tMax * ray.d;
+    if (traced) {
+        glm::vec3 grad;
+        if (!compiled.objectSdfGradient(hit.obj, hit.p, hit.dist, grad))
+            grad = -ray.d;
+        normal = glm::normalize(grad);
+    }
+    return true;
+}
 
-        progress += 1.0 / imageWidth;
-        if ((i + 1) == imageWidth)
-            progress = 1;
-        progressBar(progress, previousPos);
+//--------------------------------------------------------------
+// Sphere trace scene object k alone from tMin, clipped to its primitive's
+// box and given up at tMax. Hit below the march threshold like rayMarching.
+//
+bool ofApp::traceObject(int k, const Ray& ray, float tMin, float tMax, float& t, int& steps) const {
+    if (k >= compiled.objectPrims.size() || compiled.objectPrims[k].type == PRIM_NONE)
+        return false;
+    const PrimRef& prim = compiled.objectPrims[k];
+    float tNear, tFar;
+    if (!compiled.primBounds(prim).clip(ray.p, ray.d, tNear, tFar))
+        return false;
+    t = std::max(tMin, tNear);
+    float tEnd = std::min(tMax, tFar);
+    int objIndex;
+    for (int i = 0; i < march.maxSteps && t < tEnd; i++) {
+        float d = compiled.primSdf(prim, ray.p + t * ray.d, objIndex);
+        steps++;
+        if (d < march.threshold(t))
+            return true;
+        //endless primitives: nothing left out there
+        if (d > march.maxDistance && isinf(tEnd))
+            return false;
+        t += d;
     }
+    return false;
+}
 
-    //save image
-    image.save("Output.png");
+//--------------------------------------------------------------
+bool ofApp::rayMarching(Ray r, glm::vec3& p) const {
+    HitRecord hit;
+    bool found = rayMarching(r, hit);
+    p = hit.p;
+    return found;
 }
 
 //--------------------------------------------------------------
-bool ofApp::rayMarching(Ray r, glm::vec3& p) {
-    const int MAX_RAY_STEPS = 200;
-    const float DIST_THRESHOLD = 0.001;
-    const float MAX_DISTANCE = 10;
+// Sphere tracing along r, strategy picked by march.strategy (see MarchStrategy).
+// Over-relaxed steps go omega * dist. As long as the sphere at the new point
+// overlaps the previous one nothing was skipped; when they stop overlapping
+// the ray falls back to the edge of the previous sphere (the last point known
+// to be safe) and continues with plain steps. The record holds the last
+// point, its closest object and distance, and steps counts scene evaluations.
+// prims (TileCuller) limits the march to the primitives the ray can reach.
+//
+bool ofApp::rayMarching(Ray r, HitRecord& record, float tStart, const PrimSpan* prims) const {
+    if (staticMarcher)
+        return staticMarcher(r.p, r.d, tStart, record);
     bool hit = false;
-    int objIndex;
-    p = r.p;
-    for (int i = 0; i < MAX_RAY_STEPS; i++) {
-        float dist = sceneSDF(p, objIndex);
-        if (dist < DIST_THRESHOLD) {
+    float t = 0, tNear, tFar;
+    float omega = march.stepScale();
+    float stepLength = 0, previousRadius = 0;
+    glm::vec3 p = r.p;
+    record = HitRecord();
+    record.p = p;
+    //skip the empty space in front of the scene box, rays missing it are done
+    if (!compiled.clipRay(r.p, r.d, tNear, tFar))
+        return false;
+    //tStart is known to be empty (cone pre-pass)
+    t = std::max(tNear, tStart);
+    if (t > 0)
+        p = r.p + r.d * t;
+    for (int i = 0; i < march.maxSteps; i++) {
+        float dist = marchSDF(p, record.obj, march.threshold(t), prims);
+        record.steps++;
+        record.dist = dist;
+        if (omega > 1 && abs(dist) + previousRadius < stepLength) {
+            t -= stepLength - previousRadius;
+            p = r.p + r.d * t;
+            omega = 1;
+            stepLength = 0;
+            previousRadius = 0;
+            continue;
+        }
+        if (dist < march.threshold(t)) {
             hit = true;
             break;
         }
-        else if (dist > MAX_DISTANCE) {
+        else if (compiled.bounded ? t > tFar : dist > march.maxDistance) {
             break;
         }
-        else
-            p = p + (r.d * dist);
+        else {
+            stepLength = dist * omega;
+            previousRadius = dist;
+            p = p + (r.d * stepLength);
+            t += stepLength;
+        }
     }
+    record.t = t;
+    record.p = p;
     return hit;
 }
 
 //--------------------------------------------------------------
-void ofApp::rayMarchLoop() {
-    Ray renderRay(glm::vec3(0, 0, 0), glm::vec3(0, 0, 0)); //placeholder
-    glm::vec3 p(0,0,0);
-    bool hit;
+// Half the angular size of a pixel, measured at the centre of the view plane:
+// a pixel cone covers pixelConeRadius() * t at distance t from the camera.
+//
+float ofApp::pixelConeRadius() const {
+    float planeDistance = glm::length(renderCam.view.position - renderCam.position);
+    return 0.5f * (renderCam.view.width() / imageWidth) / planeDistance;
+}
+
+void ofApp::updateMarchSettings() {
+    march.strategy = MarchStrategy(int(strategySlider));
+    march.pixelRadius = pixelConeRadius();
+    march.conePrepass = coneToggle;
+    march.distanceCache = cacheToggle;
+    march.tileCulling = cullToggle;
+    march.shadows = shadowToggle;
+    march.penumbra = penumbraSlider;
+    antiAlias.enabled = aaToggle;
+    antiAlias.maxSamples = aaSamplesSlider;
+    antiAlias.contrast = aaContrastSlider;
+}
+
+//--------------------------------------------------------------
+// March one cone around the rays of pixels [i0, i1) x [j0, j1) and return how
+// far all of them can safely skip. The cone follows the middle ray; its slope
+// is the largest distance between the middle direction and a corner pixel's
+// direction, so every pixel ray stays within slope * t of the axis. The ball
+// of radius dist around the axis point covers the cone for the next
+// (dist - slope * t) / (1 + slope); the hit threshold is kept out of that
+// margin so no pixel ray could have stopped inside the skipped part.
+//
+float ofApp::coneMarch(int i0, int j0, int i1, int j1, float tStart, int& steps, const PrimSpan* prims) const {
+    float u = 0.5f * (i0 + i1 - 1) / imageWidth;
+    float v = 0.5f * (j0 + j1 - 1) / imageHeight;
+    glm::vec3 axis = renderCam.getRay(u, v).d;
+    int cornerI[2] = { i0, i1 - 1 }, cornerJ[2] = { j0, j1 - 1 };
+    float slope = 0;
+    //bounded scenes: no need to follow the cone past the box
+    float tEnd = compiled.bounded ? -INFINITY : INFINITY;
+    for (int a = 0; a < 2; a++)
+        for (int b = 0; b < 2; b++) {
+            glm::vec3 corner = renderCam.getRay(float(cornerI[a]) / imageWidth, float(cornerJ[b]) / imageHeight).d;
+            slope = std::max(slope, glm::length(corner - axis));
+            float tNear, tFar;
+            if (compiled.bounded && compiled.clipRay(renderCam.position, corner, tNear, tFar))
+                tEnd = std::max(tEnd, tFar);
+        }
+
+    int objIndex;
+    float t = tStart;
+    for (int i = 0; i < CONE_MAX_STEPS && t < tEnd; i++) {
+        float dist = marchSDF(renderCam.position + axis * t, objIndex, march.hitThreshold, prims);
+        steps++;
+        float free = dist - slope * t - march.threshold(t);
+        if (free <= march.hitThreshold)
+            break;
+        t += free / (1 + slope);
+        //the whole cone is past the scene, the pixels will miss straight away
+        if (!compiled.bounded && dist > march.maxDistance)
+            break;
+    }
+    return std::max(tStart, std::min(t, tEnd));
+}
+
+//--------------------------------------------------------------
+// Cone pre-pass for one tile: 8x8 blocks from the camera, then 2x2 blocks from
+// their 8x8 depth. startT receives the 2x2 depth for every pixel of the tile
+// (row major, tile width). Returns the scene evaluations spent. The 8x8
+// blocks are the leaves of culler, when given.
+//
+long long ofApp::conePrepass(int x0, int y0, int x1, int y1, vector<float>& startT, const TileCuller* culler) const {
+    int width = x1 - x0;
+    int steps = 0;
+    for (int by = y0; by < y1; by += 8) {
+        for (int bx = x0; bx < x1; bx += 8) {
+            int bx1 = std::min(bx + 8, x1), by1 = std::min(by + 8, y1);
+            const PrimSpan* prims = culler ? culler->at(bx, by) : nullptr;
+            float blockT = coneMarch(bx, by, bx1, by1, 0, steps, prims);
+            for (int sy = by; sy < by1; sy += 2) {
+                for (int sx = bx; sx < bx1; sx += 2) {
+                    int sx1 = std::min(sx + 2, bx1), sy1 = std::min(sy + 2, by1);
+                    float subT = coneMarch(sx, sy, sx1, sy1, blockT, steps, prims);
+                    for (int j = sy; j < sy1; j++)
+                        for (int i = sx; i < sx1; i++)
+                            startT[(j - y0) * width + (i - x0)] = subT;
+                }
+            }
+        }
+    }
+    return steps;
+}
+
+//--------------------------------------------------------------
+// Start rendering in the background. Settings are read and the scene is
+// compiled here on the UI thread, the job then only reads them. Tiles are
+// shaded into workFrame and tone mapped into displayPixels as they finish,
+// update() uploads those to renderTexture.
+// Nothing is written to disk until saveRender().
+//
+void ofApp::startRender(RenderMode mode) {
+    stopRender();
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+
+    if (workFrame.width != imageWidth || workFrame.height != imageHeight) {
+        workFrame.allocate(imageWidth, imageHeight);
+        std::lock_guard<std::mutex> guard(displayLock);
+        displayPixels.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+        renderTexture.allocate(imageWidth, imageHeight, GL_RGB);
+    }
+    if (gbuffer.width != imageWidth || gbuffer.height != imageHeight)
+        gbuffer.allocate(imageWidth, imageHeight);
+    renderMode = mode;
+    renderActive = true;
+    jobSettings = renderSettings();
+    jobLights = lightSettings();
+    jobShadows = shadowSettings();
+    jobAntiAlias = antiAliasSettings();
+    jobToneMap = toneMapSettings();
+    bShowImage = true;
+    renderCancelled = false;
+    renderDone = false;
+    antialiasDone = false;
+    renderThread = std::thread(&ofApp::renderJob, this, mode);
+}
+
+//--------------------------------------------------------------
+// after the scene was replaced: a started render starts over, so nothing
+// re-shades the old scene's G-buffer with the new objects. otherwise only
+// the flat scene is rebuilt
+//
+void ofApp::restartRender() {
+    if (renderActive)
+        startRender(renderMode);
+    else
+        compileScene();
+}
+
+//--------------------------------------------------------------
+// cancel the running job (if any) and wait for it
+//
+void ofApp::stopRender() {
+    if (!renderThread.joinable())
+        return;
+    renderCancelled = true;
+    renderThread.join();
+    renderCancelled = false;
+}
+
+//--------------------------------------------------------------
+// Background job. The ray marcher first fills the frame with one ray per
+// PREVIEW_BLOCK x PREVIEW_BLOCK block, then refines tile by tile at full
+// resolution, then anti-aliases (antialiasJob). Tiles that start after a
+// cancel return straight away.
+//
+void ofApp::renderJob(RenderMode mode) {
+    bool usePackets = usePacketMarcher();
+    if (mode == RENDER_MARCH) {
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            if (renderCancelled)
+                return;
+            previewTile(x0, y0, x1, y1, workFrame, PREVIEW_BLOCK);
+            publishTile(x0, y0, x1, y1);
+        });
+    }
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        if (renderCancelled)
+            return;
+        if (mode == RENDER_MARCH)
+            marchTile(x0, y0, x1, y1, workFrame, usePackets, &gbuffer);
+        else
+            traceTile(x0, y0, x1, y1, workFrame, &gbuffer);
+        publishTile(x0, y0, x1, y1);
+    });
+    if (renderCancelled)
+        return;
+    //from here on lighting, anti-aliasing and tone mapping changes only redo
+    //their passes, see update()
+    baseFrame = workFrame;
+    renderDone = true;
+    antialiasJob(mode);
+    if (!renderCancelled)
+        cout << "render finished, 's' saves it to " << outputPath << endl;
+}
+
+//--------------------------------------------------------------
+// Anti-alias the finished frame again in the background, starting over from
+// baseFrame. The frame without anti-aliasing shows straight away, then the
+// refined tiles as they finish.
+//
+void ofApp::startAntialias() {
+    stopRender();
+    updateLights();
+    updateMarchSettings();
+    jobAntiAlias = antiAliasSettings();
+    workFrame = baseFrame;
+    publishTile(0, 0, imageWidth, imageHeight);
+    renderCancelled = false;
+    antialiasDone = false;
+    renderThread = std::thread(&ofApp::antialiasJob, this, renderMode);
+}
+
+//--------------------------------------------------------------
+// background anti-aliasing pass of workFrame, a copy of baseFrame
+//
+void ofApp::antialiasJob(RenderMode mode) {
+    antialiasPass(mode, workFrame, true);
+    if (!renderCancelled)
+        antialiasDone = true;
+}
+
+//--------------------------------------------------------------
+// Lighting changed on a finished frame: run phong again on the G-buffer, no
+// marching, into baseFrame. Shadow settings changes also re-cast the shadow
+// rays. The extra anti-aliasing rays saw the old lighting, so the
+// anti-aliasing pass starts over in the background.
+//
+void ofApp::reshadeRender() {
+    stopRender();
+    bool recastShadows = shadowSettings() != jobShadows;
+    updateLights();
+    updateMarchSettings();
+    jobLights = lightSettings();
+    jobShadows = shadowSettings();
+
+    float start = ofGetElapsedTimef();
+    bool wasVerbose = verbose;
+    verbose = false;
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        reshadeTile(x0, y0, x1, y1, baseFrame, recastShadows);
+    });
+    verbose = wasVerbose;
+    if (verbose)
+        cout << "re-shaded " << imageWidth << "x" << imageHeight << (recastShadows ? " with new shadows" : "")
+            << " in " << (ofGetElapsedTimef() - start) * 1000 << "ms" << endl;
+    startAntialias();
+}
+
+//--------------------------------------------------------------
+// Exposure or tone curve changed on a finished frame: the HDR frame is all
+// there, only the quantization runs again. An anti-aliasing pass it stops
+// starts over.
+//
+void ofApp::retoneRender() {
+    stopRender();
+    updateLights();
+    jobToneMap = toneMapSettings();
+    if (antialiasDone)
+        publishTile(0, 0, imageWidth, imageHeight);
+    else
+        startAntialias();
+}
+
+//--------------------------------------------------------------
+// phong from the G-buffer alone, tile rows y0..y1 like marchTile
+//
+void ofApp::reshadeTile(int x0, int y0, int x1, int y1, HdrImage& frame, bool recastShadows) {
+    for (int j = y0; j < y1; j++) {
+        int row = imageHeight - 1 - j;
+        for (int i = x0; i < x1; i++) {
+            GBufferTexel& texel = gbuffer.at(i, row);
+            if (texel.obj < 0) {
+                frame.set(i, row, glm::vec3(0));
+                continue;
+            }
+            if (recastShadows)
+                for (int l = 0; l < GBUFFER_LIGHTS && l + 1 < lights.size(); l++)
+                    texel.visibility[l] = lightVisibility(texel.p, texel.normal, l + 1);
+            frame.set(i, row, phong(texel.p, texel.normal, objectColor(texel.obj, texel.p),
+                scene[texel.obj]->specularColor, phongPower, texel.visibility));
+        }
+    }
+}
+
+//--------------------------------------------------------------
+// one ray per block x block pixels, filling the whole block with its colour
+//
+void ofApp::previewTile(int x0, int y0, int x1, int y1, HdrImage& frame, int block) const {
+    for (int by = y0; by < y1; by += block) {
+        for (int bx = x0; bx < x1; bx += block) {
+            HitRecord hit;
+            glm::vec3 color(0);
+            if (rayMarching(renderCam.getRay(float(bx) / imageWidth, float(by) / imageHeight), hit))
+                color = shadeRM(hit);
+            for (int j = by; j < std::min(by + block, y1); j++)
+                for (int i = bx; i < std::min(bx + block, x1); i++)
+                    frame.set(i, imageHeight - 1 - j, color);
+        }
+    }
+}
+
+//--------------------------------------------------------------
+// tone map a finished tile (render rows y0..y1, stored flipped) into the
+// display copy
+//
+void ofApp::publishTile(int x0, int y0, int x1, int y1) {
+    std::lock_guard<std::mutex> guard(displayLock);
+    toneMap(workFrame, displayPixels, toneMapping, x0, imageHeight - y1, x1, imageHeight - y0);
+    renderVersion++;
+}
+
+//--------------------------------------------------------------
+void ofApp::saveRender() {
+    if (!renderActive)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(displayLock);
+        image.setFromPixels(displayPixels);
+    }
+    image.save(outputPath);
+    cout << "saved " << outputPath << endl;
+}
+
+//--------------------------------------------------------------
+// everything the geometry of a render depends on, compared every frame to
+// restart the job
+//
+vector<float> ofApp::renderSettings() const {
+    vector<float> values = { (float)threadSlider, (float)strategySlider, (float)packetToggle, (float)coneToggle,
+        (float)cacheToggle, (float)cullToggle, (float)imageWidth, (float)imageHeight };
+    for (int i = 0; i < 3; i++) {
+        values.push_back(renderCam.position[i]);
+        values.push_back(renderCam.aim[i]);
+    }
+    return values;
+}
+
+//--------------------------------------------------------------
+// settings that only change the shading of a G-buffer texel
+//
+vector<float> ofApp::lightSettings() const {
+    return { (float)powerSlider, (float)ambientLightSlider, (float)lightIntensitySlider1,
+        (float)lightIntensitySlider2, (float)lightIntensitySlider3 };
+}
+
+vector<float> ofApp::shadowSettings() const {
+    return { (float)shadowToggle, (float)penumbraSlider };
+}
+
+vector<float> ofApp::antiAliasSettings() const {
+    return { (float)aaToggle, (float)aaSamplesSlider, (float)aaContrastSlider };
+}
+
+vector<float> ofApp::toneMapSettings() const {
+    return { (float)exposureSlider, (float)reinhardToggle };
+}
+
+//--------------------------------------------------------------
+// luminance (0..1) of an HDR colour as it will be displayed
+//
+float ofApp::displayLuminance(const glm::vec3& color) const {
+    return (0.299f * toneMapValue(color.x, toneMapping) + 0.587f * toneMapValue(color.y, toneMapping)
+        + 0.114f * toneMapValue(color.z, toneMapping)) / 255;
+}
+
+//--------------------------------------------------------------
+// largest channel difference of pixel (x, y) of two frames once tone mapped
+//
+int ofApp::displayDifference(const HdrImage& a, const HdrImage& b, int x, int y) const {
+    glm::vec3 p = a.get(x, y), q = b.get(x, y);
+    int diff = 0;
+    for (int c = 0; c < 3; c++)
+        diff = std::max(diff, abs((int)toneMapValue(p[c], toneMapping) - (int)toneMapValue(q[c], toneMapping)));
+    return diff;
+}
+
+//--------------------------------------------------------------
+// Anti-alias a finished one ray per pixel frame in place, using the G-buffer
+// of that frame. frame starts as a copy of baseFrame, which keeps the frame
+// without anti-aliasing so the pass can be run again with other settings.
+// With publish the tiles go to the display as they finish. Prints how many
+// rays it took against uniform supersampling.
+//
+void ofApp::antialiasPass(RenderMode mode, HdrImage& frame, bool publish) {
+    if (!antiAlias.enabled) {
+        if (publish)
+            publishTile(0, 0, imageWidth, imageHeight);
+        return;
+    }
+
+    std::atomic<long long> samples(0);
+    std::atomic<int> refined(0);
+    float start = ofGetElapsedTimef();
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        if (renderCancelled)
+            return;
+        int tileRefined = 0;
+        samples += antialiasTile(x0, y0, x1, y1, mode, baseFrame, frame, tileRefined);
+        refined += tileRefined;
+        if (publish)
+            publishTile(x0, y0, x1, y1);
+    });
+
+    if (verbose && !renderCancelled) {
+        double count = double(imageWidth) * imageHeight;
+        double perPixel = (count + samples) / count;
+        cout << "anti-aliasing: " << refined << " of " << (long long)count << " pixels refined ("
+            << 100 * refined / count << "%), " << perPixel << " rays per pixel against " << antiAlias.maxSamples
+            << " for uniform supersampling (" << antiAlias.maxSamples / perPixel << "x fewer), "
+            << (ofGetElapsedTimef() - start) * 1000 << "ms" << endl;
+    }
+}
+
+//--------------------------------------------------------------
+// the pixels of tile rows y0..y1 that needsAntiAlias() picks get rays
+// AA_BATCH at a time until their displayed luminance settles. The rays are
+// averaged in HDR. base is the one ray per pixel frame (neighbours are read
+// from it, never from frame, which other tiles are writing). Returns the rays
+// added, refined counts the pixels.
+//
+long long ofApp::antialiasTile(int x0, int y0, int x1, int y1, RenderMode mode, const HdrImage& base,
+    HdrImage& frame, int& refined) const {
+    long long added = 0;
+    for (int j = y0; j < y1; j++) {
+        int row = imageHeight - 1 - j;
+        for (int i = x0; i < x1; i++) {
+            if (!needsAntiAlias(i, row, base))
+                continue;
+            glm::vec3 sum = base.get(i, row);
+            float lum = displayLuminance(sum);
+            float lumSum = lum, lumSquares = lum * lum;
+            int n = 1;
+            while (n < antiAlias.maxSamples) {
+                for (int k = 0; k < AA_BATCH && n < antiAlias.maxSamples; k++, n++) {
+                    glm::vec3 c = pixelSample(mode, i, j, n);
+                    sum += c;
+                    lum = displayLuminance(c);
+                    lumSum += lum;
+                    lumSquares += lum * lum;
+                }
+                float mean = lumSum / n;
+                float variance = std::max(lumSquares / n - mean * mean, 0.0f);
+                if (sqrt(variance / n) < antiAlias.tolerance)
+                    break;
+            }
+            frame.set(i, row, sum / float(n));
+            added += n - 1;
+            refined++;
+        }
+    }
+    return added;
+}
+
+//--------------------------------------------------------------
+// x, y in image coordinates. true on a G-buffer edge to any of the 8
+// neighbours, or when the 3x3 luminance range is over the contrast threshold
+//
+bool ofApp::needsAntiAlias(int x, int y, const HdrImage& base) const {
+    const GBufferTexel& centre = gbuffer.at(x, y);
+    float low = 1, high = 0;
+    for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, imageHeight - 1); ny++) {
+        for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, imageWidth - 1); nx++) {
+            const GBufferTexel& texel = gbuffer.at(nx, ny);
+            if (texel.obj != centre.obj)
+                return true;
+            if (centre.obj >= 0 && glm::dot(texel.normal, centre.normal) < antiAlias.normalCos)
+                return true;
+            float lum = displayLuminance(base.get(nx, ny));
+            low = std::min(low, lum);
+            high = std::max(high, lum);
+        }
+    }
+    return high - low > antiAlias.contrast;
+}
+
+//--------------------------------------------------------------
+// Colour of ray n of render pixel (i, j). Ray 0 is the pixel's usual ray, the
+// others are spread over the pixel by the R2 low discrepancy sequence, so the
+// first n rays of every pixel are the same for the adaptive and the uniform
+// passes.
+//
+glm::vec3 ofApp::pixelSample(RenderMode mode, int i, int j, int n) const {
+    float ox = fmod(0.5f + n * 0.7548776662f, 1.0f) - 0.5f;
+    float oy = fmod(0.5f + n * 0.5698402910f, 1.0f) - 0.5f;
+    Ray ray = renderCam.getRay((i + ox) / imageWidth, (j + oy) / imageHeight);
+    if (mode == RENDER_TRACE)
+        return traceRay(ray);
+    HitRecord hit;
+    if (rayMarching(ray, hit))
+        return shadeRM(hit);
+    return glm::vec3(0);
+}
+
+//--------------------------------------------------------------
+// Adaptive against uniform anti-aliasing of the marched frame. The reference
+// is uniform supersampling with the maximum rays per pixel; uniform passes
+// with fewer rays are added until one has no more visibly different pixels
+// than the adaptive frame, which gives the rays uniform supersampling needs
+// for equal quality.
+//
+void ofApp::compareAntiAlias() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    bool usePackets = usePacketMarcher();
+    bool wasEnabled = antiAlias.enabled;
+    antiAlias.enabled = true;
+    gbuffer.allocate(imageWidth, imageHeight);
+
+    HdrImage single, adaptive;
+    single.allocate(imageWidth, imageHeight);
+    float start = ofGetElapsedTimef();
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        marchTile(x0, y0, x1, y1, single, usePackets, &gbuffer);
+    });
+    float singleTime = ofGetElapsedTimef() - start;
+    adaptive = single;
+    baseFrame = single;
+    start = ofGetElapsedTimef();
+    antialiasPass(RENDER_MARCH, adaptive, false);
+    float adaptiveTime = singleTime + ofGetElapsedTimef() - start;
+
+    auto uniform = [&](int samples, HdrImage& frame, float& seconds) {
+        frame.allocate(imageWidth, imageHeight);
+        float start = ofGetElapsedTimef();
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            for (int j = y0; j < y1; j++)
+                for (int i = x0; i < x1; i++) {
+                    glm::vec3 sum(0);
+                    for (int n = 0; n < samples; n++)
+                        sum += pixelSample(RENDER_MARCH, i, j, n);
+                    frame.set(i, imageHeight - 1 - j, sum / float(samples));
+                }
+        });
+            seconds = ofGetElapsedTimef() - start;
+    };
+    //pixels with a channel more than 8 off the reference. the mean difference
+    //is mostly rounding of smooth shading, edges are what shows
+    auto error = [&](const HdrImage& a, const HdrImage& b) {
+        int count = 0;
+        for (int y = 0; y < imageHeight; y++)
+            for (int x = 0; x < imageWidth; x++)
+                if (displayDifference(a, b, x, y) > 8)
+                    count++;
+        return count;
+    };
+
+    HdrImage reference, pixels;
+    float referenceTime, seconds;
+    uniform(antiAlias.maxSamples, reference, referenceTime);
+    int adaptiveError = error(adaptive, reference);
+    cout << "reference: uniform " << antiAlias.maxSamples << " rays per pixel, " << referenceTime << "s" << endl;
+    cout << "1 ray per pixel: " << error(single, reference) << " pixels off, " << singleTime << "s" << endl;
+    cout << "adaptive: " << adaptiveError << " pixels off, " << adaptiveTime << "s" << endl;
+    for (int samples = 2; samples < antiAlias.maxSamples; samples *= 2) {
+        uniform(samples, pixels, seconds);
+        int uniformError = error(pixels, reference);
+        cout << "uniform " << samples << " rays per pixel: " << uniformError << " pixels off, " << seconds << "s" << endl;
+        if (uniformError <= adaptiveError)
+            break;
+    }
+    antiAlias.enabled = wasEnabled;
+}
+
+//--------------------------------------------------------------
+bool ofApp::rayMarchLoop() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    bool usePackets = usePacketMarcher();
+
+    workFrame.allocate(imageWidth, imageHeight);
+    std::atomic<long long> totalSteps(0);
+#ifdef RAYMARCH_STATS
+    stats.reset(imageWidth, imageHeight, march.maxSteps);
+    float start = ofGetElapsedTimef();
+#endif
+    //anti-aliasing finds its edges in the G-buffer
+    GBuffer* edges = nullptr;
+    if (antiAlias.enabled) {
+        gbuffer.allocate(imageWidth, imageHeight);
+        edges = &gbuffer;
+    }
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        totalSteps += marchTile(x0, y0, x1, y1, workFrame, usePackets, edges);
+    });
+    if (verbose)
+        cout << "average scene evaluations per pixel: " << double(totalSteps) / (imageWidth * imageHeight) << endl;
+    if (antiAlias.enabled) {
+        baseFrame = workFrame;
+        antialiasPass(RENDER_MARCH, workFrame, false);
+    }
+    image.allocate(imageWidth, imageHeight, OF_IMAGE_COLOR);
+    toneMap(workFrame, image.getPixels(), toneMapping);
+#ifdef RAYMARCH_STATS
+    stats.seconds = ofGetElapsedTimef() - start;
+    stats.threads = getPool().size();
+    stats.save(outputPath);
+#endif
+
+    image.update();
+    return image.save(outputPath);
+}
+
+//--------------------------------------------------------------
+// render straight to disk, stripRows image rows at a time: a finished strip
+// goes to the StripWriter, whose thread encodes it while the next one
+// renders, so neither the float frame nor the 8 bit image of the whole
+// picture ever exists. adaptive anti-aliasing needs the G-buffer of the
+// whole frame and is left out.
+//
+bool ofApp::renderStrips(RenderMode mode, const string& path, int stripRows) {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    bool usePackets = usePacketMarcher();
+
+    StripWriter writer;
+    if (!writer.open(ofToDataPath(path), imageWidth, imageHeight, toneMapping)) {
+        cout << "cannot write " << path << " (strips go to .png, .ppm or .pfm)" << endl;
+        return false;
+    }
+    if (antiAlias.enabled && verbose)
+        cout << "no anti-aliasing in strip renders" << endl;
+
+    int strips = (imageHeight + stripRows - 1) / stripRows;
+    std::atomic<long long> totalSteps(0);
+    bool wasVerbose = verbose;
+    verbose = false;
+    int previousPos = -1;
+    float start = ofGetElapsedTimef();
+    for (int s = 0; s < strips; s++) {
+        int n = writer.bottomUp() ? strips - 1 - s : s;
+        int top = n * stripRows;
+        int bottom = std::min(top + stripRows, imageHeight);
+        HdrImage strip;
+        strip.allocate(imageWidth, bottom - top, top);
+        //image rows top..bottom are render rows imageHeight - bottom .. imageHeight - top
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            if (mode == RENDER_TRACE)
+                traceTile(x0, y0, x1, y1, strip);
+            else
+                totalSteps += marchTile(x0, y0, x1, y1, strip, usePackets);
+        }, imageHeight - bottom, imageHeight - top);
+        writer.write(std::move(strip));
+        if (wasVerbose)
+            progressBar(float(s + 1) / strips, previousPos);
+    }
+    bool saved = writer.close();
+    verbose = wasVerbose;
+    float seconds = ofGetElapsedTimef() - start;
+
+    if (verbose) {
+        cout << "\n" << imageWidth << "x" << imageHeight << " in " << strips << " strips, " << seconds << "s on "
+            << getPool().size() << " threads, "
+            << (float(imageWidth) * imageHeight) / (seconds * 1e6f) << " Mrays/s" << endl;
+        if (mode == RENDER_MARCH)
+            cout << "average scene evaluations per pixel: " << double(totalSteps) / (double(imageWidth) * imageHeight) << endl;
+    }
+    if (!saved)
+        cout << "writing " << path << " failed" << endl;
+    return saved;
+}
+
+//--------------------------------------------------------------
+// colour of a surface point found by the marcher. with a texel the inputs
+// of the shading are kept there for reshadeTile
+//
+glm::vec3 ofApp::shadeRM(const HitRecord& hit, GBufferTexel* texel) const {
+    ofColor diffuseCol = objectColor(hit.obj, hit.p);
+    ofColor spectralCol = scene[hit.obj]->specularColor;
+    glm::vec3 normal = getNormalRM(hit);
+    if (!texel)
+        return phong(hit.p, normal, diffuseCol, spectralCol, phongPower);
+    texel->set(hit.p, normal, hit.obj);
+    for (int l = 0; l < GBUFFER_LIGHTS && l + 1 < lights.size(); l++)
+        texel->visibility[l] = lightVisibility(hit.p, normal, l + 1);
+    return phong(hit.p, normal, diffuseCol, spectralCol, phongPower, texel->visibility);
+}
+
+//--------------------------------------------------------------
+// march one tile. with usePackets every tile row is handed to the SIMD
+// packet marcher, otherwise each pixel is marched on its own, against the
+// primitives of its block with march.tileCulling.
+// returns the number of march steps taken. gbuffer (optional) receives the
+// shading inputs of every pixel.
+//
+long long ofApp::marchTile(int x0, int y0, int x1, int y1, HdrImage& frame, bool usePackets, GBuffer* gbuffer) const {
     float widthIncrament = 1.0 / imageWidth;
     float heightIncrament = 1.0 / imageHeight;
+    int count = x1 - x0;
+    vector<float> dx(count), dy(count), dz(count), px(count), py(count), pz(count);
+    vector<int> hit(count), steps(count);
+    vector<HitRecord> records(count);
+    long long totalSteps = 0;
+
+    //a static scene marches its own distance function, which neither the
+    //culled primitive lists nor the cone depths (runtime sceneSDF) would save
+    //any work for
+    bool runtimeScene = !staticMarcher;
+    TileCuller culler;
+    const TileCuller* cull = nullptr;
+    if (march.tileCulling && !usePackets && runtimeScene) {
+        glm::vec3 origin = renderCam.view.toWorld(0, 0);
+        culler.build(compiled, march, renderCam.position, origin, renderCam.view.toWorld(widthIncrament, 0) - origin,
+            renderCam.view.toWorld(0, heightIncrament) - origin, x0, y0, x1, y1);
+        cull = &culler;
+#ifdef RAYMARCH_STATS
+        stats.cullTests += culler.tests;
+#endif
+    }
 
-    //loop through each pixel
-    for (int i = 1; i <= imageWidth; i++) {
-        for (int j = 1; j <= imageHeight; j++) {
-            renderRay = renderCam.getRay(widthIncrament * (i - 1), heightIncrament * (j - 1));
-            hit = rayMarching(renderRay, p);
-            if (hit) {
-                int objIndex;
-                sceneSDF(p, objIndex);
-                ofColor diffuseCol = scene[objIndex]->diffuseColor;
-                ofColor spectralCol = scene[objIndex]->specularColor;
-                ofColor pShading = phong(p, getNormalRM(p), diffuseCol, spectralCol, powerSlider);
-                image.setColor(i, imageHeight - j, pShading);
+    vector<float> startT(count * (y1 - y0), 0.0f);
+    if (march.conePrepass && runtimeScene) {
+        long long coneSteps = conePrepass(x0, y0, x1, y1, startT, cull);
+        totalSteps += coneSteps;
+#ifdef RAYMARCH_STATS
+        stats.coneEvaluations += coneSteps;
+#endif
+    }
+#ifdef RAYMARCH_STATS
+    vector<long long> evaluations(count);
+#endif
+
+    for (int j = y0; j < y1; j++) {
+        const float* rowStart = &startT[(j - y0) * count];
+        for (int i = x0; i < x1; i++) {
+            Ray renderRay = renderCam.getRay(widthIncrament * i, heightIncrament * j);
+            if (usePackets) {
+                dx[i - x0] = renderRay.d.x;
+                dy[i - x0] = renderRay.d.y;
+                dz[i - x0] = renderRay.d.z;
+                continue;
             }
-            else
-                image.setColor(i, imageHeight - j, ofColor::black);
+#ifdef RAYMARCH_STATS
+            evaluations[i - x0] = -sdfEvaluations;
+#endif
+            hit[i - x0] = rayMarching(renderRay, records[i - x0], rowStart[i - x0], cull ? cull->at(i, j) : nullptr);
+            steps[i - x0] = records[i - x0].steps;
+#ifdef RAYMARCH_STATS
+            evaluations[i - x0] += sdfEvaluations;
+#endif
+        }
+        if (usePackets) {
+            packetMarcher.march(march, renderCam.position, count, dx.data(), dy.data(), dz.data(), rowStart,
+                px.data(), py.data(), pz.data(), hit.data(), steps.data());
+            for (int i = 0; i < count; i++) {
+                records[i].p = glm::vec3(px[i], py[i], pz[i]);
+                records[i].t = glm::length(records[i].p - renderCam.position);
+                records[i].steps = steps[i];
+            }
+        }
+
+        for (int i = x0; i < x1; i++) {
+            totalSteps += steps[i - x0];
+#ifdef RAYMARCH_STATS
+            //packets do not go through sceneSDF, their steps are the evaluations
+            if (usePackets)
+                evaluations[i - x0] = steps[i - x0];
+            evaluations[i - x0] -= sdfEvaluations;
+#endif
+            //the packet kernel does not track objects, hits look theirs up once
+            if (usePackets && hit[i - x0])
+                records[i - x0].dist = sceneSDF(records[i - x0].p, records[i - x0].obj);
+            GBufferTexel* texel = gbuffer ? &gbuffer->at(i, imageHeight - 1 - j) : nullptr;
+            if (hit[i - x0])
+                frame.set(i, imageHeight - 1 - j, shadeRM(records[i - x0], texel));
+            else {
+                frame.set(i, imageHeight - 1 - j, glm::vec3(0));
+                if (texel)
+                    texel->obj = -1;
+            }
+#ifdef RAYMARCH_STATS
+            evaluations[i - x0] += sdfEvaluations;
+            //a miss on the very last step also counts as out of steps
+            MarchEnd end = hit[i - x0] ? MARCH_END_HIT : (steps[i - x0] >= march.maxSteps) ? MARCH_END_STEPS : MARCH_END_MISS;
+            stats.record(i, imageHeight - 1 - j, steps[i - x0], (int)evaluations[i - x0], end);
+#endif
+        }
+    }
+    return totalSteps;
+}
+
+//--------------------------------------------------------------
+// render the frame with the scalar and the packet marcher, report the
+// speedup and how far the two images are apart. marching is timed on its
+// own (no shading) so the number is the marcher's Mrays/s.
+//
+void ofApp::comparePacketMarch() {
+    if (!packetMarcher.isAvailable()) {
+        cout << "no SIMD packet marcher on this CPU" << endl;
+        return;
+    }
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    if (!packetMarcher.fitsScene()) {
+        cout << "the packet marcher does not handle this scene's repetition" << endl;
+        return;
+    }
+
+    HdrImage scalarFrame, packetFrame;
+    scalarFrame.allocate(imageWidth, imageHeight);
+    packetFrame.allocate(imageWidth, imageHeight);
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        marchTile(x0, y0, x1, y1, scalarFrame, false);
+    });
+    renderTiles([&](int x0, int y0, int x1, int y1) {
+        marchTile(x0, y0, x1, y1, packetFrame, true);
+    });
+
+    int differing = 0, maxDiff = 0;
+    for (int y = 0; y < imageHeight; y++) {
+        for (int x = 0; x < imageWidth; x++) {
+            int diff = displayDifference(scalarFrame, packetFrame, x, y);
+            if (diff > 0)
+                differing++;
+            maxDiff = std::max(maxDiff, diff);
         }
-        cout << '.';
     }
-    cout << "\n done";
-    image.save("Output.png");
+
+    //march only, single thread, same rays
+    vector<float> dx(imageWidth), dy(imageWidth), dz(imageWidth), px(imageWidth), py(imageWidth), pz(imageWidth);
+    vector<int> hit(imageWidth), steps(imageWidth);
+    float scalarTime = 0, packetTime = 0;
+    for (int j = 0; j < imageHeight; j += 8) {
+        for (int i = 0; i < imageWidth; i++) {
+            Ray r = renderCam.getRay(float(i) / imageWidth, float(j) / imageHeight);
+            dx[i] = r.d.x; dy[i] = r.d.y; dz[i] = r.d.z;
+        }
+        float start = ofGetElapsedTimef();
+        glm::vec3 p;
+        for (int i = 0; i < imageWidth; i++)
+            rayMarching(Ray(renderCam.position, glm::vec3(dx[i], dy[i], dz[i])), p);
+        scalarTime += ofGetElapsedTimef() - start;
+        start = ofGetElapsedTimef();
+        packetMarcher.march(march, renderCam.position, imageWidth, dx.data(), dy.data(), dz.data(), nullptr,
+            px.data(), py.data(), pz.data(), hit.data(), steps.data());
+        packetTime += ofGetElapsedTimef() - start;
+    }
+    float rays = imageWidth * ((imageHeight + 7) / 8);
+    cout << PacketMarcher::levelName(packetMarcher.level) << ": " << differing << " of " << imageWidth * imageHeight
+        << " pixels differ, max channel difference " << maxDiff << "\n"
+        << "  scalar " << rays / (scalarTime * 1e6f) << " Mrays/s, packets " << rays / (packetTime * 1e6f)
+        << " Mrays/s (" << scalarTime / packetTime << "x)" << endl;
 }
 
 //--------------------------------------------------------------
-glm::vec3 ofApp::getNormalRM(const glm::vec3& p) {
+// render the frame with and without the cone pre-pass, report scene
+// evaluations per pixel (pre-pass included), time and how many pixels differ
+//
+void ofApp::compareConePrepass() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    bool selected = march.conePrepass;
+    bool usePackets = usePacketMarcher();
+
+    HdrImage results[2];
+    for (int pass = 0; pass < 2; pass++) {
+        march.conePrepass = (pass == 1);
+        results[pass].allocate(imageWidth, imageHeight);
+        std::atomic<long long> evaluations(0);
+        float start = ofGetElapsedTimef();
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            evaluations += marchTile(x0, y0, x1, y1, results[pass], usePackets);
+        });
+        cout << (pass ? "cone pre-pass: " : "no pre-pass:   ") << double(evaluations) / (imageWidth * imageHeight)
+            << " evaluations/pixel, " << ofGetElapsedTimef() - start << "s" << endl;
+    }
+    //silhouette pixels can flip: samples land at different t along the ray
+    int changed = 0;
+    for (int y = 0; y < imageHeight; y++)
+        for (int x = 0; x < imageWidth; x++)
+            if (displayDifference(results[0], results[1], x, y) > 8)
+                changed++;
+    cout << changed << " pixels changed by more than 8" << endl;
+    march.conePrepass = selected;
+}
+
+//--------------------------------------------------------------
+// render the frame with and without tile culling, report scene evaluations
+// per pixel, time and how many pixels differ
+//
+void ofApp::compareTileCulling() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    bool selected = march.tileCulling;
+
+    HdrImage results[2];
+    for (int pass = 0; pass < 2; pass++) {
+        march.tileCulling = (pass == 1);
+        bool usePackets = usePacketMarcher();
+        results[pass].allocate(imageWidth, imageHeight);
+        std::atomic<long long> evaluations(0);
+        float start = ofGetElapsedTimef();
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            evaluations += marchTile(x0, y0, x1, y1, results[pass], usePackets);
+        });
+        cout << (pass ? "tile culling: " : "whole scene:  ") << double(evaluations) / (imageWidth * imageHeight)
+            << " evaluations/pixel, " << ofGetElapsedTimef() - start << "s" << endl;
+    }
+    //hits land anywhere within the threshold, silhouettes can flip
+    int changed = 0;
+    for (int y = 0; y < imageHeight; y++)
+        for (int x = 0; x < imageWidth; x++)
+            if (displayDifference(results[0], results[1], x, y) > 8)
+                changed++;
+    cout << changed << " pixels changed by more than 8" << endl;
+    march.tileCulling = selected;
+}
+
+//--------------------------------------------------------------
+// render the frame with every MarchStrategy and print the average number of
+// steps per pixel, the time and how many pixels changed hit / miss state
+// compared to MARCH_BASIC
+//
+void ofApp::compareMarchStrategies() {
+    updateLights();
+    updateMarchSettings();
+    compileScene();
+    MarchStrategy selected = march.strategy;
+    const char* names[] = { "basic", "footprint", "relaxed" };
+
+    vector<char> basicHits(imageWidth * imageHeight);
+    for (int s = MARCH_BASIC; s <= MARCH_RELAXED; s++) {
+        march.strategy = MarchStrategy(s);
+        std::atomic<long long> totalSteps(0);
+        std::atomic<int> changed(0);
+        float start = ofGetElapsedTimef();
+        renderTiles([&](int x0, int y0, int x1, int y1) {
+            long long tileSteps = 0;
+            int tileChanged = 0;
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    HitRecord record;
+                    bool hit = rayMarching(renderCam.getRay(float(i) / imageWidth, float(j) / imageHeight), record);
+                    tileSteps += record.steps;
+                    if (s == MARCH_BASIC)
+                        basicHits[j * imageWidth + i] = hit;
+                    else if (basicHits[j * imageWidth + i] != hit)
+                        tileChanged++;
+                }
+            }
+            totalSteps += tileSteps;
+            changed += tileChanged;
+        });
+        float seconds = ofGetElapsedTimef() - start;
+        cout << names[s] << ": " << double(totalSteps) / (imageWidth * imageHeight) << " steps/pixel, "
+            << seconds << "s, " << changed << " pixels changed hit/miss" << endl;
+    }
+    march.strategy = selected;
+}
+
+//--------------------------------------------------------------
+// Scene normal by tetrahedral differences: four evaluations at the corners of
+// a tetrahedron around p. Fallback for objects without an analytic gradient.
+//
+glm::vec3 ofApp::getNormalRM(const glm::vec3& p) const {
     float eps = .01;
     int objIndex;
-    float dp = sceneSDF(p, objIndex);
-    glm::vec3 n(dp - sceneSDF(glm::vec3(p.x - eps, p.y, p.z), objIndex),
-        dp - sceneSDF(glm::vec3(p.x, p.y - eps, p.z), objIndex),
-        dp - sceneSDF(glm::vec3(p.x, p.y, p.z - eps), objIndex));
+    glm::vec3 a(1, -1, -1), b(-1, -1, 1), c(-1, 1, -1), d(1, 1, 1);
+    glm::vec3 n = a * sceneSDF(p + eps * a, objIndex) + b * sceneSDF(p + eps * b, objIndex)
+        + c * sceneSDF(p + eps * c, objIndex) + d * sceneSDF(p + eps * d, objIndex);
     return glm::normalize(n);
 }
 
-float ofApp::opRep(const glm::vec3& p, SceneObject* obj) {
-    glm::vec3 c(3);
-    glm::vec3 q = glm::mod(p + 0.5 * c, c) - 0.5 * c;
-    return obj->sdf(q);
+//--------------------------------------------------------------
+// normal at a hit: gradient of the winning object alone, no scene evaluation
+//
+glm::vec3 ofApp::getNormalRM(const HitRecord& hit) const {
+    float dist;
+    glm::vec3 grad;
+    if (compiled.objectSdfGradient(hit.obj, hit.p, dist, grad))
+        return glm::normalize(grad);
+    return getNormalRM(hit.p);
+}
+
+//--------------------------------------------------------------
+// the object's repetition, nearest copy only (CompiledScene::repeatedSdf
+// also checks the neighbour cells)
+//
+float ofApp::opRep(const glm::vec3& p, const SceneObject* obj) const {
+    const Repetition& rep = obj->repetition;
+    if (!rep.enabled())
+        return obj->sdf(p);
+    glm::vec3 cell;
+    for (int a = 0; a < 3; a++) {
+        float nearest = (rep.period[a] > 0) ? floor((p[a] - obj->position[a]) / rep.period[a] + 0.5f) : 0;
+        cell[a] = ofClamp(nearest, rep.firstCell(a), rep.lastCell(a));
+    }
+    glm::vec3 q = p - cell * rep.period;
+    if (rep.sizeJitter <= 0)
+        return obj->sdf(q);
+    float scale = rep.scale(glm::ivec3(cell));
+    return scale * obj->sdf(obj->position + (q - obj->position) / scale);
+}
+
+//--------------------------------------------------------------
+// diffuse colour of the object at p, varied per copy for repeated objects
+//
+ofColor ofApp::objectColor(int objIndex, const glm::vec3& p) const {
+    const Repetition& rep = scene[objIndex]->repetition;
+    ofColor color = scene[objIndex]->diffuseColor;
+    glm::ivec3 cell;
+    if (rep.colorJitter <= 0 || !compiled.objectCell(objIndex, p, cell))
+        return color;
+    for (int c = 0; c < 3; c++)
+        color[c] = ofLerp(color[c], 255 * Repetition::random(cell, c + 1), rep.colorJitter);
+    return color;
+}
+
+//--------------------------------------------------------------
+// rebuild the flat scene representation from the scene objects
+//
+void ofApp::compileScene() {
+    compiled.clear();
+    for (int i = 0; i < scene.size(); i++) {
+        scene[i]->updateTransform();
+        scene[i]->compile(compiled, i);
+        compiled.repetitions.push_back(scene[i]->repetition);
+    }
+    compiled.build();
+    packetMarcher.build(compiled);
+
+    if (!march.distanceCache)
+        return;
+    Bounds region = distanceCacheRegion();
+    if (distanceCache.matches(compiled, region))
+        return;
+    distanceCache.build(compiled, region, march.cacheCells, getPool());
+    if (verbose)
+        cout << "distance cache: " << distanceCache.brickCount << " bricks, "
+            << distanceCache.memoryBytes() / (1024.0f * 1024.0f) << " MB, baked in " << distanceCache.bakeSeconds << "s" << endl;
+}
+
+//--------------------------------------------------------------
+// the box the distance cache covers: the scene box (a little larger, so rays
+// clipped to it start inside), or where the scene is unbounded the space
+// within two march.maxDistance of the origin
+//
+Bounds ofApp::distanceCacheRegion() const {
+    Bounds region;
+    if (compiled.bounded) {
+        glm::vec3 pad = 0.01f * (compiled.bounds.max - compiled.bounds.min) + march.hitThreshold;
+        region.min = compiled.bounds.min - pad;
+        region.max = compiled.bounds.max + pad;
+    }
+    else {
+        glm::vec3 reach(2 * march.maxDistance);
+        region.min = -reach;
+        region.max = reach;
+    }
+    return region;
+}
+
+//--------------------------------------------------------------
+// packets test every primitive, once the scene has a BVH (or repetition the
+// kernel cannot fold) the scalar path wins. only the scalar path steps
+// through the distance cache and marches culled tiles
+//
+bool ofApp::usePacketMarcher() const {
+    return packetToggle && packetMarcher.isAvailable() && packetMarcher.fitsScene() && !march.distanceCache
+        && !march.tileCulling && !staticMarcher;
+}
+
+//--------------------------------------------------------------
+float ofApp::sceneSDF(const glm::vec3 p, int& objIndex) const {
+#ifdef RAYMARCH_STATS
+    sdfEvaluations++;
+#endif
+    return compiled.sdf(p, objIndex);
+}
+
+//--------------------------------------------------------------
+// closest of the primitives of a culled tile block
+//
+float ofApp::sceneSDF(const glm::vec3& p, int& objIndex, const PrimSpan& prims) const {
+#ifdef RAYMARCH_STATS
+    sdfEvaluations++;
+#endif
+    return compiled.sdf(prims.prims, prims.count, p, objIndex);
 }
 
 //--------------------------------------------------------------
-float ofApp::sceneSDF(const glm::vec3 p, int& objIndex) {
+// distance a march may step: the baked lower bound while that is above
+// both the cache's exactBelow and the hit threshold, otherwise the exact
+// distance of the scene, or of prims when the tile was culled. objIndex is
+// only set by exact evaluations, and only those can end a march with a hit
+//
+float ofApp::marchSDF(const glm::vec3& p, int& objIndex, float threshold, const PrimSpan* prims) const {
+    if (march.distanceCache) {
+        float bound = distanceCache.lowerBound(p);
+        if (bound > distanceCache.exactBelow && bound > threshold)
+            return bound;
+    }
+    return prims ? sceneSDF(p, objIndex, *prims) : sceneSDF(p, objIndex);
+}
+
+//--------------------------------------------------------------
+// original per object path, virtual sdf() through opRep. kept for comparison
+//
+float ofApp::sceneSDFVirtual(const glm::vec3 p, int& objIndex) const {
     float closestDist = INFINITY;
     float tempDist;
     for (int i = 0; i < scene.size(); i++) {
@@ -365,11 +2044,48 @@ float ofApp::sceneSDF(const glm::vec3 p, int& objIndex) {
 }
 
 //--------------------------------------------------------------
-void ofApp::dragEvent(ofDragInfo dragInfo) {
+// time scene evaluations through the virtual objects and the flat scene
+// at the same random points and print evaluations/sec for both
+//
+void ofApp::sdfThroughput() {
+    compileScene();
+    const int COUNT = 1 << 20;
+    vector<glm::vec3> points(COUNT);
+    for (int i = 0; i < COUNT; i++)
+        points[i] = glm::vec3(ofRandom(-5, 5), ofRandom(-5, 5), ofRandom(-5, 5));
 
+    int objIndex;
+    float sum = 0;     // keeps the optimizer from dropping the loops
+    float start = ofGetElapsedTimef();
+    for (int i = 0; i < COUNT; i++)
+        sum += sceneSDFVirtual(points[i], objIndex);
+    float virtualTime = ofGetElapsedTimef() - start;
+
+    start = ofGetElapsedTimef();
+    for (int i = 0; i < COUNT; i++)
+        sum += sceneSDF(points[i], objIndex);
+    float flatTime = ofGetElapsedTimef() - start;
+
+    cout << scene.size() << " objects, " << COUNT << " evaluations (" << sum << ")\n"
+        << "  virtual: " << COUNT / (virtualTime * 1e6f) << " M evals/s\n"
+        << "  flat:    " << COUNT / (flatTime * 1e6f) << " M evals/s" << endl;
 }
 
-ofColor ofApp::lambert(const glm::vec3& p, const glm::vec3& n, const ofColor diffuse) {
+//--------------------------------------------------------------
+// scene files (.txt) replace the scene and are watched from then on, other
+// files are read as a mesh
+//
+void ofApp::dragEvent(ofDragInfo dragInfo) {
+    if (dragInfo.files.empty())
+        return;
+    string path = dragInfo.files[0];
+    if (ofToLower(ofFilePath::getFileExt(path)) == "txt")
+        loadScene(path);
+    else
+        setupMeshScene(path);
+}
+
+ofColor ofApp::lambert(const glm::vec3& p, const glm::vec3& n, const ofColor diffuse) const {
     float lambertVal = 0;
     float diffuseCoefficient = 0.35;
     float r;
@@ -389,47 +2105,71 @@ ofColor ofApp::lambert(const glm::vec3& p, const glm::vec3& n, const ofColor dif
     return diffuse * lambertVal;
 }
 
-ofColor ofApp::phong(const glm::vec3& p, const glm::vec3& norm, const ofColor diffuse,
-    const ofColor specular, float power) {
-    //color in black, using addative process to build the image color.
-    ofColor retColor = 0;
-    float r, tempVal, specCoeff = 1, diffCoeff = 0.35, ambiCoeff = 1;
-    //   cout << "before: " << p << " n: " << norm << "  after: " << p + (0.001 * norm) << endl;
-    for (int i = 1; i < lights.size(); i++) {
-        //lifted point away from surface for a small amount
-        Ray pointToLight(p + (0.1 * norm), glm::normalize(lights[i].position - p));
-
-        //if (!inShadow(pointToLight)) {
-            //         retColor += lambert(p, norm, diffuse);
-            r = glm::length(lights[i].position - p);
-            //cosAngle part of lambart
-            tempVal = glm::dot(norm, lights[i].position);
-            //max between dot value and 0
-            if (0 > tempVal)
-                tempVal = 0;
-            //lambart shading
-            retColor += diffuse * (diffCoeff * ((lights[i].intensity / (r * r)) * tempVal));
-
-            //max between 0 and dot value part of phong
-            tempVal = glm::dot(norm, glm::normalize((lights[i].position - p) + (renderCam.position - p)));
-            if (0 > tempVal)
-                tempVal = 0;
-            //         cout << tempVal << endl;
-                     //phong shading
-            retColor += specular * (specCoeff * (lights[i].intensity / (r * r)) * glm::pow(tempVal, power));
-            //ambient lighting
-            retColor += ambiCoeff * lights[0].intensity;
-        //}
-    }
-
-    return retColor;
-}
-
-bool ofApp::inShadow(Ray r) {
-    glm::vec3 p, n;
-    for (int i = 0; i < scene.size(); i++) {
-        if (rayMarching(r, p))
-            return true;
+//--------------------------------------------------------------
+// Phong shading of surface point p in HDR: the lights' diffuse and specular
+// terms come from shadeLights on lightPack, the ambient light is added once
+// per point light as it always was. Nothing is clamped here, see toneMap().
+//
+glm::vec3 ofApp::phong(const glm::vec3& p, const glm::vec3& norm, const ofColor diffuse,
+    const ofColor specular, float power, const float* visibilities) const {
+    float specCoeff = 1, diffCoeff = 0.35, ambiCoeff = 1;
+
+    //shadows from the G-buffer when given, cast here otherwise
+    float visibility[MAX_SHADED_LIGHTS];
+    for (int i = 0; i < lightPack.padded(); i++) {
+        if (i >= lightPack.count)
+            visibility[i] = 1;
+        else
+            visibility[i] = (visibilities && i < GBUFFER_LIGHTS) ? visibilities[i] : lightVisibility(p, norm, i + 1);
     }
-    return false;
+
+    float diffuseLight, specularLight;
+    shadeLights(lightPack, p, norm, renderCam.position, power, visibility, diffuseLight, specularLight);
+    glm::vec3 diffuseColor(diffuse.r, diffuse.g, diffuse.b), specularColor(specular.r, specular.g, specular.b);
+    return diffuseColor * (diffCoeff * diffuseLight) + specularColor * (specCoeff * specularLight)
+        + glm::vec3(ambiCoeff * lights[0].intensity * lightPack.count);
+}
+
+//--------------------------------------------------------------
+// shadow term of light i at surface point p: a shadow ray lifted away from
+// the surface for a small amount, only when the light adds something here
+//
+float ofApp::lightVisibility(const glm::vec3& p, const glm::vec3& norm, int i) const {
+    if (!march.shadows)
+        return 1;
+    bool diffuseLit = glm::dot(norm, lights[i].position) > 0;
+    bool specularLit = glm::dot(norm, glm::normalize((lights[i].position - p) + (renderCam.position - p))) > 0;
+    if (!diffuseLit && !specularLit)
+        return 1;
+    return shadowRay(p + march.shadowBias * norm, lights[i].position);
+}
+
+//--------------------------------------------------------------
+// Visibility of lightPos from origin: 0 in shadow, 1 fully lit. Sphere traces
+// towards the light only as far as the light (and the scene box) and stops at
+// the first occluder. On the way min(k * h / t) measures how close the ray
+// passed by something, which gives the penumbra (k = march.penumbra, larger
+// is harder); once that is dark enough the march stops too.
+//
+float ofApp::shadowRay(const glm::vec3& origin, const glm::vec3& lightPos) const {
+    glm::vec3 toLight = lightPos - origin;
+    float lightDist = glm::length(toLight);
+    glm::vec3 d = toLight / lightDist;
+    float tNear, tFar;
+    if (!compiled.clipRay(origin, d, tNear, tFar))
+        return 1;
+    float tEnd = std::min(lightDist, tFar);
+    float t = std::max(tNear, march.hitThreshold);
+    float visibility = 1;
+    int objIndex;
+    for (int i = 0; i < march.shadowMaxSteps && t < tEnd; i++) {
+        float h = sceneSDF(origin + d * t, objIndex);
+        if (h < march.hitThreshold)
+            return 0;
+        visibility = std::min(visibility, march.penumbra * h / t);
+        if (visibility < 0.01f)
+            return 0;
+        t += h;
+    }
+    return visibility;
 }
@@ -1,9 +1,21 @@
 #pragma once
 
 #include "ofMain.h"
-#include <glm/gtx/intersect.hpp>
 #include "glm/gtx/euler_angles.hpp"
 #include "ofxGui.h"
+#include "ThreadPool.h"
+#include "CompiledScene.h"
+#include "PacketMarch.h"
+#include "MarchStats.h"
+#include "Shading.h"
+#include "HdrImage.h"
+#include "StripWriter.h"
+#include "DistanceCache.h"
+#include "Csg.h"
+#include "TileCull.h"
+#include "TriMesh.h"
+#include "SceneFile.h"
+#include "StaticScene.h"
 
 //  General Purpose Ray class 
 //
@@ -19,12 +31,54 @@ public:
 	glm::vec3 p, d;
 };
 
+//  Shading inputs of one pixel, kept so lighting changes can re-run phong
+//  without marching again (ofApp::reshadeTile). obj -1 is background.
+//
+static const int GBUFFER_LIGHTS = 3;     // shadow terms kept for the first point lights
+
+struct GBufferTexel {
+	glm::vec3 p;
+	glm::vec3 normal;
+	int obj = -1;
+	float visibility[GBUFFER_LIGHTS];
+
+	void set(const glm::vec3& p, const glm::vec3& normal, int obj) { this->p = p; this->normal = normal; this->obj = obj; }
+};
+
+struct GBuffer {
+	void allocate(int w, int h) { width = w; height = h; texels.assign(w * h, GBufferTexel()); }
+	GBufferTexel& at(int x, int y) { return texels[y * width + x]; }   // image coordinates
+	const GBufferTexel& at(int x, int y) const { return texels[y * width + x]; }
+
+	int width = 0, height = 0;
+	vector<GBufferTexel> texels;
+};
+
+//  Adaptive anti-aliasing (ofApp::antialiasPass). After the one ray per pixel
+//  pass, pixels on an edge in the G-buffer (object or background change, a
+//  crease in the normals) or with a high luminance range over their 3x3
+//  neighbours get more rays, a batch at a time, until the standard error of
+//  their luminance drops below tolerance or maxSamples is reached.
+//
+struct AntiAliasSettings {
+	bool enabled = false;
+	int maxSamples = 16;      // per pixel, including the first ray
+	float contrast = 0.1;     // neighbour luminance range (0..1) that asks for more rays
+	float normalCos = 0.9;    // neighbouring normals less alike than this are an edge
+	float tolerance = 0.01;   // standard error of the pixel luminance (0..1) to stop at
+};
+
 //  Base class for any renderable object in the scene
 //
 class SceneObject {
 public:
 	virtual void draw() = 0;    // pure virtual funcs - must be overloaded
-	virtual bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) { cout << "SceneObject::intersect" << endl; return false; }
+	//  closest hit of the ray with t in (tMin, tMax) and the normal there.
+	//  only objects with analytic() = true compute it, the others are sphere
+	//  traced through their flat scene primitive (ofApp::closestHit)
+	virtual bool analytic() const { return false; }
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const { return false; }
+	virtual ~SceneObject() {}
 
 	// any data common to all scene objects goes here
 	glm::vec3 position = glm::vec3(0, 0, 0);
@@ -35,7 +89,13 @@ public:
 	ofColor specularColor = ofColor::lightGray;
 
 	//rayMarching stuff
-	virtual float sdf(const glm::vec3& p) { cout << "SceneObject::sdf" << endl; return 0; }
+	virtual float sdf(const glm::vec3& p) const { cout << "SceneObject::sdf" << endl; return 0; }
+	//  append this object's parameters to the flat scene, index is its slot in ofApp::scene
+	virtual void compile(CompiledScene& out, int index) const { }
+	//  refresh cached data after position / rotation edits (see TransformedObject)
+	virtual void updateTransform() { }
+	//  copies of the object over a grid of cells, ray marcher only
+	Repetition repetition;
 
 };
 
@@ -45,9 +105,9 @@ class Sphere : public SceneObject {
 public:
 	Sphere(glm::vec3 p, float r, ofColor diffuse = ofColor::lightGray) { position = p; radius = r; diffuseColor = diffuse; }
 	Sphere() {}
-	bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
-		return (glm::intersectRaySphere(ray.p, ray.d, position, radius, point, normal));
-	}
+	//  repeated copies only exist in the flat scene
+	bool analytic() const { return !repetition.enabled(); }
+	bool intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const;
 	void draw() {
 		ofDrawSphere(position, radius);
 	}
@@ -56,16 +116,13 @@ public:
 
 
 	//rayMarching stuff
-	float sdf(const glm::vec3& p) {
+	float sdf(const glm::vec3& p) const {
 		return glm::length(position - p) - radius;
 	}
-};
-
-//  Mesh class (will complete later- this will be a refinement of Mesh from Project 1)
-//
-class Mesh : public SceneObject {
-	bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) { return false; }
-	void draw() { }
+	void compile(CompiledScene& out, int index) const {
+		SpherePrim s = { position, radius, index };
+		out.spheres.push_back(s);
+	}
 };
 
 //  General purpose plane 
@@ -81,7 +138,8 @@ public:
 	}
 	Plane() { }
 	glm::vec3 normal = glm::vec3(0, 1, 0);
-	bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal);
+	bool analytic() const { return true; }
+	bool intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const;
 	void draw() {
 		plane.setPosition(position);
 		plane.setWidth(width);
@@ -94,80 +152,104 @@ public:
 	float height = 20;
 
 	//RayMarching stuff
-	float sdf(const glm::vec3& p)
+	float sdf(const glm::vec3& p) const
 	{
-		return p.y - plane.getY();
+		return p.y - position.y;    // as intersect() and compile(); plane only follows position in draw()
+	}
+	void compile(CompiledScene& out, int index) const {
+		PlanePrim pl = { position.y, index };
+		out.planes.push_back(pl);
 	}
 };
 
+//  Base class for primitives that are positioned and rotated in the scene.
+//  The world -> local transform is cached and only rebuilt by updateTransform()
+//  when position or rotation changed since the last call, so sdf() costs one
+//  matrix-vector multiply instead of building and inverting two mat4s.
+//
+class TransformedObject : public SceneObject {
+public:
+	glm::vec3 rotation;
+
+	glm::mat4 getRotateMatrix() const {
+		return (glm::eulerAngleXYZ(glm::radians(rotation.y), glm::radians(rotation.x), glm::radians(rotation.z)));   // yaw, pitch, roll 
+	}
+	glm::mat4 getTranslateMatrix() const {
+		return (glm::translate(glm::mat4(1.0), glm::vec3(position.x, position.y, position.z)));
+	}
+
+	//  object space = inverse(translate * rotate), i.e. undo the translation first
+	//  then the rotation. the rotation part is orthonormal so its inverse is its transpose.
+	void updateTransform() {
+		if (transformValid && position == cachedPosition && rotation == cachedRotation)
+			return;
+		toLocal.rotate = glm::transpose(glm::mat3(getRotateMatrix()));
+		toLocal.translate = -(toLocal.rotate * position);
+		cachedPosition = position;
+		cachedRotation = rotation;
+		transformValid = true;
+	}
+	glm::vec3 toObjectSpace(const glm::vec3& p) const { return toLocal.apply(p); }
+
+protected:
+	AffineTransform toLocal;
+
+private:
+	glm::vec3 cachedPosition, cachedRotation;
+	bool transformValid = false;
+};
+
 //Torus
 //
-class Torus : public SceneObject {
+class Torus : public TransformedObject {
 public:
 	Torus(glm::vec3 p, glm::vec2 t, ofColor diffuse = ofColor::lightGray, glm::vec3 rot = glm::vec3(20,45,0)) {
 		position = p;
 		this->t = t;
 		diffuseColor = diffuse;
 		rotation = rot;
+		updateTransform();
 	}
-	Torus() {};
-	bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
-		return false;
-	}
+	Torus() { updateTransform(); };
 	void draw() {
 		ofDrawSphere(position, 1);
 	}
 
 	glm::vec2 t = glm::vec2(1, 2);
-	glm::vec3 rotation;
-
-	glm::mat4 getRotateMatrix() {
-		return (glm::eulerAngleXYZ(glm::radians(rotation.y), glm::radians(rotation.x), glm::radians(rotation.z)));   // yaw, pitch, roll 
-	}
-	glm::mat4 getTranslateMatrix() {
-		return (glm::translate(glm::mat4(1.0), glm::vec3(position.x, position.y, position.z)));
-	}
 
 	//rayMarching stuff
-	float sdf(const glm::vec3& p) {
-		glm::vec4 temp = glm::inverse(getTranslateMatrix()) * glm::inverse(getRotateMatrix()) * glm::vec4(p, 1);
+	float sdf(const glm::vec3& p) const {
+		glm::vec3 temp = toObjectSpace(p);
 		
 		glm::vec2 q = glm::vec2(glm::length(glm::vec2(temp.x, temp.y)) - t.x, temp.z);
 		return glm::length(q) - t.y;
 	}
+	void compile(CompiledScene& out, int index) const {
+		TorusPrim tp = { toLocal, t, index };
+		out.tori.push_back(tp);
+	}
 };
 
 //HollowSphere
 //
-class HollowSphere : public SceneObject {
+class HollowSphere : public TransformedObject {
 public:
 	HollowSphere(glm::vec3 p, ofColor diffuse = ofColor::lightGray, glm::vec3 rot = glm::vec3(20, -45, 0)) {
 		position = p;
-		this->rht = rht;
 		diffuseColor = diffuse;
 		rotation = rot;
+		updateTransform();
 	}
-	HollowSphere() {};
-	bool intersect(const Ray& ray, glm::vec3& point, glm::vec3& normal) {
-		return false;
-	}
+	HollowSphere() { updateTransform(); };
 	void draw() {
 		ofDrawSphere(position, 1);
 	}
 
 	glm::vec3 rht = glm::vec3(0.1, 0.05, 0.05);
-	glm::vec3 rotation;
-
-	glm::mat4 getRotateMatrix() {
-		return (glm::eulerAngleXYZ(glm::radians(rotation.y), glm::radians(rotation.x), glm::radians(rotation.z)));   // yaw, pitch, roll 
-	}
-	glm::mat4 getTranslateMatrix() {
-		return (glm::translate(glm::mat4(1.0), glm::vec3(position.x, position.y, position.z)));
-	}
 
 	//rayMarching stuff
-	float sdf(const glm::vec3& p) {
-		glm::vec4 temp = glm::inverse(getRotateMatrix()) * glm::inverse(getTranslateMatrix()) * glm::vec4(p, 1);
+	float sdf(const glm::vec3& p) const {
+		glm::vec3 temp = toObjectSpace(p);
 
 		glm::vec2 q = glm::vec2(glm::length(glm::vec2(temp.x, temp.y)), temp.z);
 
@@ -175,6 +257,71 @@ public:
 		
 		return ((rht.y * q.x < w* q.y) ? length(q - glm::vec2(w, rht.y)) : abs(glm::length(q) - rht.x)) - rht.z;
 	}
+	void compile(CompiledScene& out, int index) const {
+		HollowSpherePrim hs = { toLocal, rht, sqrt(rht.x * rht.x - rht.y * rht.y), index };
+		out.hollowSpheres.push_back(hs);
+	}
+};
+
+//  Triangle mesh (TriMesh, loaded from OBJ or PLY) scaled so its longest
+//  side is size and centred on position. Copies of the object share the
+//  mesh data.
+//
+class Mesh : public TransformedObject {
+public:
+	Mesh(shared_ptr<TriMesh> data, glm::vec3 p, float size, ofColor diffuse = ofColor::lightGray, glm::vec3 rot = glm::vec3(0)) {
+		this->data = data;
+		position = p;
+		this->size = size;
+		diffuseColor = diffuse;
+		rotation = rot;
+		updateTransform();
+	}
+	Mesh() { updateTransform(); };
+	//  repeated copies only exist in the flat scene
+	bool analytic() const { return data && !repetition.enabled(); }
+	bool intersect(const Ray& ray, float tMin, float tMax, float& t, glm::vec3& normal) const;
+	void draw() {
+		ofDrawBox(position, size);
+	}
+
+	shared_ptr<TriMesh> data;
+	float size = 2;
+
+	//rayMarching stuff
+	float sdf(const glm::vec3& p) const;
+	void compile(CompiledScene& out, int index) const;
+
+private:
+	MeshPrim placement() const;
+};
+
+//  CSG model (see CsgTree), placed and rotated like the other primitives.
+//  The whole tree is a single entry of the flat scene, evaluated by the
+//  CompiledScene stack machine.
+//
+class CsgObject : public TransformedObject {
+public:
+	CsgObject(glm::vec3 p, ofColor diffuse = ofColor::lightGray, glm::vec3 rot = glm::vec3(0)) {
+		position = p;
+		diffuseColor = diffuse;
+		rotation = rot;
+		updateTransform();
+	}
+	CsgObject() { updateTransform(); };
+	void draw() {
+		ofDrawSphere(position, 1);
+	}
+
+	CsgTree tree;
+
+	//rayMarching stuff
+	float sdf(const glm::vec3& p) const {
+		return tree.sdf(toObjectSpace(p));
+	}
+	void compile(CompiledScene& out, int index) const {
+		compileCsg(tree, toLocal, index, out);
+	}
 };
 
 // view plane for render camera
@@ -191,19 +338,19 @@ public:
 	}
 
 	void setSize(glm::vec2 min, glm::vec2 max) { this->min = min; this->max = max; }
-	float getAspect() { return width() / height(); }
+	float getAspect() const { return width() / height(); }
 
-	glm::vec3 toWorld(float u, float v);   //   (u, v) --> (x, y, z) [ world space ]
+	glm::vec3 toWorld(float u, float v) const;   //   (u, v) --> (x, y, z) [ world space ]
 
 	void draw() {
 		ofDrawRectangle(glm::vec3(min.x, min.y, position.z), width(), height());
 	}
 
 
-	float width() {
+	float width() const {
 		return (max.x - min.x);
 	}
-	float height() {
+	float height() const {
 		return (max.y - min.y);
 	}
 
@@ -234,7 +381,7 @@ public:
 		position = glm::vec3(0, 0, 10);
 		aim = glm::vec3(0, 0, -1);
 	}
-	Ray getRay(float u, float v);
+	Ray getRay(float u, float v) const;
 	void draw() { ofDrawBox(position, 1.0); };
 	void drawFrustum();
 
@@ -261,8 +408,11 @@ class ofApp : public ofBaseApp {
 
 public:
 	void setup();
+	void setupScene();
+	void useDefaultSettings();
 	void update();
 	void draw();
+	void exit();
 
 	void keyPressed(int key);
 	void keyReleased(int key);
@@ -275,22 +425,95 @@ public:
 	void windowResized(int w, int h);
 	void dragEvent(ofDragInfo dragInfo);
 	void gotMessage(ofMessage msg);
-	void rayTrace();
+	bool rayTrace();   // false when the image cannot be saved
+	void traceTile(int x0, int y0, int x1, int y1, HdrImage& frame, GBuffer* gbuffer = nullptr) const;
+	glm::vec3 traceRay(const Ray& ray, GBufferTexel* texel = nullptr) const;
+	bool closestHit(const Ray& ray, float tMin, float tMax, HitRecord& hit, glm::vec3& normal) const;
+	bool traceObject(int k, const Ray& ray, float tMin, float tMax, float& t, int& steps) const;
 	void drawGrid();
 	void drawAxis(glm::vec3 position);
-	bool rayMarching(Ray r, glm::vec3& p);
-	void rayMarchLoop();
-	float opRep(const glm::vec3& p, SceneObject* obj);
+	bool rayMarching(Ray r, glm::vec3& p) const;
+	bool rayMarching(Ray r, HitRecord& hit, float tStart = 0, const PrimSpan* prims = nullptr) const;
+	bool rayMarchLoop();   // false when the image cannot be saved
 
-	glm::vec3 getNormalRM(const glm::vec3& p);
-	float sceneSDF(const glm::vec3 p, int& objIndex); 
+	//  background progressive render, restarted when a setting changes
+	//
+	enum RenderMode { RENDER_MARCH, RENDER_TRACE };
+	void startRender(RenderMode mode);
+	void stopRender();
+	void restartRender();
+	void renderJob(RenderMode mode);
+	void startAntialias();
+	void antialiasJob(RenderMode mode);
+	void previewTile(int x0, int y0, int x1, int y1, HdrImage& frame, int block) const;
+	void publishTile(int x0, int y0, int x1, int y1);
+	void saveRender();
+	void reshadeRender();
+	void reshadeTile(int x0, int y0, int x1, int y1, HdrImage& frame, bool recastShadows);
+	void retoneRender();
+	bool renderStrips(RenderMode mode, const string& path, int stripRows);
+	vector<float> renderSettings() const;
+	vector<float> lightSettings() const;
+	vector<float> shadowSettings() const;
+	vector<float> antiAliasSettings() const;
+	vector<float> toneMapSettings() const;
+
+	//  adaptive anti-aliasing, see AntiAliasSettings
+	//
+	void antialiasPass(RenderMode mode, HdrImage& frame, bool publish);
+	long long antialiasTile(int x0, int y0, int x1, int y1, RenderMode mode, const HdrImage& base,
+		HdrImage& frame, int& refined) const;
+	bool needsAntiAlias(int x, int y, const HdrImage& base) const;
+	glm::vec3 pixelSample(RenderMode mode, int i, int j, int n) const;
+	void compareAntiAlias();
+	long long marchTile(int x0, int y0, int x1, int y1, HdrImage& frame, bool usePackets, GBuffer* gbuffer = nullptr) const;
+	glm::vec3 shadeRM(const HitRecord& hit, GBufferTexel* texel = nullptr) const;
+	void comparePacketMarch();
+	void compareMarchStrategies();
+	float coneMarch(int i0, int j0, int i1, int j1, float tStart, int& steps, const PrimSpan* prims = nullptr) const;
+	long long conePrepass(int x0, int y0, int x1, int y1, vector<float>& startT, const TileCuller* culler = nullptr) const;
+	void compareConePrepass();
+	void compareTileCulling();
+	float pixelConeRadius() const;
+	void updateMarchSettings();
+	float opRep(const glm::vec3& p, const SceneObject* obj) const;
+	ofColor objectColor(int objIndex, const glm::vec3& p) const;
+
+	glm::vec3 getNormalRM(const glm::vec3& p) const;
+	glm::vec3 getNormalRM(const HitRecord& hit) const;
+	float sceneSDF(const glm::vec3 p, int& objIndex) const; 
+	float sceneSDF(const glm::vec3& p, int& objIndex, const PrimSpan& prims) const;
+	float marchSDF(const glm::vec3& p, int& objIndex, float threshold, const PrimSpan* prims = nullptr) const;
+	Bounds distanceCacheRegion() const;
+	bool usePacketMarcher() const;
+	float sceneSDFVirtual(const glm::vec3 p, int& objIndex) const;
+	void compileScene();
+	void setupCsgScene();
+	bool setupMeshScene(const string& path);
+	bool loadScene(const string& path);
+	void setupStaticScene();
+	int applyScene(const SceneDesc& desc);
+	bool applySetting(const string& name, float value);
+	void sdfThroughput();
 
 	void progressBar(float progress, int& prevPos);
 
-	ofColor lambert(const glm::vec3& p, const glm::vec3& n, const ofColor diffuse);
-	ofColor phong(const glm::vec3& p, const glm::vec3& norm, const ofColor diffuse,
-		const ofColor specular, float power);
-	bool inShadow(Ray r);
+	//  tile scheduler - splits the image (or its render rows rowBegin..rowEnd,
+	//  -1 = to the end) into tileSize x tileSize blocks and runs
+	//  renderTile(x0, y0, x1, y1) for each of them on the thread pool.
+	//  everything called from renderTile must be const / only write its own pixels.
+	//
+	void renderTiles(std::function<void(int, int, int, int)> renderTile, int rowBegin = 0, int rowEnd = -1);
+	ThreadPool& getPool();
+	void updateLights();
+
+	ofColor lambert(const glm::vec3& p, const glm::vec3& n, const ofColor diffuse) const;
+	glm::vec3 phong(const glm::vec3& p, const glm::vec3& norm, const ofColor diffuse,
+		const ofColor specular, float power, const float* visibilities = nullptr) const;
+	float displayLuminance(const glm::vec3& color) const;
+	int displayDifference(const HdrImage& a, const HdrImage& b, int x, int y) const;
+	float lightVisibility(const glm::vec3& p, const glm::vec3& norm, int i) const;
+	float shadowRay(const glm::vec3& origin, const glm::vec3& lightPos) const;
 
 	bool bHide = true;
 	bool bShowImage = false;
@@ -306,15 +529,59 @@ public:
 	ofImage image;
 
 	vector<SceneObject*> scene;
+	CompiledScene compiled;    // flat copy of scene used by sceneSDF, see compileScene()
+	SceneFile sceneFile;       // watched by update(), edits reload it
+	vector<ObjectDesc> sceneObjects;   // what applyScene made each scene entry from, empty for other scenes
+	float sceneCheckTime = 0;
+	//  set by setupStaticScene: rayMarching marches this compiled-in scene
+	//  (staticMarch over a StaticScene type) instead of calling sceneSDF. scene
+	//  holds the same objects for shading and everything else. marchTile skips
+	//  tile culling and the cone pre-pass while it is set
+	std::function<bool(const glm::vec3& origin, const glm::vec3& dir, float tStart, HitRecord& hit)> staticMarcher;
+	PacketMarcher packetMarcher;
+	MarchSettings march;
+	DistanceCache distanceCache;   // baked by compileScene() while march.distanceCache is on
+	AntiAliasSettings antiAlias;
+#ifdef RAYMARCH_STATS
+	mutable MarchStats stats;  // filled by marchTile (const, every tile writes only its own pixels)
+#endif
 
 	int imageWidth = 1200;
 	int imageHeight = 800;
+	string outputPath = "Output.png";
+
+	int numThreads = 0;       // render threads, 0 = one per hardware thread
+	int tileSize = 32;
+	float phongPower = 30;    // powerSlider, copied by updateLights() for the render threads
+	bool verbose = true;      // progress bar and timings on cout
+	std::unique_ptr<ThreadPool> pool;
 
 	vector<Light> lights;
+	LightPack lightPack;      // lights[1..] for shadeLights, see updateLights()
+	ToneMapSettings toneMapping;
+
+	std::thread renderThread;
+	std::atomic<bool> renderCancelled{ false };
+	bool renderActive = false;        // a render was started, setting changes restart it
+	RenderMode renderMode = RENDER_MARCH;
+	vector<float> jobSettings;        // renderSettings() the running job started with
+	vector<float> jobLights, jobShadows, jobAntiAlias, jobToneMap;
+	std::atomic<bool> renderDone{ false };   // the full resolution pass finished, gbuffer and baseFrame are complete
+	std::atomic<bool> antialiasDone{ false };    // and the anti-aliasing pass after it
+	GBuffer gbuffer;
+	HdrImage workFrame;               // written by the tile workers
+	HdrImage baseFrame;               // one ray per pixel, before anti-aliasing
+	ofPixels displayPixels;           // finished tiles tone mapped, guarded by displayLock
+	std::mutex displayLock;
+	std::atomic<int> renderVersion{ 0 };
+	int uploadedVersion = 0;
+	ofTexture renderTexture;
 
 	ofxPanel gui;
-	ofxIntSlider powerSlider;
+	ofxIntSlider powerSlider, threadSlider, strategySlider;
 	ofxFloatSlider ambientLightSlider, lightIntensitySlider1,
-		lightIntensitySlider2, lightIntensitySlider3;
+		lightIntensitySlider2, lightIntensitySlider3, penumbraSlider, aaContrastSlider, exposureSlider;
+	ofxIntSlider aaSamplesSlider;
+	ofxToggle packetToggle, coneToggle, shadowToggle, aaToggle, reinhardToggle, cacheToggle, cullToggle;
 };
 